@@ -0,0 +1,93 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "context_pool.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Renders many small images from a fixed number of threads, sharing a
+ *  single tape, with pools of different sizes.  A pool of one context
+ *  serializes the renders, which is the baseline; larger pools print their
+ *  speedup over it.  Renders only synchronize their own thread's stream,
+ *  so small renders (which don't fill the GPU) should overlap and scale
+ *  until the GPU is saturated.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    const int num_threads = 8;
+    const int renders_per_thread = 16;
+    const int size = 256;
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    double baseline = 0.0;
+    for (unsigned n : {1, 2, 4, 8}) {
+        mpr::ContextPool pool(n);
+        std::cout << "Pool of " << pool.max_contexts << ": ";
+        const double mean = get_stats([&](){
+            std::vector<std::thread> threads;
+            for (int i=0; i < num_threads; ++i) {
+                threads.emplace_back([&](){
+                    for (int j=0; j < renders_per_thread; ++j) {
+                        auto ctx = pool.lease(size);
+                        ctx->render3D(tape, T);
+                    }
+                });
+            }
+            for (auto& th : threads) {
+                th.join();
+            }
+        }, 2, 10);
+        if (n == 1) {
+            baseline = mean;
+        }
+        std::cout << "Pool of " << pool.max_contexts << " speedup "
+                  << baseline / mean << "x ("
+                  << num_threads * renders_per_thread * 1000.0 / mean
+                  << " renders/s)\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <iostream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Cycles through a set of image sizes, rendering once at each size, and
+ *  compares building a new Context for each size against resizing one.
+ */
+int main(int, char**)
+{
+    auto X = libfive::Tree::X();
+    auto Y = libfive::Tree::Y();
+    auto Z = libfive::Tree::Z();
+    auto t = sqrt(X*X + Y*Y + Z*Z) - 0.5;
+    auto tape = mpr::Tape(t);
+
+    const int sizes[] = {256, 1024, 512, 2048};
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+
+    std::cout << "New context per size: ";
+    get_stats([&](){
+        for (int s : sizes) {
+            auto c = mpr::Context(s);
+            c.render3D(tape, T);
+        }
+    }, 2, 10);
+
+    std::cout << "Resized context: ";
+    auto c = mpr::Context(sizes[0]);
+    get_stats([&](){
+        for (int s : sizes) {
+            c.resize(s);
+            c.render3D(tape, T);
+        }
+    }, 2, 10);
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <memory>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "bounds.hpp"
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Infers a model's bounding box, then compares rendering with the default
+ *  (identity) view against rendering with a view fitted to that box,
+ *  printing timing and the number of filled pixels for each.
+ *
+ *  With no model, this uses a small sphere in one corner of the volume.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc == 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = sqrt((X - 0.6)*(X - 0.6) + (Y - 0.5)*(Y - 0.5) + Z*Z) - 0.2;
+    }
+
+    auto tape = mpr::Tape(t);
+    auto c = mpr::Context(1024);
+
+    std::unique_ptr<mpr::Bounds> bounds;
+    std::cout << "Bounds inference ";
+    get_stats([&](){ bounds.reset(new mpr::Bounds(tape, c)); }, 5, 20);
+    if (bounds->empty) {
+        std::cout << "Model is empty\n";
+        return 0;
+    }
+    std::cout << "Bounds: [" << bounds->lower.transpose() << "] - ["
+              << bounds->upper.transpose() << "]\n";
+
+    const Eigen::Matrix4f fitted = bounds->fitView(c);
+    for (const auto& T : {Eigen::Matrix4f(Eigen::Matrix4f::Identity()),
+                          fitted})
+    {
+        const bool is_fitted = (T == fitted);
+        std::cout << (is_fitted ? "fitted " : "default ");
+        get_stats([&](){ c.render3D(tape, T); });
+
+        uint32_t filled = 0;
+        for (int i=0; i < c.image_width_px * c.image_height_px; ++i) {
+            filled += (c.stages[3].filled[i] != 0);
+        }
+        std::cout << (is_fitted ? "fitted " : "default ")
+                  << filled << " filled pixels\n";
+    }
+
+    // A 16:9 image spans less than [-1, 1] vertically, so its fitted view
+    // is scaled by the aspect ratio (rather than clipping the box).
+    auto wide = mpr::Context(1920, 1080);
+    const Eigen::Matrix4f wide_fitted = bounds->fitView(wide);
+    std::cout << "wide fitted ";
+    get_stats([&](){ wide.render3D(tape, wide_fitted); });
+    uint32_t filled = 0;
+    for (int i=0; i < wide.image_width_px * wide.image_height_px; ++i) {
+        filled += (wide.stages[3].filled[i] != 0);
+    }
+    std::cout << "wide fitted " << filled << " filled pixels\n";
+    return 0;
+}
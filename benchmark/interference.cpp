@@ -0,0 +1,54 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <memory>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+
+#include "context.hpp"
+#include "interference.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Checks two spheres of radius 0.25 for interference, as they're moved
+ *  closer together (they touch at a separation of 0.5), printing timing
+ *  and the result of each check.
+ */
+int main(int, char**)
+{
+    auto X = libfive::Tree::X();
+    auto Y = libfive::Tree::Y();
+    auto Z = libfive::Tree::Z();
+
+    const char* names[] = {"disjoint", "possible", "confirmed"};
+    auto c = mpr::Context(256);
+    for (float d : {0.7f, 0.55f, 0.51f, 0.5f, 0.49f, 0.45f, 0.3f}) {
+        auto a = mpr::Tape(sqrt((X + d / 2)*(X + d / 2) + Y*Y + Z*Z) - 0.25);
+        auto b = mpr::Tape(sqrt((X - d / 2)*(X - d / 2) + Y*Y + Z*Z) - 0.25);
+
+        std::unique_ptr<mpr::Interference> result;
+        std::cout << d << " ";
+        get_stats([&](){ result.reset(new mpr::Interference(a, b, c, 8)); },
+                  5, 20);
+        std::cout << d << " " << names[result->result];
+        if (result->result != mpr::Interference::DISJOINT) {
+            std::cout << " in [" << result->overlap_lower.transpose()
+                      << "] - [" << result->overlap_upper.transpose() << "]";
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
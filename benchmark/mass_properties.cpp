@@ -0,0 +1,84 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "integrate.hpp"
+#include "octree.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Computes volume (from octrees of increasing depth) and area (from 2D
+ *  renders of increasing resolution), printing timing, the results, and
+ *  their error bounds.
+ *
+ *  With no model, this uses two spheres of radius 0.25, which have a volume
+ *  of 0.1309 and a cross-sectional area (at z = 0) of 0.3927.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc == 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    mpr::Integrator integrator;
+
+    auto c = mpr::Context(256);
+    for (int depth=4; depth <= 7; ++depth) {
+        mpr::Octree octree(tape, c, depth);
+        mpr::MassProperties p;
+        std::cout << "depth " << depth << " volume ";
+        get_stats([&](){ p = integrator.volume(octree); });
+        std::cout << "depth " << depth << ": " << p.volume << " +/- "
+                  << p.error << ", centroid " << p.centroid.transpose()
+                  << ", inertia diagonal " << p.inertia.diagonal().transpose()
+                  << "\n";
+    }
+
+    const Eigen::Matrix3f T = Eigen::Matrix3f::Identity();
+    for (int size : {256, 512, 1024, 2048}) {
+        auto c = mpr::Context(size);
+        mpr::MassProperties p;
+        std::cout << size << " area ";
+        get_stats([&](){
+            c.render2D(tape, T);
+            p = integrator.area(c, T);
+        });
+        std::cout << size << ": " << p.volume << " +/- " << p.error
+                  << ", centroid " << p.centroid.head<2>().transpose() << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares renders with GPU-only buffers (the tape buffer, tile lists, and
+ *  intermediate stages) left as plain managed memory, which is faulted onto
+ *  the GPU during the first render, against placing and prefetching them
+ *  on the GPU when they're allocated.  The first render in a new context
+ *  shows the difference most clearly.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = sqrt(X*X + Y*Y + Z*Z) - 0.5;
+    }
+
+    auto tape = mpr::Tape(t);
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    for (bool prefer : {false, true}) {
+        cudaSetPreferDevice(prefer);
+        std::cout << (prefer ? "Prefetched to GPU:\n" : "Plain managed:\n");
+
+        // Time the first render in a fresh context, which touches every
+        // buffer for the first time
+        auto start = std::chrono::steady_clock::now();
+        auto c = mpr::Context(2048);
+        c.render3D(tape, T);
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "    First render (including allocation): "
+                  << std::chrono::duration<double, std::milli>(
+                          end - start).count() << " ms\n";
+
+        std::cout << "    Later renders: ";
+        get_stats([&](){ c.render3D(tape, T); });
+    }
+    cudaSetPreferDevice(true);
+
+    return 0;
+}
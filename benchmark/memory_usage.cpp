@@ -0,0 +1,79 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "effects.hpp"
+#include "tape.hpp"
+
+/*
+ *  Prints the memory held by a context at each step of a small session:
+ *  after construction, after a large render, and after trimming back down
+ *  to a small image.  This isn't timed; it's a report for capacity planning.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = sqrt(X*X + Y*Y + Z*Z) - 0.5;
+    }
+
+    auto tape = mpr::Tape(t);
+    std::cout << "Tape:\n";
+    tape.memoryUsage().print();
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    auto c = mpr::Context(256);
+    mpr::Effects effects;
+    std::cout << "\nContext (256^2, before rendering):\n";
+    c.memoryUsage().print();
+
+    c.resize(2048);
+    c.render3D(tape, T);
+    effects.drawShaded(c);
+    std::cout << "\nContext (2048^2, after rendering):\n";
+    c.memoryUsage().print();
+    std::cout << "\nEffects (2048^2):\n";
+    effects.memoryUsage().print();
+
+    c.resize(256);
+    c.trim();
+    c.render3D(tape, T);
+    std::cout << "\nContext (trimmed to 256^2, after rendering):\n";
+    c.memoryUsage().print();
+
+    std::cout << "\nAll CUDA allocations: " << cudaBytesAllocated()
+              << " bytes (peak " << cudaPeakBytesAllocated() << ")\n";
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "profile.hpp"
+#include "tape.hpp"
+
+/*
+ *  Renders a model once in 2D and once in 3D, then prints which opcodes
+ *  and clauses were executed the most in each stage, and how often min/max
+ *  clauses pruned a branch.  This only collects data in builds with the
+ *  MPR_PROFILE CMake option turned on.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    auto c = mpr::Context(1024);
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    mpr::Profile::reset();
+    c.render2D(tape, Eigen::Matrix3f::Identity());
+    c.render3D(tape, T);
+    mpr::Profile::collect("(other)");
+    mpr::Profile::report(tape);
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+#include "trace.hpp"
+
+/*
+ *  Records hardware performance counters for the host-side stages of tape
+ *  construction (with and without scheduling, and with parallel DFS) and
+ *  rendering, then prints per-stage totals and writes the events (with
+ *  counters as arguments) to perf_counters.json.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+    const char* filename = (argc >= 3) ? argv[2] : "perf_counters.json";
+
+    // Warm-up, so that the first trace doesn't include page faults
+    for (unsigned i=0; i < 10; ++i) {
+        auto r = mpr::Tape(t);
+    }
+
+    mpr::Trace::start(true);
+    for (unsigned i=0; i < 20; ++i) {
+        auto r = mpr::Tape(t);
+    }
+    for (unsigned i=0; i < 20; ++i) {
+        auto r = mpr::Tape(t, 1, false);
+    }
+    for (unsigned i=0; i < 20; ++i) {
+        auto r = mpr::Tape(t, 4);
+    }
+
+    auto tape = mpr::Tape(t);
+    auto c = mpr::Context(1024);
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+    for (unsigned i=0; i < 20; ++i) {
+        c.render2D(tape, Eigen::Matrix3f::Identity());
+        c.render3D(tape, T);
+    }
+
+    if (!mpr::Trace::stop(filename)) {
+        return 1;
+    }
+    mpr::Trace::summary();
+    std::cout << "\nWrote events to " << filename << "\n";
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "octree.hpp"
+#include "query.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Measures batch point-query throughput, comparing a depth-0 octree (which
+ *  evaluates every point with the root tape) against deeper octrees (which
+ *  classify points in empty / filled cells for free, and evaluate the rest
+ *  with pruned tapes).  Ray casting is timed the same way.
+ *
+ *  Usage: query_points [model.frep]
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc == 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    auto c = mpr::Context(256);
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<Eigen::Vector3f> pts(1 << 22);
+    for (auto& p : pts) {
+        p = Eigen::Vector3f(dist(rng), dist(rng), dist(rng));
+    }
+    std::cout << pts.size() << " random points\n";
+
+    // Rays from random points on a sphere, aimed at random points near
+    // the center of the model
+    std::vector<Eigen::Vector3f> ray_origins(4096);
+    std::vector<Eigen::Vector3f> ray_dirs(ray_origins.size());
+    for (uint32_t i=0; i < ray_origins.size(); ++i) {
+        Eigen::Vector3f o(dist(rng), dist(rng), dist(rng));
+        ray_origins[i] = o.normalized() * 2.0f;
+        const Eigen::Vector3f target(dist(rng), dist(rng), dist(rng));
+        ray_dirs[i] = target * 0.25f - ray_origins[i];
+    }
+
+    std::vector<uint8_t> expected;
+    for (int depth : {0, 4, 5, 6, 7}) {
+        mpr::Octree octree(tape, c, depth);
+        mpr::Query q(octree);
+
+        std::cout << "depth " << depth << " contains ";
+        get_stats([&](){ q.contains(pts); }, 5, 20);
+        std::cout << "depth " << depth << " evaluated "
+                  << q.num_evaluated << " points\n";
+
+        if (depth == 0) {
+            expected.assign(q.inside.get(), q.inside.get() + pts.size());
+        } else {
+            uint32_t mismatched = 0;
+            for (uint32_t i=0; i < pts.size(); ++i) {
+                mismatched += (q.inside[i] != expected[i]);
+            }
+            std::cout << "depth " << depth << " mismatched "
+                      << mismatched << "\n";
+        }
+
+        std::cout << "depth " << depth << " distance ";
+        get_stats([&](){ q.distance(pts); }, 5, 20);
+        std::cout << "depth " << depth << " gradient ";
+        get_stats([&](){ q.gradient(pts); }, 5, 20);
+
+        std::cout << "depth " << depth << " raycast ";
+        get_stats([&](){ q.raycast(ray_origins, ray_dirs); }, 5, 20);
+        uint32_t ray_hits = 0;
+        for (uint32_t i=0; i < ray_origins.size(); ++i) {
+            ray_hits += (q.hits[i].w >= 0.0f);
+        }
+        std::cout << "depth " << depth << " rays hit " << ray_hits << " / "
+                  << ray_origins.size() << "\n";
+    }
+    return 0;
+}
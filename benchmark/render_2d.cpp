@@ -53,7 +53,10 @@ int main(int argc, char **argv)
         }
     }
 
-    auto tape = mpr::Tape(t);
+    // Fold in z = 0 once, before rendering, so that tiles only evaluate
+    // clauses which depend on X and Y.
+    auto full = mpr::Tape(t);
+    auto tape = mpr::Tape(full, 2, 0.0f);
     auto c = mpr::Context(resolution);
 
     c.render2D(tape, Eigen::Matrix3f::Identity(), 0.0f);
@@ -0,0 +1,110 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+#include <libfive/render/discrete/heightmap.hpp>
+
+#include "tape.hpp"
+#include "context.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares render3D (voxel scan in the last stage) against render3D_sphere
+ *  (sphere tracing in the last stage), printing timing for each and the
+ *  number of pixels where the two depth images disagree.
+ *
+ *  Usage: render_3d_sphere [model.frep [lipschitz]]
+ *
+ *  The built-in model is a true distance field, so it's traced with a
+ *  Lipschitz constant of 1.  Models loaded from a file need a constant on
+ *  the command line (run_benchmarks.sh declares one for gears); without
+ *  one, render3D_sphere uses the same voxel scan as render3D, so only the
+ *  timing is printed.  A non-zero `mismatched` count means that the model
+ *  doesn't actually satisfy the declared constant, so the tracer stepped
+ *  past thin features.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    float lipschitz = 0.0f;
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+        if (argc >= 3) {
+            lipschitz = std::stof(argv[2]);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+        lipschitz = 1.0f;
+    }
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    const std::vector<int> sizes = {256, 512, 1024, 1536, 2048};
+    for (auto size: sizes) {
+        auto tape = mpr::Tape(t);
+        auto c = mpr::Context(size);
+
+        std::cout << size << " voxels ";
+        auto mean = get_stats([&](){ c.render3D(tape, T); });
+        std::vector<int32_t> expected(c.stages[3].filled.get(),
+                                      c.stages[3].filled.get() + size * size);
+
+        std::cout << size << " sphere ";
+        get_stats([&](){ c.render3D_sphere(tape, T, lipschitz); });
+
+        if (lipschitz > 0.0f) {
+            uint32_t mismatched = 0;
+            for (int i=0; i < size * size; ++i) {
+                mismatched += (c.stages[3].filled[i] != expected[i]);
+            }
+            std::cout << size << " mismatched " << mismatched << "\n";
+        }
+
+        libfive::Heightmap out(size, size);
+        uint32_t i = 0;
+        for (int x=0; x < size; ++x) {
+            for (int y=0; y < size; ++y) {
+                out.depth(x, y) = c.stages[3].filled[i];
+                out.norm(x, y) = c.normals[i];
+                ++i;
+            }
+        }
+        out.savePNG("out_gpu_depth_sphere_" + std::to_string(size) + ".png");
+        out.saveNormalPNG("out_gpu_norm_sphere_" + std::to_string(size) + ".png");
+
+        if (mean > 750) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <memory>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "octree.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Renders a model from 24 different views, both from the root tape and
+ *  from a world-space octree of pruned tapes, to measure how much work is
+ *  saved by reusing pruning across views.
+ *
+ *  Usage: render_3d_views [model.frep] [resolution] [octree cache file]
+ *
+ *  If a cache file is given, the octree is loaded from it (if it exists)
+ *  or saved into it (otherwise).
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    int resolution = 1024;
+    if (argc >= 3) {
+        errno = 0;
+        resolution = strtol(argv[2], NULL, 10);
+        if (errno || resolution == 0) {
+            fprintf(stderr, "Could not parse resolution '%s'\n",
+                    argv[2]);
+            exit(1);
+        }
+    }
+
+    auto tape = mpr::Tape(t);
+    auto c = mpr::Context(resolution);
+
+    std::unique_ptr<mpr::Octree> octree;
+    if (argc >= 4) {
+        std::ifstream ifs(argv[3], std::ios::binary);
+        if (ifs.is_open()) {
+            octree = mpr::Octree::load(ifs);
+            if (!octree) {
+                fprintf(stderr, "Could not load octree from %s\n", argv[3]);
+                exit(1);
+            }
+            std::cout << "Loaded octree from " << argv[3] << "\n";
+        }
+    }
+    if (!octree) {
+        auto start = std::chrono::steady_clock::now();
+        octree.reset(new mpr::Octree(tape, c));
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "Building octree took " <<
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                    end - start).count() / 1000.0 << " ms\n";
+        if (argc >= 4) {
+            std::ofstream ofs(argv[3], std::ios::binary);
+            if (!octree->save(ofs)) {
+                fprintf(stderr, "Could not save octree to %s\n", argv[3]);
+                exit(1);
+            }
+        }
+    }
+    std::cout << "Octree has " << octree->tape_length << " clauses of tape"
+              << " (root tape is " << tape.length << ")\n";
+
+    // Print a table of per-view timing, comparing rendering from the root
+    // tape against rendering from the octree.
+    double total_tape = 0;
+    double total_octree = 0;
+    for (unsigned i=0; i < 24; ++i) {
+        const float yaw = 2 * M_PI * (i % 8) / 8.0f;
+        const float pitch = M_PI / 6.0f * (int(i / 8) - 1);
+
+        Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+        Eigen::Affine3f r(Eigen::AngleAxisf(yaw, Eigen::Vector3f::UnitY()) *
+                          Eigen::AngleAxisf(pitch, Eigen::Vector3f::UnitX()));
+        T.topLeftCorner<3, 3>() = r.linear();
+        T(3,2) = 0.3f;
+
+        std::cout << i << " tape ";
+        total_tape += get_stats([&](){ c.render3D(tape, T); }, 5, 20);
+        std::cout << i << " octree ";
+        total_octree += get_stats([&](){ c.render3D(*octree, T); }, 5, 20);
+    }
+    std::cout << "Mean per view: " << total_tape / 24 << " ms (tape), "
+              << total_octree / 24 << " ms (octree)\n";
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares rendering a 16:9 image directly against rendering the square
+ *  image which would otherwise be needed to cover it, in both 2D and 3D.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    const int width = 1920;
+    const int height = 1080;
+
+    auto wide = mpr::Context(width, height);
+    auto square = mpr::Context(width);
+
+    Eigen::Matrix3f T2 = Eigen::Matrix3f::Identity();
+    Eigen::Matrix4f T3 = Eigen::Matrix4f::Identity();
+    T3(3,2) = 0.3f;
+
+    std::cout << "2D " << width << "x" << height << " ";
+    get_stats([&](){ wide.render2D(tape, T2); });
+    std::cout << "2D " << width << "x" << width << " ";
+    get_stats([&](){ square.render2D(tape, T2); });
+
+    std::cout << "3D " << width << "x" << height << " ";
+    get_stats([&](){ wide.render3D(tape, T3); });
+    std::cout << "3D " << width << "x" << width << " ";
+    get_stats([&](){ square.render3D(tape, T3); });
+
+    // The wide image should match the middle rows of the square image
+    const int offset = (width - height) / 2;
+    int mismatched = 0;
+    for (int y=0; y < height; ++y) {
+        for (int x=0; x < width; ++x) {
+            mismatched += wide.stages[3].filled[x + y * width] !=
+                          square.stages[3].filled[x + (y + offset) * width];
+        }
+    }
+    std::cout << mismatched << " pixels differ from the square render\n";
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares 3D renders at full depth against renders with a coarser depth,
+ *  which subdivide Z into fewer tiles.  The coarse heightmaps are compared
+ *  against the full-depth heightmap (rescaled to the same depth).
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    const int size = 2048;
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    auto full = mpr::Context(size);
+    std::cout << "3D " << size << "^2 x " << size << " ";
+    get_stats([&](){ full.render3D(tape, T); });
+
+    for (int depth : {1024, 512, 256, 128}) {
+        auto c = mpr::Context(size, size, depth);
+        std::cout << "3D " << size << "^2 x " << depth << " ";
+        get_stats([&](){ c.render3D(tape, T); });
+
+        // Count pixels whose depth is off by more than one coarse voxel
+        // (which is expected where tiles straddle the surface)
+        int mismatched = 0;
+        for (int i=0; i < size * size; ++i) {
+            const int32_t a = full.stages[3].filled[i];
+            const int32_t b = c.stages[3].filled[i];
+            if ((a == 0) != (b == 0) || abs(a * depth / size - b) > 1) {
+                mismatched++;
+            }
+        }
+        std::cout << "    " << mismatched
+                  << " pixels differ from the full-depth render\n";
+    }
+
+    return 0;
+}
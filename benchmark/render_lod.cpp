@@ -0,0 +1,84 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Renders with a range of tile budgets, reporting the time taken, how many
+ *  64^2 columns of the image were approximated, and how many pixels differ
+ *  from the full-detail render.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    const int size = 1024;
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    auto full = mpr::Context(size);
+    std::cout << "3D " << size << "^3 (full detail) ";
+    get_stats([&](){ full.render3D(tape, T); });
+
+    auto c = mpr::Context(size);
+    const int columns = ((size + 63) / 64) * ((size + 63) / 64);
+    for (int64_t max_tiles : {1000000, 100000, 10000, 1000}) {
+        mpr::RenderBudget budget;
+        budget.max_tiles = max_tiles;
+        std::cout << "3D " << size << "^3 (" << max_tiles << " tiles) ";
+        get_stats([&](){ c.render3D(tape, T, budget); });
+
+        int approximated = 0;
+        for (int i=0; i < columns; ++i) {
+            approximated += c.lod[i] != mpr::Context::LOD_FULL;
+        }
+        int mismatched = 0;
+        for (int i=0; i < size * size; ++i) {
+            mismatched += (full.stages[3].filled[i] == 0) !=
+                          (c.stages[3].filled[i] == 0);
+        }
+        std::cout << "    " << approximated << " / " << columns
+                  << " columns approximated, " << mismatched
+                  << " pixels differ in coverage\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "tape.hpp"
+#include "context.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares rendering every shape in an archive with its own tape against
+ *  rendering all of them at once with a single multi-output tape, printing
+ *  tape lengths, timing, and the number of pixels labelled with each output.
+ *
+ *  Usage: render_multi [model.frep]
+ */
+int main(int argc, char **argv)
+{
+    std::vector<libfive::Tree> shapes;
+    if (argc == 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            for (auto& s : a.shapes) {
+                shapes.push_back(s.tree);
+            }
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        // A row of spheres which share a common (Y^2 + Z^2) subexpression
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        auto yz = Y*Y + Z*Z;
+        for (int i=0; i < 4; ++i) {
+            const float x = -0.75 + 0.5 * i;
+            shapes.push_back(sqrt((X - x)*(X - x) + yz) - 0.2);
+        }
+    }
+
+    std::vector<mpr::Tape> tapes;
+    int32_t separate_length = 0;
+    for (auto& s : shapes) {
+        tapes.emplace_back(s);
+        separate_length += tapes.back().length;
+    }
+    auto multi = mpr::Tape(shapes);
+    std::cout << shapes.size() << " shapes: " << separate_length
+              << " clauses in separate tapes, " << multi.length
+              << " clauses in multi-output tape\n";
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    const std::vector<int> sizes = {256, 512, 1024, 1536, 2048};
+    for (auto size: sizes) {
+        auto c = mpr::Context(size);
+
+        std::cout << size << " separate ";
+        get_stats([&](){
+            for (auto& t : tapes) {
+                c.render3D(t, T);
+            }
+        });
+
+        std::cout << size << " multi ";
+        auto mean = get_stats([&](){ c.render3D(multi, T); });
+
+        std::vector<uint32_t> counts(shapes.size());
+        for (int i=0; i < size * size; ++i) {
+            if (c.ids[i] >= 0) {
+                counts[c.ids[i]]++;
+            }
+        }
+        std::cout << size << " pixels per output:";
+        for (auto n : counts) {
+            std::cout << " " << n;
+        }
+        std::cout << "\n";
+
+        if (mean > 750) {
+            break;
+        }
+    }
+    return 0;
+}
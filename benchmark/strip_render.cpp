@@ -0,0 +1,92 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "strip_renderer.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares a single-context 3D render against strip renders on one device
+ *  and on every device, checking that the strips match the single render.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+
+    auto tape = mpr::Tape(t);
+    const int size = 2048;
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    auto c = mpr::Context(size);
+    std::cout << "Single context: ";
+    const double single = get_stats([&](){ c.render3D(tape, T); });
+
+    int count = 0;
+    CUDA_CHECK(cudaGetDeviceCount(&count));
+    for (int n : {1, count}) {
+        std::vector<int> devices;
+        for (int i=0; i < n; ++i) {
+            devices.push_back(i);
+        }
+        mpr::StripRenderer strips(size, size, size, devices);
+        std::cout << "Strips on " << n << " device(s): ";
+        const double ms = get_stats([&](){ strips.render3D(tape, T); });
+        std::cout << "    " << single / ms << "x vs. single context\n";
+        for (unsigned i=0; i < strips.devices.size(); ++i) {
+            std::cout << "    device " << strips.devices[i] << ": "
+                      << strips.strips_rendered[i] << " strips\n";
+        }
+
+        int mismatched = 0;
+        for (int i=0; i < size * size; ++i) {
+            if (strips.image[i] != c.stages[3].filled[i]) {
+                mismatched++;
+            }
+        }
+        std::cout << "    " << mismatched
+                  << " pixels differ from the single render\n";
+
+        if (count == 1) {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -9,10 +9,12 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 Copyright (C) 2019-2020  Matt Keeter
 */
+#include <algorithm>
 #include <cstdio>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 // libfive
 #include <libfive/tree/tree.hpp>
@@ -45,14 +47,38 @@ int main(int argc, char **argv)
     for (unsigned i=0; i < 100; ++i) {
         auto r = mpr::Tape(t);
     }
+
+    // Time libfive's own DFS, which is what tape building used to rely on
+    // (before doing a great deal of std::map work on top of it)
+    auto start_dfs = std::chrono::steady_clock::now();
+    for (unsigned i=0; i < 100; ++i) {
+        auto r = t.orderedDfs();
+    }
+    auto end_dfs = std::chrono::steady_clock::now();
+    const double dfs_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            end_dfs - start_dfs).count() / 100000.0;
+    std::cout << "libfive DFS took " << dfs_time << " ms\n";
+
     auto start_gpu = std::chrono::steady_clock::now();
     for (unsigned i=0; i < 100; ++i) {
         auto r = mpr::Tape(t);
     }
     auto end_gpu = std::chrono::steady_clock::now();
-    std::cout << "Building tape took " <<
-        std::chrono::duration_cast<std::chrono::milliseconds>(end_gpu - start_gpu).count() / 100 <<
-        " ms\n";
+    const double serial_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            end_gpu - start_gpu).count() / 100000.0;
+    std::cout << "Building tape took " << serial_time << " ms\n";
+
+    const unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    auto start_par = std::chrono::steady_clock::now();
+    for (unsigned i=0; i < 100; ++i) {
+        auto r = mpr::Tape(t, threads);
+    }
+    auto end_par = std::chrono::steady_clock::now();
+    const double parallel_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            end_par - start_par).count() / 100000.0;
+    std::cout << "Building tape with " << threads << " threads took "
+              << parallel_time << " ms (" << serial_time / parallel_time
+              << "x speedup)\n";
 
     return 0;
 }
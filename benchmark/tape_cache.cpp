@@ -0,0 +1,74 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "tape.hpp"
+#include "tape_cache.hpp"
+
+#include "stats.hpp"
+
+// Loads the model again from scratch, so that its tree has new Ids
+static libfive::Tree load(int argc, char** argv) {
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            return a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        return min(sqrt((X + 0.5)*(X + 0.5) + Y*Y + Z*Z) - 0.25,
+                   sqrt((X - 0.5)*(X - 0.5) + Y*Y + Z*Z) - 0.25);
+    }
+}
+
+/*
+ *  Compares building a tape against hashing a tree and getting its tape
+ *  from a TapeCache, using a separately-loaded copy of the model (as if an
+ *  edit had been reverted).
+ */
+int main(int argc, char **argv)
+{
+    auto t = load(argc, argv);
+
+    std::cout << "Building tape: ";
+    get_stats([&](){ mpr::Tape tape(t); }, 5, 20);
+
+    std::cout << "Hashing tree: ";
+    get_stats([&](){ mpr::TapeCache::hash({t}); }, 5, 20);
+
+    mpr::TapeCache cache(64 * 1024 * 1024);
+    auto a = cache.get(t);
+    auto copy = load(argc, argv);
+    auto b = cache.get(copy);
+    std::cout << "Reloaded model " << (a == b ? "hit" : "missed")
+              << " the cache\n";
+
+    std::cout << "Cached tape: ";
+    get_stats([&](){ cache.get(copy); }, 5, 20);
+    std::cout << cache.hits() << " hits, " << cache.misses() << " misses, "
+              << cache.bytes() << " bytes cached\n";
+
+    return 0;
+}
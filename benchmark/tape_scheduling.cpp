@@ -0,0 +1,67 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "tape.hpp"
+
+#include "stats.hpp"
+
+/*
+ *  Compares tapes built with and without clause scheduling, printing the
+ *  tape length, number of slots, and 2D / 3D render times for each.
+ *
+ *  Usage: tape_scheduling model.frep [model.frep ...]
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s model.frep [model.frep ...]\n", argv[0]);
+        exit(1);
+    }
+
+    const int size = 1024;
+    auto c = mpr::Context(size);
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    for (int i=1; i < argc; ++i) {
+        std::ifstream ifs;
+        ifs.open(argv[i]);
+        if (!ifs.is_open()) {
+            fprintf(stderr, "Could not open file %s\n", argv[i]);
+            exit(1);
+        }
+        auto a = libfive::Archive::deserialize(ifs);
+        auto t = a.shapes.front().tree;
+
+        std::cout << argv[i] << "\n";
+        for (bool schedule : {false, true}) {
+            auto tape = mpr::Tape(t, 1, schedule);
+            const char* name = schedule ? "scheduled" : "dfs";
+            std::cout << name << " clauses " << tape.length
+                      << " slots " << tape.num_slots << "\n";
+            std::cout << name << " 2d ";
+            get_stats([&](){
+                c.render2D(tape, Eigen::Matrix3f::Identity()); });
+            std::cout << name << " 3d ";
+            get_stats([&](){ c.render3D(tape, T); });
+        }
+    }
+    return 0;
+}
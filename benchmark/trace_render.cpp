@@ -0,0 +1,91 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// libfive
+#include <libfive/tree/tree.hpp>
+#include <libfive/tree/archive.hpp>
+
+#include "context.hpp"
+#include "context_pool.hpp"
+#include "effects.hpp"
+#include "tape.hpp"
+#include "trace.hpp"
+
+/*
+ *  Records a timeline of a short session (tape construction, 2D and 3D
+ *  renders, a budgeted render, shading, and a few renders from a pool of
+ *  threads), then writes it as trace.json, which can be opened in Perfetto
+ *  (https://ui.perfetto.dev) or chrome://tracing.
+ */
+int main(int argc, char **argv)
+{
+    libfive::Tree t = libfive::Tree::X();
+    if (argc >= 2) {
+        std::ifstream ifs;
+        ifs.open(argv[1]);
+        if (ifs.is_open()) {
+            auto a = libfive::Archive::deserialize(ifs);
+            t = a.shapes.front().tree;
+        } else {
+            fprintf(stderr, "Could not open file %s\n", argv[1]);
+            exit(1);
+        }
+    } else {
+        auto X = libfive::Tree::X();
+        auto Y = libfive::Tree::Y();
+        auto Z = libfive::Tree::Z();
+        t = sqrt(X*X + Y*Y + Z*Z) - 0.5;
+    }
+    const char* filename = (argc >= 3) ? argv[2] : "trace.json";
+
+    mpr::Trace::start();
+
+    auto tape = mpr::Tape(t, 4);
+
+    Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+    T(3,2) = 0.3f;
+
+    auto c = mpr::Context(1024);
+    c.render2D(tape, Eigen::Matrix3f::Identity());
+    c.render3D(tape, T);
+
+    mpr::Effects effects;
+    effects.drawShaded(c);
+
+    mpr::RenderBudget budget;
+    budget.max_ms = 1.0;
+    c.render3D(tape, T, budget);
+
+    // Each thread shows up as its own lane in the timeline
+    mpr::ContextPool pool(4);
+    std::vector<std::thread> threads;
+    for (unsigned i=0; i < 4; ++i) {
+        threads.emplace_back([&]() {
+            auto ctx = pool.lease(512);
+            ctx->render3D(tape, T);
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    if (!mpr::Trace::stop(filename)) {
+        return 1;
+    }
+    std::cout << "Wrote trace to " << filename << "\n";
+    return 0;
+}
@@ -124,7 +124,7 @@ void Interpreter::eval(std::string script)
     // Then iterate over the results, picking out shapes
     if (result_valid) {
         // Initialize variables and their textual positions
-        std::map<libfive::Tree::Id, float> vars;
+        vars.clear();
         std::map<libfive::Tree::Id, Range> var_pos;
 
         {   // Walk through the global variable map
@@ -160,6 +160,5 @@ void Interpreter::eval(std::string script)
         }
 
         // Do something with shapes
-        // Do something with vars
     }
 }
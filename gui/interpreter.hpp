@@ -53,4 +53,5 @@ struct Interpreter {
     Range result_err_range;
 
     std::map<libfive::Tree::Id, libfive::Tree> shapes;
+    std::map<libfive::Tree::Id, float> vars;
 };
@@ -24,6 +24,7 @@ Copyright (C) 2019-2020  Matt Keeter
 #include "context.hpp"
 #include "effects.hpp"
 #include "tape.hpp"
+#include "tape_cache.hpp"
 
 #include "interpreter.hpp"
 #include "tex.hpp"
@@ -36,8 +37,13 @@ static void glfw_error_callback(int error, const char* description)
 }
 
 struct Shape {
-    mpr::Tape tape;
+    std::shared_ptr<mpr::Tape> tape;
     libfive::Tree tree;
+
+    // Tape specialized for the z = 0 plane, used for 2D rendering.  This
+    // is rebuilt whenever the script is re-evaluated (since specializing
+    // folds in the values of free variables), rather than every frame.
+    std::shared_ptr<mpr::Tape> slice;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -160,6 +166,12 @@ int main(int argc, char** argv)
     int render_dimension = 3;
     int render_mode = RENDER_MODE_NORMALS;
 
+    // While the view is changing, render previews with a time budget,
+    // then refine them once the view stops moving.
+    bool progressive = false;
+    float preview_ms = 10.0f;
+    Eigen::Matrix4f prev_matrix = Eigen::Matrix4f::Zero();
+
     mpr::Context ctx(render_size);
     mpr::Effects effects;
 
@@ -276,10 +288,21 @@ int main(int argc, char** argv)
                 // Create new shapes from the script
                 for (auto& t : interpreter.shapes) {
                     if (shapes.find(t.first) == shapes.end()) {
-                        Shape s = { mpr::Tape(t.second), t.second };
+                        // Reverted edits give back a cached tape
+                        Shape s = { mpr::TapeCache::instance().get(t.second),
+                                    t.second, nullptr };
                         shapes.emplace(t.first, std::move(s));
                     }
                 }
+                // Update free variables in place, so that changing a
+                // variable's value doesn't require rebuilding the tape.
+                for (auto& s : shapes) {
+                    for (auto& v : interpreter.vars) {
+                        s.second.tape->setVar(v.first, v.second);
+                    }
+                    s.second.slice = std::make_shared<mpr::Tape>(
+                            *s.second.tape, 2, 0.0f);
+                }
             }
 
             float size = ImGui::GetContentRegionAvail().y;
@@ -313,7 +336,7 @@ int main(int argc, char** argv)
 
             // Update the render context if size has changed
             if (render_size != ctx.image_size_px) {
-                ctx = mpr::Context(render_size);
+                ctx.resize(render_size);
             }
 
             ImGui::Text("Dimension:");
@@ -333,8 +356,21 @@ int main(int argc, char** argv)
             } else {
                 render_mode = RENDER_MODE_2D;
             }
+
+            ImGui::Checkbox("Progressive preview", &progressive);
+            if (progressive) {
+                ImGui::SliderFloat("Budget (ms)", &preview_ms, 1.0f, 100.0f);
+            }
         ImGui::End();
 
+        // Only use the render budget while the view is moving, so that a
+        // still view is refined to full detail on the next frame.
+        mpr::RenderBudget budget;
+        if (progressive && model.matrix() != prev_matrix) {
+            budget.max_ms = preview_ms;
+        }
+        prev_matrix = model.matrix();
+
         // Draw the shapes, and add them to the draw list
         auto background = ImGui::GetBackgroundDrawList();
 
@@ -361,9 +397,9 @@ int main(int argc, char** argv)
                         mat2d.block<2, 1>(0, 2) = mat.block<2, 1>(0, 3);
                         mat2d.block<1, 2>(2, 0) = mat.block<1, 2>(3, 0);
                         mat2d.block<1, 1>(2, 2) = mat.block<1, 1>(3, 3);
-                        ctx.render2D(s.second.tape, mat2d);
+                        ctx.render2D(*s.second.slice, mat2d, budget);
                     } else {
-                        ctx.render3D(s.second.tape, model.matrix());
+                        ctx.render3D(*s.second.tape, model.matrix(), budget);
                     }
                     auto end = high_resolution_clock::now();
                     auto dt = duration_cast<microseconds>(end - start);
@@ -55,7 +55,7 @@ void copy_2d_to_surface(int32_t* const __restrict__ image,
 
 __global__
 void copy_depth_to_surface(int32_t* const __restrict__ image,
-                        int image_size_px,
+                        int image_size_px, int image_depth_px,
                         cudaSurfaceObject_t surf,
                         int texture_size_px, bool append)
 {
@@ -67,7 +67,7 @@ void copy_depth_to_surface(int32_t* const __restrict__ image,
         const uint32_t py = y * image_size_px / texture_size_px;
         auto h = image[px + py * image_size_px];
         if (h) {
-            h = (h * 255) / image_size_px;
+            h = (h * 255) / image_depth_px;
             surf2Dwrite(0x00FFFFFF | (h << 24),
                         surf, x*4, y);
         } else if (!append) {
@@ -181,7 +181,7 @@ void copy_to_texture(const mpr::Context& ctx,
         case RENDER_MODE_DEPTH:
             copy_depth_to_surface<<<dim3(u, u), dim3(16, 16)>>>(
                     ctx.stages[3].filled.get(),
-                    ctx.image_size_px,
+                    ctx.image_size_px, ctx.image_depth_px,
                     surf, texture_size_px, append);
             break;
         case RENDER_MODE_NORMALS:
@@ -0,0 +1,69 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <Eigen/Eigen>
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Tape;
+
+/*
+ *  Bounds finds a tight axis-aligned box around the non-empty part of a
+ *  shape, by subdividing a world-space region with interval arithmetic and
+ *  only recursing into ambiguous cells.  A second pass repeats this within
+ *  the first pass's result (grown by one cell), which makes the box much
+ *  tighter for small models in a large search region.
+ *
+ *  The result is conservative: the shape is guaranteed to be inside the
+ *  box (within the search region), but the box may be up to one cell of
+ *  the final pass too large on each side.
+ *
+ *  Like the Octree, this uses the context's tape buffer as scratch space.
+ */
+struct Bounds {
+    Bounds(const Tape& tape, Context& ctx, int32_t depth=6,
+           const Eigen::Vector3f& lower=Eigen::Vector3f(-1, -1, -1),
+           const Eigen::Vector3f& upper=Eigen::Vector3f(1, 1, 1));
+
+    /*  Returns a matrix for Context::render3D which fits the box into the
+     *  context's rendered volume (accounting for its image aspect ratio),
+     *  viewed with the given rotation, while preserving the box's aspect
+     *  ratio. */
+    Eigen::Matrix4f fitView(
+        const Context& ctx,
+        const Eigen::Matrix3f& rotation=Eigen::Matrix3f::Identity()) const;
+
+    /*  Returns a matrix for Context::render2D which fits the box's X and Y
+     *  extent into the context's image, preserving its aspect ratio */
+    Eigen::Matrix3f fitView2D(const Context& ctx) const;
+
+    Eigen::Vector3f lower;
+    Eigen::Vector3f upper;
+
+    // True if the shape was proven empty everywhere in the search region,
+    // in which case lower and upper are meaningless.
+    bool empty;
+
+    // The deepest supported subdivision (limited by 10-bit Morton indices)
+    static constexpr int32_t MAX_DEPTH = 10;
+
+protected:
+    /*  Runs one subdivision pass over the given region, updating lower,
+     *  upper, and empty.  */
+    void run(Context& ctx, int32_t tape_length, int32_t depth,
+             const Eigen::Vector3f& lower, const Eigen::Vector3f& upper);
+};
+
+}   // namespace mpr
@@ -21,3 +21,11 @@ Copyright (C) 2019-2020  Matt Keeter
 #define I_RHS(d) (((uint8_t*)(d))[3])
 #define IMM(d) (((float*)(d))[1])
 #define JUMP_TARGET(d) (((int32_t*)(d))[1])
+#define OUTPUT_INDEX(d) (((int32_t*)(d))[1])
+
+// The first clause of a tape is a header, which stores the X/Y/Z slots in
+// the I_OUT / I_LHS / I_RHS bytes and a set of flags in the following byte.
+#define TAPE_FLAGS(d) (((uint8_t*)(d))[4])
+
+// Set if the tape contains GPU_OP_MARK_X and GPU_OP_MARK_XY clauses
+#define TAPE_FLAG_MARKERS 1
@@ -17,7 +17,8 @@ Copyright (C) 2019-2020  Matt Keeter
 
 namespace mpr {
 
-// Forward declaration
+// Forward declarations
+struct Octree;
 struct Tape;
 
 struct TileNode {
@@ -29,18 +30,103 @@ struct TileNode {
 struct Tiles {
     /* 2D array of filled Z values (or 0) */
     Ptr<int32_t[]> filled;
+    size_t filled_array_size=0;
 
     /*  1D list of active tiles */
     Ptr<TileNode[]> tiles;
     size_t tile_array_size=0;
 };
 
+/*
+ *  Limits on how much work a level-of-detail render may do.  Once either
+ *  limit would be exceeded, ambiguous tiles are resolved by evaluating the
+ *  shape at their centers instead of being subdivided, which produces a
+ *  blocky (but otherwise correct) image.
+ */
+struct RenderBudget {
+    /*  Wall-clock time for the render, checked between stages */
+    double max_ms=0;
+
+    /*  Total number of tiles evaluated, counting each stage's active tiles
+     *  (including the 4^3 or 8^2 tiles evaluated per voxel) */
+    int64_t max_tiles=0;
+
+    /*  Checks whether the budget is exceeded, given elapsed time and the
+     *  number of tiles that will have been evaluated.  Limits of zero are
+     *  ignored, so the default budget is unlimited. */
+    bool exceeded(double elapsed_ms, int64_t tiles) const;
+};
+
 struct Context {
+    /*  Builds a context for square images */
     Context(int32_t image_size_px);
+
+    /*  Builds a context for images of arbitrary size.  Sizes don't need to
+     *  be a multiple of the tile size; tiles on the right and bottom edges
+     *  are clipped to the image. */
+    Context(int32_t image_width_px, int32_t image_height_px);
+
+    /*  Builds a context with a separate depth for 3D renders.  Z is split
+     *  into fewer tiles when the depth is smaller than the image, which
+     *  makes rendering proportionally cheaper when a coarse heightmap is
+     *  good enough.  Pixels remain square in X and Y, so voxels are
+     *  stretched along Z. */
+    Context(int32_t image_width_px, int32_t image_height_px,
+            int32_t image_depth_px);
+
+    /*  Changes the image size, keeping the tape buffer.  Other buffers are
+     *  only reallocated if they're too small, in which case their capacity
+     *  is at least doubled, so switching between a handful of sizes soon
+     *  stops allocating.  Like the constructors, the depth defaults to the
+     *  image's longer side. */
+    void resize(int32_t image_size_px);
+    void resize(int32_t image_width_px, int32_t image_height_px);
+    void resize(int32_t image_width_px, int32_t image_height_px,
+                int32_t image_depth_px);
+
+    /*  Returns the memory held by each of the context's buffers */
+    MemoryUsage memoryUsage() const;
+
+    /*  Shrinks buffers which have grown beyond what the current image size
+     *  needs (e.g. after a large render), and frees the buffers which are
+     *  regrown by every render.  The last render's outputs (the final image,
+     *  normals, ids, and lod) are kept, but its intermediate tile data is
+     *  not.  The tape buffer has a fixed size, so it isn't affected. */
+    void trim();
+
     void render3D(const Tape& tape, const Eigen::Matrix4f& mat);
+
+    /*  Renders a 3D image, starting each tile from the deepest octree cell
+     *  that contains it (rather than always starting from the root tape).
+     *  This amortizes tape pruning across many views of the same model. */
+    void render3D(const Octree& octree, const Eigen::Matrix4f& mat);
+
+    /*  Renders a 2D slice at the given z.  For repeated renders of a 3D
+     *  model at the same z, build a specialized Tape(tape, 2, z) once and
+     *  render that instead, so tiles only evaluate clauses which depend on
+     *  X and Y. */
     void render2D(const Tape& tape, const Eigen::Matrix3f& mat,
                   const float z=0.0f);
 
+    /*  Renders with a limited budget, for interactive previews.  When the
+     *  budget runs out, the remaining ambiguous tiles are resolved with a
+     *  single point evaluation rather than subdivided further; the stage
+     *  that each region of the image reached is recorded in `lod`. */
+    void render3D(const Tape& tape, const Eigen::Matrix4f& mat,
+                  const RenderBudget& budget);
+    void render2D(const Tape& tape, const Eigen::Matrix3f& mat,
+                  const RenderBudget& budget, const float z=0.0f);
+
+    /*  Renders a 3D image, replacing the per-voxel evaluation of the last
+     *  stage with sphere tracing down each pixel's column.  If the caller
+     *  declares a Lipschitz constant for the field (i.e. |f(a) - f(b)| is at
+     *  most lipschitz * |a - b| everywhere), it's used as a distance bound
+     *  to take multi-voxel steps, which is faster for distance fields with
+     *  large empty regions.  With no constant (lipschitz <= 0), the last
+     *  stage uses the same voxel scan as render3D. */
+    void render3D_sphere(const Tape& tape, const Eigen::Matrix4f& mat,
+                         const float lipschitz=0.0f);
+
     /*  Renders a 2D image using a brute-force approach, without subdivision
      *  or tape pruning.  This is only useful for benchmarking, and is not
      *  recommended for regular use. */
@@ -57,8 +143,19 @@ struct Context {
     Ptr<float[]> render3D_heatmap(const Tape& tape,
                                   const Eigen::Matrix4f& mat);
 
+    /*  Rendered images (stages[3].filled, normals, and ids) are stored
+     *  row-major, with image_width_px pixels per row. */
+    int32_t image_width_px;
+    int32_t image_height_px;
+
+    /*  The longer side of the image, which spans +/-1 in render space (the
+     *  shorter side is centered, so that pixels are square). */
     int32_t image_size_px;
 
+    /*  Number of voxels along Z in 3D renders (which also spans +/-1).
+     *  Filled values in 3D renders are in the range [0, image_depth_px). */
+    int32_t image_depth_px;
+
     Ptr<uint64_t[]> tape_data;    // original tape is copied to index 0
     Ptr<int32_t> tape_index;    // single value
 
@@ -70,6 +167,52 @@ struct Context {
     size_t values_size=0;
 
     Ptr<uint32_t[]> normals;
+    size_t normals_array_size=0;
+
+    /*  Per-pixel index of the output which produced each filled pixel, or
+     *  -1 for empty pixels.  This is only written when rendering a
+     *  multi-output Tape (i.e. one built from a list of shapes). */
+    Ptr<int32_t[]> ids;
+    size_t ids_array_size=0;
+
+    /*  Level of detail reached by the last call to render2D or render3D,
+     *  with one value per 64^2 column of the image (row-major, rounded up).
+     *  Each value is the index of the stage where that column's tiles were
+     *  approximated (see `stages` above), or LOD_FULL if every tile was
+     *  fully resolved. */
+    Ptr<uint8_t[]> lod;
+    size_t lod_array_size=0;
+    static constexpr uint8_t LOD_FULL = 3;
+
+protected:
+    /*  Number of outputs in the tape being rendered */
+    int32_t num_outputs=1;
+
+    /*  Memory usage when trim() was last called, which is used to report
+     *  peak usage (since buffers otherwise only grow) */
+    MemoryUsage trimmed;
+
+    /*  Runs the 3D rendering pipeline, assuming that the tape buffer has
+     *  already been loaded.  If octree is non-null, then its cells are used
+     *  to pick initial tapes for each tile. */
+    void run3D(const Eigen::Matrix4f& mat, const Octree* octree,
+               const RenderBudget& budget);
+
+    /*  Evaluates the 64^3, 16^3, and 4^3 tile stages, returning the number
+     *  of active 4^3 tiles (which are stored in stages[3].tiles).  Returns
+     *  0 if there are no active tiles, in which case rendering is done.
+     *
+     *  If the budget runs out, then the remaining tiles are resolved with
+     *  eval_tiles_center, filled tiles are copied into the final image,
+     *  and this returns -1. */
+    int32_t renderTiles3D(const Eigen::Matrix4f& mat, const Octree* octree,
+                          const RenderBudget& budget);
+
+    /*  Evaluates every voxel in the given number of active 4^3 tiles */
+    void renderVoxels3D(const Eigen::Matrix4f& mat, int32_t count);
+
+    /*  Renders normals for every filled pixel, then synchronizes */
+    void renderNormals3D(const Eigen::Matrix4f& mat);
 };
 
 } // mpr
@@ -0,0 +1,93 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace mpr {
+
+// Forward declaration
+struct Context;
+
+/*
+ *  A ContextPool lets many threads render at once, without building a
+ *  Context (and its tape buffer) for every request.
+ *
+ *  A Context can only be used by one thread at a time, because it stores
+ *  the state of the render in progress.  The pool hands out leases on
+ *  contexts, building them lazily up to a fixed limit (which bounds the
+ *  total memory used).  Once every context is leased, further requests
+ *  block until one is returned.
+ *
+ *  Tapes are only read while rendering (they're copied into the context's
+ *  tape buffer), so every thread can share the same Tape, as long as none
+ *  of them calls Tape::setVar during a render.
+ *
+ *  The library is built with per-thread default streams, so work from
+ *  different threads can overlap on the GPU.  Rendering from many threads
+ *  requires a GPU which supports concurrent managed memory access; on
+ *  other GPUs, the pool is limited to a single context.
+ *
+ *  The pool must outlive all of its leases.
+ */
+struct ContextPool {
+    ContextPool(unsigned max_contexts);
+    ~ContextPool();
+
+    /*  Exclusive access to one context, which is returned to the pool when
+     *  the lease is destroyed. */
+    struct Lease {
+        Lease(Lease&& other);
+        ~Lease();
+
+        Context& operator*() const { return *ctx; }
+        Context* operator->() const { return ctx; }
+
+    protected:
+        friend struct ContextPool;
+        Lease(ContextPool* pool, Context* ctx);
+
+        ContextPool* pool;
+        Context* ctx;
+    };
+
+    /*  Waits for a free context, resizes it (see Context::resize), and
+     *  leases it to the caller.  The smallest free context whose buffers
+     *  already fit the image is picked (or the largest one, if none fit),
+     *  so that contexts only grow when no free context is big enough. */
+    Lease lease(int32_t image_size_px);
+    Lease lease(int32_t image_width_px, int32_t image_height_px);
+
+    /*  Returns the number of contexts which have been built so far */
+    unsigned size();
+
+    /*  Maximum number of contexts which will be built */
+    const unsigned max_contexts;
+
+protected:
+    void release(Context* ctx);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // Every context that has been built, and the ones that aren't leased
+    std::vector<std::unique_ptr<Context>> contexts;
+    std::vector<Context*> available;
+
+    // Number of contexts that are built (or being built)
+    unsigned num_contexts=0;
+};
+
+}   // namespace mpr
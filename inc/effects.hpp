@@ -27,10 +27,15 @@ struct Effects {
     void drawSSAO(const Context& ctx);
     void drawShaded(const Context& ctx);
 
+    /*  Returns the memory held by the effects' scratch images */
+    MemoryUsage memoryUsage() const;
+
 protected:
     void resizeTo(const Context& ctx);
 
-    int32_t image_size_px;
+    int32_t image_width_px;
+    int32_t image_height_px;
+    size_t image_array_size=0;
 
     Eigen::Matrix<float, 64, 3> ssao_kernel;
     Eigen::Matrix<float, 16*16, 3> ssao_rvecs;
@@ -0,0 +1,517 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <cassert>
+
+#include "clause.hpp"
+#include "gpu_deriv.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_opcode.hpp"
+#include "parameters.hpp"
+#include "profile.hpp"
+
+namespace mpr {
+
+// Number of uint32_t words used to record min/max choices, two bits each
+constexpr int CHOICE_ARRAY_SIZE = 256;
+
+#ifdef __CUDACC__
+
+/*
+ *  walk_tape_i
+ *
+ *  Evaluates the tape beginning at `data` (which must point to the tape's
+ *  header clause) using interval arithmetic.  Axis values must already be
+ *  loaded into `slots`.
+ *
+ *  The result of each min/max clause is recorded as a two-bit value in
+ *  `choices`, and `has_any_choice` is set if any of them picked a single
+ *  branch.  Returns a pointer to the final clause of the tape, which stores
+ *  the output slot in its I_OUT byte.
+ */
+__device__ __forceinline__
+const uint64_t* walk_tape_i(const uint64_t* __restrict__ data,
+                            Interval* const __restrict__ slots,
+                            uint32_t* const __restrict__ choices,
+                            int& choice_index,
+                            bool& has_any_choice)
+{
+    while (1) {
+        const uint64_t d = *++data;
+        if (!OP(&d)) {
+            break;
+        }
+        PROFILE_CLAUSE(Profile::INTERVAL, d);
+        switch (OP(&d)) {
+            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+
+#define lhs slots[I_LHS(&d)]
+#define rhs slots[I_RHS(&d)]
+#define imm IMM(&d)
+#define out slots[I_OUT(&d)]
+
+            case GPU_OP_SQUARE_LHS: out = square(lhs); break;
+            case GPU_OP_SQRT_LHS:   out = sqrt(lhs); break;
+            case GPU_OP_NEG_LHS:    out = -lhs; break;
+            case GPU_OP_SIN_LHS:    out = sin(lhs); break;
+            case GPU_OP_COS_LHS:    out = cos(lhs); break;
+            case GPU_OP_ASIN_LHS:   out = asin(lhs); break;
+            case GPU_OP_ACOS_LHS:   out = acos(lhs); break;
+            case GPU_OP_ATAN_LHS:   out = atan(lhs); break;
+            case GPU_OP_EXP_LHS:    out = exp(lhs); break;
+            case GPU_OP_ABS_LHS:    out = abs(lhs); break;
+            case GPU_OP_LOG_LHS:    out = log(lhs); break;
+
+            // Commutative opcodes
+            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
+            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
+            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
+            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
+
+#define CHOICE(f, a, b) {                                               \
+    int c = 0;                                                          \
+    out = f(a, b, c);                                                   \
+    if (choice_index < CHOICE_ARRAY_SIZE * 16) {                        \
+        choices[choice_index / 16] |= (c << ((choice_index % 16) * 2)); \
+    }                                                                   \
+    choice_index++;                                                     \
+    has_any_choice |= (c != 0);                                         \
+    PROFILE_CHOICE(d, c);                                               \
+    break;                                                              \
+}
+            case GPU_OP_MIN_LHS_IMM: CHOICE(min, lhs, imm);
+            case GPU_OP_MIN_LHS_RHS: CHOICE(min, lhs, rhs);
+            case GPU_OP_MAX_LHS_IMM: CHOICE(max, lhs, imm);
+            case GPU_OP_MAX_LHS_RHS: CHOICE(max, lhs, rhs);
+#undef CHOICE
+
+            // Non-commutative opcodes
+            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
+            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
+            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
+            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
+            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+
+            case GPU_OP_COPY_IMM: out = Interval(imm); break;
+            case GPU_OP_COPY_LHS: out = lhs; break;
+            case GPU_OP_COPY_RHS: out = rhs; break;
+            case GPU_OP_TAG_LHS: out = lhs; break;
+
+            case GPU_OP_MARK_X:
+            case GPU_OP_MARK_XY: continue;
+
+            default: assert(false);
+        }
+#undef lhs
+#undef rhs
+#undef imm
+#undef out
+    }
+    return data;
+}
+
+/*
+ *  push_tape
+ *
+ *  Walks *backwards* from `data` (the final clause of a tape, as returned by
+ *  walk_tape_i), writing a new tape into `tape_data` which only contains
+ *  active clauses.  This is done with an algorithm similiar to the "mark"
+ *  phase of "mark-and-sweep": each clause marks its children as active,
+ *  except for min/max clauses, which have the option to only mark one branch
+ *  (based on the `choices` recorded during evaluation).
+ *
+ *  `active` is scratch space for 128 slots; callers typically reuse their
+ *  slots array, since it's no longer needed after evaluation.
+ *
+ *  Returns the index of the new tape's header in `tape_data`, or -1 if
+ *  we ran out of room in the tape buffer.
+ */
+__device__ __forceinline__
+int32_t push_tape(uint64_t* const __restrict__ tape_data,
+                  int32_t* const __restrict__ tape_index,
+                  const uint64_t* __restrict__ data,
+                  const uint32_t* const __restrict__ choices,
+                  int choice_index,
+                  int* const __restrict__ active)
+{
+    // Use this array to track which slots are active
+    for (unsigned i=0; i < 128; ++i) {
+        active[i] = false;
+    }
+    active[I_OUT(data)] = true;
+
+    // Check to make sure the tape isn't full
+    // This doesn't mean that we'll successfully claim a chunk, because
+    // other threads could claim chunks before us, but it's a way to check
+    // quickly (and prevents tape_index from getting absurdly large).
+    if (*tape_index >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+        return -1;
+    }
+
+    // Claim a chunk of tape
+    int32_t out_index = atomicAdd(tape_index, SUBTAPE_CHUNK_SIZE);
+    int32_t out_offset = SUBTAPE_CHUNK_SIZE;
+
+    // If we've run out of tape, then immediately return
+    if (out_index + out_offset >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+        return -1;
+    }
+
+    // Write out the end of the tape, which is the same as the ending
+    // of the previous tape (0 opcode, with i_out as the last slot)
+    out_offset--;
+    tape_data[out_index + out_offset] = *data;
+
+    while (1) {
+        uint64_t d = *--data;
+        if (!OP(&d)) {
+            break;
+        }
+        const uint8_t op = OP(&d);
+        if (op == GPU_OP_JUMP) {
+            data += JUMP_TARGET(&d);
+            continue;
+        }
+
+        const bool has_choice = op >= GPU_OP_MIN_LHS_IMM &&
+                                op <= GPU_OP_MAX_LHS_RHS;
+        choice_index -= has_choice;
+
+        // Markers are always kept, since leaf evaluation relies on them
+        const uint8_t i_out = I_OUT(&d);
+        if (!active[i_out] && op != GPU_OP_MARK_X && op != GPU_OP_MARK_XY) {
+            continue;
+        }
+
+        assert(!has_choice || choice_index >= 0);
+
+        const int choice = (has_choice && choice_index < CHOICE_ARRAY_SIZE * 16)
+            ? ((choices[choice_index / 16] >>
+              ((choice_index % 16) * 2)) & 3)
+            : 0;
+
+        // If we're about to write a new piece of data to the tape,
+        // (and are done with the current chunk), then we need to
+        // add another link to the linked list.
+        --out_offset;
+        if (out_offset == 0) {
+            const int32_t prev_index = out_index;
+
+            // Early exit if we can't finish writing out this tape
+            if (*tape_index >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+                return -1;
+            }
+            out_index = atomicAdd(tape_index, SUBTAPE_CHUNK_SIZE);
+            out_offset = SUBTAPE_CHUNK_SIZE;
+
+            // Later exit if we claimed a chunk that exceeds the tape array
+            if (out_index + out_offset >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+                return -1;
+            }
+            --out_offset;
+
+            // Forward-pointing link
+            OP(&tape_data[out_index + out_offset]) = GPU_OP_JUMP;
+            const int32_t delta = (int32_t)prev_index -
+                                  (int32_t)(out_index + out_offset);
+            JUMP_TARGET(&tape_data[out_index + out_offset]) = delta;
+
+            // Backward-pointing link
+            OP(&tape_data[prev_index]) = GPU_OP_JUMP;
+            JUMP_TARGET(&tape_data[prev_index]) = -delta;
+
+            // We've written the jump, so adjust the offset again
+            --out_offset;
+        }
+
+        active[i_out] = false;
+        if (choice == 0) {
+            const uint8_t i_lhs = I_LHS(&d);
+            if (i_lhs) {
+                active[i_lhs] = true;
+            }
+            const uint8_t i_rhs = I_RHS(&d);
+            if (i_rhs) {
+                active[i_rhs] = true;
+            }
+        } else if (choice == 1 /* LHS */) {
+            // The non-immediate is always the LHS in commutative ops, and
+            // min/max (the only clauses that produce a choice) are commutative
+            const uint8_t i_lhs = I_LHS(&d);
+            active[i_lhs] = true;
+            if (i_lhs == i_out) {
+                ++out_offset;
+                continue;
+            } else {
+                OP(&d) = GPU_OP_COPY_LHS;
+            }
+        } else if (choice == 2 /* RHS */) {
+            const uint8_t i_rhs = I_RHS(&d);
+            if (i_rhs) {
+                active[i_rhs] = true;
+                if (i_rhs == i_out) {
+                    ++out_offset;
+                    continue;
+                } else {
+                    OP(&d) = GPU_OP_COPY_RHS;
+                }
+            } else {
+                OP(&d) = GPU_OP_COPY_IMM;
+            }
+        }
+        tape_data[out_index + out_offset] = d;
+    }
+
+    // Write the beginning of the tape
+    out_offset--;
+    tape_data[out_index + out_offset] = *data;
+
+    return out_index + out_offset;
+}
+
+/*
+ *  walk_tape_f
+ *
+ *  Evaluates the tape beginning at `data` at a single point, returning the
+ *  result.  Axis values must already be loaded into `slots`.
+ */
+__device__ __forceinline__
+float walk_tape_f(const uint64_t* __restrict__ data,
+                  float* const __restrict__ slots)
+{
+    while (1) {
+        const uint64_t d = *++data;
+        if (!OP(&d)) {
+            break;
+        }
+        PROFILE_CLAUSE(Profile::FLOAT, d);
+        switch (OP(&d)) {
+            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+
+#define lhs slots[I_LHS(&d)]
+#define rhs slots[I_RHS(&d)]
+#define imm IMM(&d)
+#define out slots[I_OUT(&d)]
+
+            case GPU_OP_SQUARE_LHS: out = lhs * lhs; break;
+            case GPU_OP_SQRT_LHS: out = sqrtf(lhs); break;
+            case GPU_OP_NEG_LHS: out = -lhs; break;
+            case GPU_OP_SIN_LHS: out = sinf(lhs); break;
+            case GPU_OP_COS_LHS: out = cosf(lhs); break;
+            case GPU_OP_ASIN_LHS: out = asinf(lhs); break;
+            case GPU_OP_ACOS_LHS: out = acosf(lhs); break;
+            case GPU_OP_ATAN_LHS: out = atanf(lhs); break;
+            case GPU_OP_EXP_LHS: out = expf(lhs); break;
+            case GPU_OP_ABS_LHS: out = fabsf(lhs); break;
+            case GPU_OP_LOG_LHS: out = logf(lhs); break;
+
+            // Commutative opcodes
+            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
+            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
+            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
+            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
+            case GPU_OP_MIN_LHS_IMM: out = fminf(lhs, imm); break;
+            case GPU_OP_MIN_LHS_RHS: out = fminf(lhs, rhs); break;
+            case GPU_OP_MAX_LHS_IMM: out = fmaxf(lhs, imm); break;
+            case GPU_OP_MAX_LHS_RHS: out = fmaxf(lhs, rhs); break;
+
+            // Non-commutative opcodes
+            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
+            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
+            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+
+            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
+            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
+            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+
+            case GPU_OP_COPY_IMM: out = imm; break;
+            case GPU_OP_COPY_LHS: out = lhs; break;
+            case GPU_OP_COPY_RHS: out = rhs; break;
+            case GPU_OP_TAG_LHS: out = lhs; break;
+
+#undef lhs
+#undef rhs
+#undef imm
+#undef out
+        }
+    }
+    return slots[I_OUT(data)];
+}
+
+/*
+ *  walk_tape_d
+ *
+ *  Evaluates the tape beginning at `data` with automatic differentiation,
+ *  returning the result.  Axis values (with their partial derivatives
+ *  already set) must be loaded into `slots` by the caller.
+ */
+__device__ __forceinline__
+Deriv walk_tape_d(const uint64_t* __restrict__ data,
+                  Deriv* const __restrict__ slots)
+{
+    while (1) {
+        const uint64_t d = *++data;
+        if (!OP(&d)) {
+            break;
+        }
+        PROFILE_CLAUSE(Profile::DERIV, d);
+        switch (OP(&d)) {
+            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+
+#define lhs slots[I_LHS(&d)]
+#define rhs slots[I_RHS(&d)]
+#define imm IMM(&d)
+#define out slots[I_OUT(&d)]
+
+            case GPU_OP_SQUARE_LHS: out = lhs * lhs; break;
+            case GPU_OP_SQRT_LHS: out = sqrt(lhs); break;
+            case GPU_OP_NEG_LHS: out = -lhs; break;
+            case GPU_OP_SIN_LHS: out = sin(lhs); break;
+            case GPU_OP_COS_LHS: out = cos(lhs); break;
+            case GPU_OP_ASIN_LHS: out = asin(lhs); break;
+            case GPU_OP_ACOS_LHS: out = acos(lhs); break;
+            case GPU_OP_ATAN_LHS: out = atan(lhs); break;
+            case GPU_OP_EXP_LHS: out = exp(lhs); break;
+            case GPU_OP_ABS_LHS: out = abs(lhs); break;
+            case GPU_OP_LOG_LHS: out = log(lhs); break;
+
+            // Commutative opcodes
+            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
+            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
+            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
+            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
+            case GPU_OP_MIN_LHS_IMM: out = min(lhs, imm); break;
+            case GPU_OP_MIN_LHS_RHS: out = min(lhs, rhs); break;
+            case GPU_OP_MAX_LHS_IMM: out = max(lhs, imm); break;
+            case GPU_OP_MAX_LHS_RHS: out = max(lhs, rhs); break;
+
+            // Non-commutative opcodes
+            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
+            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
+            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+
+            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
+            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
+            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+
+            case GPU_OP_COPY_IMM: out = Deriv(imm); break;
+            case GPU_OP_COPY_LHS: out = lhs; break;
+            case GPU_OP_COPY_RHS: out = rhs; break;
+            case GPU_OP_TAG_LHS: out = lhs; break;
+
+#undef lhs
+#undef rhs
+#undef imm
+#undef out
+        }
+    }
+    return slots[I_OUT(data)];
+}
+
+/*
+ *  walk_tape_tag
+ *
+ *  Evaluates a multi-output tape (built from a list of shapes) at a single
+ *  point, tracking which output each slot's value came from: TAG_LHS clauses
+ *  assign their output index, min/max clauses take the tag of the branch
+ *  they picked, and copies pass it through.  Axis values must already be
+ *  loaded into `slots`.
+ *
+ *  Returns the output index which produced the tape's result, or -1 if it
+ *  doesn't come from a single tagged output.
+ */
+__device__ __forceinline__
+int32_t walk_tape_tag(const uint64_t* __restrict__ data,
+                      float* const __restrict__ slots,
+                      int32_t* const __restrict__ tags)
+{
+    for (unsigned i=1; i < 4; ++i) {
+        tags[((const uint8_t*)data)[i]] = -1;
+    }
+
+    while (1) {
+        const uint64_t d = *++data;
+        if (!OP(&d)) {
+            break;
+        }
+        PROFILE_CLAUSE(Profile::FLOAT, d);
+
+#define lhs slots[I_LHS(&d)]
+#define rhs slots[I_RHS(&d)]
+#define imm IMM(&d)
+#define lhs_tag tags[I_LHS(&d)]
+#define rhs_tag tags[I_RHS(&d)]
+
+        float out;
+        int32_t tag = -1;
+        switch (OP(&d)) {
+            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+
+            case GPU_OP_SQUARE_LHS: out = lhs * lhs; break;
+            case GPU_OP_SQRT_LHS: out = sqrtf(lhs); break;
+            case GPU_OP_NEG_LHS: out = -lhs; break;
+            case GPU_OP_SIN_LHS: out = sinf(lhs); break;
+            case GPU_OP_COS_LHS: out = cosf(lhs); break;
+            case GPU_OP_ASIN_LHS: out = asinf(lhs); break;
+            case GPU_OP_ACOS_LHS: out = acosf(lhs); break;
+            case GPU_OP_ATAN_LHS: out = atanf(lhs); break;
+            case GPU_OP_EXP_LHS: out = expf(lhs); break;
+            case GPU_OP_ABS_LHS: out = fabsf(lhs); break;
+            case GPU_OP_LOG_LHS: out = logf(lhs); break;
+
+            // Commutative opcodes
+            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
+            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
+            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
+            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
+            case GPU_OP_MIN_LHS_IMM: out = fminf(lhs, imm);
+                                     tag = (lhs < imm) ? lhs_tag : -1; break;
+            case GPU_OP_MIN_LHS_RHS: out = fminf(lhs, rhs);
+                                     tag = (lhs <= rhs) ? lhs_tag : rhs_tag; break;
+            case GPU_OP_MAX_LHS_IMM: out = fmaxf(lhs, imm);
+                                     tag = (lhs > imm) ? lhs_tag : -1; break;
+            case GPU_OP_MAX_LHS_RHS: out = fmaxf(lhs, rhs);
+                                     tag = (lhs >= rhs) ? lhs_tag : rhs_tag; break;
+
+            // Non-commutative opcodes
+            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
+            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
+            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+
+            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
+            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
+            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+
+            case GPU_OP_COPY_IMM: out = imm; break;
+            case GPU_OP_COPY_LHS: out = lhs; tag = lhs_tag; break;
+            case GPU_OP_COPY_RHS: out = rhs; tag = rhs_tag; break;
+            case GPU_OP_TAG_LHS: out = lhs; tag = OUTPUT_INDEX(&d); break;
+
+            default: continue;
+        }
+        slots[I_OUT(&d)] = out;
+        tags[I_OUT(&d)] = tag;
+
+#undef lhs
+#undef rhs
+#undef imm
+#undef lhs_tag
+#undef rhs_tag
+    }
+    return tags[I_OUT(data)];
+}
+
+#endif  // __CUDACC__
+
+}   // namespace mpr
@@ -0,0 +1,123 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+
+#include "gpu_interval.hpp"
+#include "octree.hpp"
+
+namespace mpr {
+
+#ifdef __CUDACC__
+
+// Device-side equivalent of Octree::levelOffset
+__device__ inline uint32_t octree_level_offset(int32_t level) {
+    return ((1u << (3 * level)) - 1) / 7;
+}
+
+// Spreads the low 10 bits of v so that there are two zeros between each bit
+__device__ inline uint32_t octree_spread_bits(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8))  & 0x0300f00f;
+    v = (v | (v << 4))  & 0x030c30c3;
+    v = (v | (v << 2))  & 0x09249249;
+    return v;
+}
+
+// Inverse of octree_spread_bits
+__device__ inline uint32_t octree_compact_bits(uint32_t v) {
+    v &= 0x09249249;
+    v = (v | (v >> 2))  & 0x030c30c3;
+    v = (v | (v >> 4))  & 0x0300f00f;
+    v = (v | (v >> 8))  & 0x030000ff;
+    v = (v | (v >> 16)) & 0x3ff;
+    return v;
+}
+
+// Converts a cell's integer coordinates into its Morton index within a level
+__device__ inline uint32_t octree_pack(int3 c) {
+    return octree_spread_bits(c.x) |
+          (octree_spread_bits(c.y) << 1) |
+          (octree_spread_bits(c.z) << 2);
+}
+
+// Converts a Morton index within a level into integer coordinates
+__device__ inline int3 octree_unpack(uint32_t i) {
+    return make_int3(octree_compact_bits(i),
+                     octree_compact_bits(i >> 1),
+                     octree_compact_bits(i >> 2));
+}
+
+/*
+ *  Returns the world-space bounds of cell `c` along one axis, given the
+ *  octree's bounds along that axis and the number of cells per side.
+ *
+ *  This must be used both when building and when searching the octree, so
+ *  that the floating-point cell boundaries are exactly the same.
+ */
+__device__ inline Interval octree_cell_bounds(float lower, float upper,
+                                              int32_t c, int32_t n)
+{
+    const float size = upper - lower;
+    return {lower + size * (c / (float)n),
+            lower + size * ((c + 1) / (float)n)};
+}
+
+// Returns the (clamped) index of the cell containing v along one axis
+__device__ inline int32_t octree_cell_coord(float v, float lower, float upper,
+                                            int32_t n)
+{
+    const int32_t c = (v - lower) / (upper - lower) * n;
+    return (c < 0) ? 0 : (c >= n) ? (n - 1) : c;
+}
+
+/*
+ *  Finds the deepest cell which completely contains the given world-space
+ *  box, returning its tape index or CellState.  If the box isn't contained
+ *  in the octree at all (or is NaN), returns 0 (the root tape).
+ */
+__device__ inline int32_t octree_lookup(const int32_t* __restrict__ cells,
+                                        const int32_t depth,
+                                        const float3 lower,
+                                        const float3 upper,
+                                        const Interval ix,
+                                        const Interval iy,
+                                        const Interval iz)
+{
+    int32_t cell = 0;
+    for (int32_t level=0; level <= depth && cell >= 0; ++level) {
+        const int32_t n = 1 << level;
+        const int3 c = make_int3(
+            octree_cell_coord(ix.lower(), lower.x, upper.x, n),
+            octree_cell_coord(iy.lower(), lower.y, upper.y, n),
+            octree_cell_coord(iz.lower(), lower.z, upper.z, n));
+        const Interval bx = octree_cell_bounds(lower.x, upper.x, c.x, n);
+        const Interval by = octree_cell_bounds(lower.y, upper.y, c.y, n);
+        const Interval bz = octree_cell_bounds(lower.z, upper.z, c.z, n);
+
+        // Written so that NaN bounds are never considered to be contained
+        const bool contained =
+            ix.lower() >= bx.lower() && ix.upper() <= bx.upper() &&
+            iy.lower() >= by.lower() && iy.upper() <= by.upper() &&
+            iz.lower() >= bz.lower() && iz.upper() <= bz.upper();
+        if (!contained) {
+            break;
+        }
+        cell = cells[octree_level_offset(level) + octree_pack(c)];
+    }
+    return cell;
+}
+
+#endif  // __CUDACC__
+
+}   // namespace mpr
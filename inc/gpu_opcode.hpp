@@ -53,6 +53,16 @@ enum Opcode {
     GPU_OP_COPY_IMM,
     GPU_OP_COPY_LHS,
     GPU_OP_COPY_RHS,
+
+    // Markers which separate groups of clauses by their axis dependencies
+    // (see Tape::Tape).  These are no-ops during evaluation.
+    GPU_OP_MARK_X,
+    GPU_OP_MARK_XY,
+
+    // Copies LHS to the output, tagging it as output OUTPUT_INDEX of a
+    // multi-output tape.  This only matters when finding per-pixel output
+    // indices; everywhere else, it's equivalent to COPY_LHS.
+    GPU_OP_TAG_LHS,
 };
 
 __host__ __device__
@@ -0,0 +1,68 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <Eigen/Eigen>
+
+#include "util.hpp"
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Octree;
+
+/*  Mass properties of a solid, assuming unit density */
+struct MassProperties {
+    double volume=0;        // Area, for 2D integration
+    Eigen::Vector3d centroid=Eigen::Vector3d::Zero();
+
+    // Inertia tensor about the centroid (with zero Z terms in 2D)
+    Eigen::Matrix3d inertia=Eigen::Matrix3d::Zero();
+
+    // Upper bound on the volume (or area) which may be misclassified,
+    // i.e. the total size of regions where interval arithmetic couldn't
+    // decide and we fell back to point sampling.
+    double error=0;
+};
+
+/*
+ *  An Integrator computes mass properties by reusing the filled / empty
+ *  classification which was already done for rendering or pruning, so
+ *  that only ambiguous leaves need to be sampled.
+ */
+struct Integrator {
+    Integrator();
+
+    /*  Integrates over an octree's cells.  Filled leaf cells are counted
+     *  exactly; ambiguous leaves are split into smaller boxes, which are
+     *  evaluated with interval arithmetic (then point-sampled at their
+     *  centers if still ambiguous).  Only the part of the model within
+     *  the octree's bounds is counted. */
+    MassProperties volume(const Octree& octree);
+
+    /*  Integrates over the most recent Context::render2D, which must have
+     *  been called with the same (affine) matrix.  Filled 64^2 and 8^2
+     *  tiles are exact, and pixels in ambiguous 8^2 tiles are counted by
+     *  their samples. */
+    MassProperties area(const Context& ctx, const Eigen::Matrix3f& mat);
+
+protected:
+    /*  Sums the per-cell (or per-tile) moments in `tmp` and converts them
+     *  into mass properties */
+    MassProperties reduce(uint32_t count);
+
+    // Per-cell (or per-tile) moments, which are summed on the host
+    Ptr<float[]> tmp;
+    size_t tmp_size=0;
+};
+
+}   // namespace mpr
@@ -0,0 +1,59 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <Eigen/Eigen>
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Tape;
+
+/*
+ *  An Interference check decides whether two shapes overlap, by subdividing
+ *  a world-space box and evaluating both tapes on each cell with interval
+ *  arithmetic.  Cells where either shape is empty are discarded, and each
+ *  tape is pruned independently as cells shrink (with the same tape pushing
+ *  as eval_tiles_i).
+ *
+ *  Subdivision stops as soon as any cell is proven to be inside both
+ *  shapes.  Otherwise, it continues down to `depth`, and the cells which
+ *  are still ambiguous there make up the (possible) overlap region.
+ *
+ *  Like the Octree, this uses the context's tape buffer as scratch space.
+ */
+struct Interference {
+    Interference(const Tape& a, const Tape& b, Context& ctx,
+                 int32_t depth=6,
+                 const Eigen::Vector3f& lower=Eigen::Vector3f(-1, -1, -1),
+                 const Eigen::Vector3f& upper=Eigen::Vector3f(1, 1, 1));
+
+    enum Result {
+        DISJOINT = 0,   // No cell could be inside both shapes
+        POSSIBLE = 1,   // Some cells were still ambiguous at full depth
+        CONFIRMED = 2,  // Some cell is definitely inside both shapes
+    };
+    Result result;
+
+    // Bounds of the cells which were inside (or possibly inside) both
+    // shapes, which is only meaningful if result != DISJOINT.  When the
+    // overlap is CONFIRMED, this only covers the cells found before
+    // returning early.
+    Eigen::Vector3f overlap_lower;
+    Eigen::Vector3f overlap_upper;
+
+    // The deepest supported subdivision (limited by 10-bit Morton indices)
+    static constexpr int32_t MAX_DEPTH = 10;
+};
+
+}   // namespace mpr
@@ -0,0 +1,85 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <Eigen/Eigen>
+
+#include "util.hpp"
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Tape;
+
+/*
+ *  An Octree is a view-independent cache of pruned tapes, built by
+ *  subdividing a world-space box and running the same interval evaluation
+ *  and tape pushing as eval_tiles_i on each cell.
+ *
+ *  Cells are stored as dense levels, in Morton order, so that level L
+ *  begins at index (8^L - 1) / 7 and cell i's parent is cell i / 8 in the
+ *  previous level.  Each cell stores either an index into `tape_data` (the
+ *  pruned tape which is valid anywhere within that cell) or one of the
+ *  CELL_EMPTY / CELL_FILLED markers.
+ *
+ *  The root tape is stored at index 0 of `tape_data`, so the whole array can
+ *  be copied into a Context's tape buffer and used directly; see
+ *  Context::render3D(const Octree&, ...).
+ *
+ *  Pruning depends on the tape's free variables, so the octree must be
+ *  rebuilt after changing them with Tape::setVar.
+ */
+struct Octree {
+    Octree(const Tape& tape, Context& ctx, int32_t depth=5,
+           const Eigen::Vector3f& lower=Eigen::Vector3f(-1, -1, -1),
+           const Eigen::Vector3f& upper=Eigen::Vector3f(1, 1, 1));
+
+    /*  Writes the octree to a binary stream.  Returns false on failure. */
+    bool save(std::ostream& out) const;
+
+    /*  Reads an octree from a binary stream, returning nullptr on failure */
+    static std::unique_ptr<Octree> load(std::istream& in);
+
+    /*  Returns the number of cells in all levels up to `depth` */
+    static uint32_t numCells(int32_t depth);
+
+    /*  Returns the index of the first cell in the given level */
+    static uint32_t levelOffset(int32_t level);
+
+    enum CellState {
+        CELL_EMPTY = -1,
+        CELL_FILLED = -2,
+    };
+
+    Eigen::Vector3f lower;
+    Eigen::Vector3f upper;
+    int32_t depth;
+
+    // tape_data is a pointer in GPU (unified) memory, and is a copy of the
+    // prefix of the tape buffer which was used during construction.
+    Ptr<uint64_t[]> tape_data;
+    int32_t tape_length;
+
+    // Tape indices (or CellState markers) for every cell in every level
+    Ptr<int32_t[]> cells;
+
+    // The deepest supported tree, which is about 19M cells
+    static constexpr int32_t MAX_DEPTH = 8;
+
+protected:
+    Octree() { /* Used when loading from a file */ }
+};
+
+}   // namespace mpr
@@ -15,6 +15,10 @@ Copyright (C) 2019-2020  Matt Keeter
 #define NUM_THREADS (64 * NUM_TILES)
 #define SUBTAPE_CHUNK_SIZE 64
 
+// Every evaluator stores its slots in a fixed-size array on the stack
+// (e.g. float slots[128]), so tapes can't use more slots than this.
+#define MAX_SLOTS 128
+
 #ifdef BIG_SERVER
 #define NUM_SUBTAPES 6400000
 #else
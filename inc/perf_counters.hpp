@@ -0,0 +1,46 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+
+namespace mpr {
+
+/*
+ *  PerfCounters reads hardware performance counters for the calling thread,
+ *  using perf_event_open on Linux.  Each thread opens its own counter group
+ *  the first time that it reads, and closes it when the thread exits.
+ *
+ *  Counters may be unavailable (on other platforms, in virtual machines, or
+ *  when perf_event_paranoid forbids it), in which case read() returns false
+ *  and a single warning is printed.  Individual counters may also be
+ *  missing on some CPUs; their values are reported as UNAVAILABLE.
+ */
+struct PerfCounters {
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        LLC_MISSES,
+        NUM_COUNTERS,
+    };
+    static constexpr uint64_t UNAVAILABLE = UINT64_MAX;
+
+    /*  Short name for a counter, e.g. "branch_misses" */
+    static const char* name(unsigned counter);
+
+    /*  Reads the calling thread's counters, scaled to account for
+     *  multiplexing.  Returns false if counters are unavailable. */
+    static bool read(uint64_t (&out)[NUM_COUNTERS]);
+};
+
+}   // namespace mpr
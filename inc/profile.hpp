@@ -0,0 +1,134 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+#include "clause.hpp"
+#include "gpu_opcode.hpp"
+
+namespace mpr {
+
+// Forward declaration
+struct Tape;
+
+/*
+ *  Profile counts how many times each opcode and each clause is executed
+ *  by the tape evaluators, in interval, float, and derivative modes, and
+ *  how often each min/max clause picks one branch during interval
+ *  evaluation (which is what lets push_tape prune the other branch).
+ *
+ *  Counting is only compiled in when MPR_PROFILE is defined (with the
+ *  MPR_PROFILE CMake option), since it adds global atomics to every clause;
+ *  otherwise, every function here is a no-op and report() says so.
+ *
+ *  Counts are attributed to the GPU stage (i.e. MPR_TRACE_GPU scope) in
+ *  which they happened, or to "(other)" outside of any stage.  Clauses are
+ *  identified by their 64-bit encoding, which pruned tapes copy verbatim
+ *  (or with min/max rewritten to a copy), so counts from every subtape are
+ *  mapped back to the clause in the original tape.  Counters are global,
+ *  so only profile one render at a time.
+ */
+struct Profile {
+    enum Mode {
+        INTERVAL,
+        FLOAT,
+        DERIV,
+        NUM_MODES,
+    };
+
+    /*  Discards every count */
+    static void reset();
+
+    /*  Waits for the GPU, then adds every count since the last call to
+     *  the given stage */
+    static void collect(const char* stage);
+
+    /*  Prints an opcode histogram for each stage, the `top` clauses with
+     *  the most executions across every stage, and how often the busiest
+     *  min/max clauses picked each branch in each stage.  The tape must be
+     *  the one that was rendered, for clause indices to be meaningful. */
+    static void report(const Tape& tape, FILE* f=stdout, unsigned top=20);
+
+    /*  Collects counts into the named stage when it goes out of scope */
+    struct Stage {
+        Stage(const char* name);
+        ~Stage();
+        const char* name;
+    };
+};
+
+#ifdef MPR_PROFILE
+
+// Number of distinct clauses which can be counted
+constexpr unsigned PROFILE_TABLE_SIZE = 1 << 14;
+constexpr unsigned PROFILE_NUM_OPS = GPU_OP_TAG_LHS + 1;
+
+struct ProfileEntry {
+    unsigned long long clause;  // 0 if this entry is unused
+    unsigned long long count[Profile::NUM_MODES];
+
+    // Interval evaluations of a min/max clause which kept both branches,
+    // picked the LHS, or picked the RHS (matching push_tape's choices)
+    unsigned long long choice[3];
+};
+
+#ifdef __CUDACC__
+extern __device__ ProfileEntry profile_table[PROFILE_TABLE_SIZE];
+extern __device__ unsigned long long
+    profile_ops[Profile::NUM_MODES][PROFILE_NUM_OPS];
+
+/*  Finds (or claims) the table entry for a clause, using open addressing.
+ *  Returns nullptr if the table is full. */
+__device__ inline ProfileEntry* profile_entry(uint64_t d) {
+    unsigned h = (unsigned)((d * 0x9E3779B97F4A7C15ull) >> 40);
+    for (unsigned i=0; i < PROFILE_TABLE_SIZE; ++i) {
+        ProfileEntry* e = &profile_table[(h + i) % PROFILE_TABLE_SIZE];
+        const unsigned long long prev = atomicCAS(&e->clause, 0ull, d);
+        if (prev == 0 || prev == d) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+__device__ inline void profile_clause(Profile::Mode mode, uint64_t d) {
+    const uint8_t op = OP(&d);
+    if (op == GPU_OP_JUMP || op == GPU_OP_MARK_X || op == GPU_OP_MARK_XY ||
+        op >= PROFILE_NUM_OPS)
+    {
+        return;
+    }
+    atomicAdd(&profile_ops[mode][op], 1ull);
+    if (ProfileEntry* e = profile_entry(d)) {
+        atomicAdd(&e->count[mode], 1ull);
+    }
+}
+
+__device__ inline void profile_choice(uint64_t d, int choice) {
+    if (ProfileEntry* e = profile_entry(d)) {
+        atomicAdd(&e->choice[choice], 1ull);
+    }
+}
+#endif  // __CUDACC__
+
+#define PROFILE_CLAUSE(mode, d) profile_clause(mode, d)
+#define PROFILE_CHOICE(d, c) profile_choice(d, c)
+
+#else   // !MPR_PROFILE
+
+#define PROFILE_CLAUSE(mode, d)
+#define PROFILE_CHOICE(d, c)
+
+#endif
+
+}   // namespace mpr
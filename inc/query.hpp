@@ -0,0 +1,107 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <Eigen/Eigen>
+
+#include "util.hpp"
+
+namespace mpr {
+
+// Forward declaration
+struct Octree;
+
+/*
+ *  A Query evaluates large batches of arbitrary points against a model,
+ *  using an Octree of pruned tapes rather than the root tape.
+ *
+ *  Each point is first located in the octree.  Points which land in a cell
+ *  that was proven empty or filled can be classified without evaluating
+ *  anything; the rest are bucketed by their deepest octree cell (with a
+ *  counting sort) so that neighbouring threads share the same pruned tape,
+ *  then evaluated with that cell's tape.
+ *
+ *  Rays are searched front-to-back in segments, using the octree to skip
+ *  empty regions and to pick a pruned tape for each segment.
+ *
+ *  Points outside of the octree's bounds fall back to the root tape.
+ *  The octree must outlive the Query.
+ */
+struct Query {
+    Query(const Octree& octree);
+
+    /*  Classifies each point as inside (1) or outside (0) the model,
+     *  storing results in `inside` */
+    void contains(const std::vector<Eigen::Vector3f>& pts);
+
+    /*  Evaluates the field value at each point, storing results in `values` */
+    void distance(const std::vector<Eigen::Vector3f>& pts);
+
+    /*  Evaluates the field value and its partial derivatives at each point,
+     *  storing results in `gradients` as (dx, dy, dz, value) */
+    void gradient(const std::vector<Eigen::Vector3f>& pts);
+
+    /*  Casts a ray from each origin along the matching direction (which
+     *  doesn't need to be normalized), storing results in `hits` as the
+     *  surface normal and distance (nx, ny, nz, t).  Rays are clipped to
+     *  the octree's bounds; rays which miss have t = -1.
+     *
+     *  Hits are found to within `epsilon` along the ray. */
+    void raycast(const std::vector<Eigen::Vector3f>& origins,
+                 const std::vector<Eigen::Vector3f>& dirs,
+                 float epsilon=1e-4f);
+
+    const Octree& octree;
+
+    // Results from the most recent query, in the same order as the points.
+    // Only the array belonging to that kind of query is valid.
+    Ptr<uint8_t[]> inside;
+    Ptr<float[]> values;
+    Ptr<float4[]> gradients;
+    Ptr<float4[]> hits;
+
+    // Number of points which needed per-point evaluation in the most
+    // recent query (i.e. which weren't classified by the octree alone)
+    uint32_t num_evaluated=0;
+
+protected:
+    enum Mode {
+        QUERY_CONTAINS,
+        QUERY_DISTANCE,
+        QUERY_GRADIENT,
+    };
+
+    /*  Uploads and buckets the points, then evaluates every point which
+     *  needs it in the given mode. */
+    void run(const std::vector<Eigen::Vector3f>& pts, Mode mode);
+
+    /*  Makes sure that every per-point buffer can hold `count` items */
+    void resize(uint32_t count);
+
+    // Scratch buffers, which are only reallocated when they need to grow
+    Ptr<float3[]> points;   // Uploaded points (or ray origins)
+    Ptr<float3[]> dirs;     // Uploaded ray directions
+    Ptr<int32_t[]> tapes;   // Tape index for each point (or -1 if done)
+    Ptr<int32_t[]> keys;    // Deepest octree cell for each point
+    Ptr<int32_t[]> order;   // Point indices, sorted by key
+    size_t points_size=0;
+
+    Ptr<int32_t[]> counts;  // Number of points in each cell
+    Ptr<int32_t[]> offsets; // Start offsets (exclusive scan of counts)
+    size_t offsets_size=0;
+
+    Ptr<uint8_t[]> scan_storage;    // Temporary storage for the scan
+    size_t scan_storage_size=0;
+};
+
+}   // namespace mpr
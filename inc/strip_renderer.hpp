@@ -0,0 +1,90 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include "util.hpp"
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Tape;
+
+/*
+ *  A StripRenderer splits an image into horizontal strips (made of whole
+ *  rows of 64^2 tiles) and renders them on several GPUs at once.
+ *
+ *  Each device has its own Context, so its tape buffer, tile lists, and
+ *  strip output stay in that device's memory; the only shared state is the
+ *  index of the next strip, which devices claim one at a time (so a faster
+ *  device, or one with emptier strips, takes more of them).  Finished
+ *  strips are copied into the full-size image and normals.
+ *
+ *  Each strip is rendered with the full image's matrix, adjusted so that
+ *  the strip covers its part of the image, so the results match a single
+ *  Context of the same size (up to tape pruning, which depends on the
+ *  tile boundaries).
+ *
+ *  Multi-output tapes are rendered, but per-pixel output IDs aren't
+ *  gathered from the strips.
+ */
+struct StripRenderer {
+    /*  Builds a context on each of the given CUDA devices, or on every
+     *  visible device if the list is empty.  The strip height is rounded
+     *  up to a multiple of 64 pixels. */
+    StripRenderer(int32_t image_width_px, int32_t image_height_px,
+                  int32_t image_depth_px,
+                  std::vector<int> devices=std::vector<int>(),
+                  int32_t strip_height_px=256);
+    ~StripRenderer();
+
+    /*  Renders into `image` (as a heightmap) and `normals` */
+    void render3D(const Tape& tape, const Eigen::Matrix4f& mat);
+
+    /*  Renders into `image`, which is non-zero for filled pixels (leaving
+     *  `normals` unchanged) */
+    void render2D(const Tape& tape, const Eigen::Matrix3f& mat,
+                  const float z=0.0f);
+
+    const int32_t image_width_px;
+    const int32_t image_height_px;
+    const int32_t image_depth_px;
+    const int32_t image_size_px;    // The longer of width and height
+    const int32_t strip_height_px;
+
+    // Full-size results, in unified memory
+    Ptr<int32_t[]> image;
+    Ptr<uint32_t[]> normals;
+
+    // Devices, their contexts, and the number of strips that each one
+    // rendered in the most recent render
+    std::vector<int> devices;
+    std::vector<int32_t> strips_rendered;
+
+protected:
+    /*  Renders every strip, claiming them from a shared counter with one
+     *  thread per device.  `f` renders a single strip into a context, given
+     *  the matrix which maps the strip into the full image (as a 3D
+     *  transform, in render space).  Normals are only copied back from the
+     *  strips if `copy_normals` is set. */
+    template <typename F>
+    void run(F f, bool copy_normals);
+
+    std::vector<std::unique_ptr<Context>> contexts;
+};
+
+}   // namespace mpr
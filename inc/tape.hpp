@@ -11,6 +11,8 @@ Copyright (C) 2019-2020  Matt Keeter
 */
 #pragma once
 #include <cstdint>
+#include <map>
+#include <vector>
 
 #include "util.hpp"
 
@@ -22,11 +24,63 @@ class Tree;
 namespace mpr {
 
 struct Tape {
-    Tape(const libfive::Tree& tree);
+    /*  Builds a tape from a tree.  If threads > 1, then the tree is split
+     *  into that many subtrees, which are traversed in parallel; this only
+     *  helps for very large trees.
+     *
+     *  If schedule is true, then clauses are sorted into groups by the axes
+     *  that they depend on, and each group is reordered to reduce the number
+     *  of slots that are live at once; otherwise, they're emitted in DFS
+     *  order without grouping (which is only useful for comparison). */
+    Tape(const libfive::Tree& tree, unsigned threads=1, bool schedule=true);
+
+    /*  Builds a single tape with multiple outputs, sharing any common
+     *  subexpressions.  The tape's value is the min of every output, and
+     *  each output is tagged with its index in `shapes`, so that renderers
+     *  can find which output is frontmost (or inside) at each pixel. */
+    Tape(const std::vector<libfive::Tree>& shapes, unsigned threads=1,
+         bool schedule=true);
+
+    /*  Builds a tape with one axis (0, 1, 2 for X, Y, Z) fixed to a constant
+     *  value.  Every clause which becomes constant is folded away, so the
+     *  new tape only contains clauses that depend on the other axes.
+     *
+     *  Free variables are folded with their current values, so the new
+     *  tape doesn't support setVar. */
+    Tape(const Tape& tape, unsigned axis, float value);
+
+    /*  Host-side implementation of axis specialization, which operates on a
+     *  flat (unpushed) tape and returns the specialized tape's clauses. */
+    static std::vector<uint64_t> specialize(const uint64_t* data,
+                                            int32_t length,
+                                            unsigned axis, float value);
 
     // data is a pointer in GPU (unified) memory
     Ptr<uint64_t[]> data;
     int32_t length;
+
+    /*  Sets the value of a free variable (given as the libfive::Tree::Id of
+     *  a libfive::Tree::var()).  The value is written into the tape in place,
+     *  so the next render uses it without rebuilding anything; this must not
+     *  be called while a render is running.  Returns false if the variable
+     *  isn't used by this tape.  Free variables start at 0. */
+    bool setVar(const void* var, float value);
+
+    /*  Returns the value of a free variable, or 0 if it isn't in the tape */
+    float getVar(const void* var) const;
+
+    /*  Returns the GPU memory held by the tape (which doesn't change) */
+    MemoryUsage memoryUsage() const;
+
+    // Number of slots used during evaluation (including the unused slot 0)
+    int32_t num_slots;
+
+    // Number of tagged outputs (1 for a single shape, which isn't tagged)
+    int32_t num_outputs;
+
+    // Maps each free variable's libfive::Tree::Id to the index of the
+    // GPU_OP_COPY_IMM clause which loads its value
+    std::map<const void*, int32_t> vars;
 };
 
 } // namespace mpr
@@ -0,0 +1,133 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+// Forward declaration
+namespace libfive {
+class Tree;
+}
+
+namespace mpr {
+
+// Forward declarations
+struct Context;
+struct Octree;
+struct Tape;
+
+/*
+ *  A TapeCache keeps recently used tapes (and octrees built from them),
+ *  keyed by a structural hash of their trees, so that rebuilding a model
+ *  which was seen recently (e.g. after reverting an edit, or in another
+ *  request) doesn't rebuild its tape.
+ *
+ *  The hash only depends on the trees' structure and constants, so equal
+ *  trees which were built separately (and have different Tree::Ids) share
+ *  a tape.  Free variables are the exception: they're hashed by identity,
+ *  since Tape::setVar looks them up by Tree::Id.  Each entry also keeps a
+ *  canonical fingerprint of its trees, which is compared on every hit, so
+ *  a hash collision is treated as a miss rather than returning the wrong
+ *  tape.
+ *
+ *  Cached tapes are shared with every caller, so setVar on a cached tape
+ *  changes it for everyone (and its values are whatever they were last set
+ *  to, rather than 0).  Tapes and octrees stay alive as long as someone
+ *  holds them, even after being evicted.
+ *
+ *  When the GPU memory held by cached entries goes over the budget, the
+ *  least recently used entries are evicted.  Every method is thread-safe;
+ *  tapes are built without holding the lock.
+ */
+struct TapeCache {
+    TapeCache(size_t max_bytes);
+
+    /*  A process-wide cache, with a 256 MB budget */
+    static TapeCache& instance();
+
+    /*  Returns the tape for the given tree (or trees, for a multi-output
+     *  tape), building it if it isn't cached.  Arguments are the same as
+     *  the Tape constructors. */
+    std::shared_ptr<Tape> get(const libfive::Tree& tree,
+                              unsigned threads=1, bool schedule=true);
+    std::shared_ptr<Tape> get(const std::vector<libfive::Tree>& shapes,
+                              unsigned threads=1, bool schedule=true);
+
+    /*  Returns an octree for a tape returned by get(), building it (with
+     *  the given context) if there isn't one for these parameters.  Octrees
+     *  depend on the tape's free variables, so their current values are
+     *  part of the key.  If the tape isn't in the cache (because it was
+     *  evicted), the octree is built but not kept. */
+    std::shared_ptr<Octree> octree(
+            const std::shared_ptr<Tape>& tape, Context& ctx,
+            int32_t depth=5,
+            const Eigen::Vector3f& lower=Eigen::Vector3f(-1, -1, -1),
+            const Eigen::Vector3f& upper=Eigen::Vector3f(1, 1, 1));
+
+    /*  Returns a structural hash of the given trees */
+    static uint64_t hash(const std::vector<libfive::Tree>& shapes);
+
+    /*  Drops every entry */
+    void clear();
+
+    /*  Statistics since construction (or the last clear) */
+    size_t hits();
+    size_t misses();
+    size_t bytes();     // GPU memory held by cached tapes and octrees
+
+    const size_t max_bytes;
+
+protected:
+    struct CachedOctree {
+        int32_t depth;
+        Eigen::Vector3f lower;
+        Eigen::Vector3f upper;
+        std::vector<float> vars;    // Free variable values, in tape order
+        std::shared_ptr<Octree> octree;
+    };
+    struct Entry {
+        uint64_t key;
+        std::vector<uint64_t> fingerprint;
+        std::shared_ptr<Tape> tape;
+        std::vector<CachedOctree> octrees;
+        size_t bytes;
+    };
+
+    /*  Evicts least-recently-used entries until we're under budget, always
+     *  keeping the most recent one.  Must be called with the lock held. */
+    void evict();
+
+    /*  Drops a single entry.  Must be called with the lock held. */
+    void erase(std::list<Entry>::iterator itr);
+
+    std::mutex mutex;
+
+    // Entries in most- to least-recently used order, with a map from keys
+    // (hash and scheduling flag) into the list
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+    // Key of each cached tape, so that octree() can find its entry
+    std::unordered_map<const Tape*, uint64_t> keys;
+
+    size_t total_bytes=0;
+    size_t num_hits=0;
+    size_t num_misses=0;
+};
+
+}   // namespace mpr
@@ -0,0 +1,107 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include "perf_counters.hpp"
+#include "profile.hpp"
+
+namespace mpr {
+
+/*
+ *  Trace records a timeline of scoped events (render stages, effects, and
+ *  tape construction), which is written as Chrome trace JSON and can be
+ *  opened in Perfetto or chrome://tracing.  Each host thread gets its own
+ *  lane.
+ *
+ *  When tracing is off, a scope costs a single relaxed atomic load.  When
+ *  it's on, GPU scopes synchronize the calling thread's stream when they
+ *  open and close, so that they measure the GPU work in the scope (rather
+ *  than just the time to launch kernels); this slows rendering a little.
+ *
+ *  Optionally, CPU scopes also record hardware performance counters
+ *  (cycles, instructions, branch misses, and cache misses) for the host
+ *  work done by the calling thread in that scope.  GPU scopes don't, since
+ *  their host time is mostly spent waiting on the stream.
+ */
+struct Trace {
+    /*  Starts recording events, discarding any previous events.  If
+     *  `counters` is true, CPU scopes also record performance counters. */
+    static void start(bool counters=false);
+
+    /*  Stops recording and writes every event to the given file, returning
+     *  false if it couldn't be written */
+    static bool stop(const char* filename);
+
+    /*  Prints totals for each event name (calls, time, and any counters)
+     *  from the most recent recording */
+    static void summary(FILE* f=stdout);
+
+    static bool enabled() {
+        return recording.load(std::memory_order_relaxed);
+    }
+
+    /*  Records an event from construction to destruction.  The name must
+     *  outlive the trace (i.e. it should be a string literal). */
+    struct Scope {
+        Scope(const char* name, bool gpu=false)
+            : name(name), gpu(gpu), active(enabled()), counting(false)
+        {
+            if (active) {
+                begin();
+            }
+        }
+        ~Scope() {
+            if (active) {
+                end();
+            }
+        }
+
+    protected:
+        void begin();
+        void end();
+
+        const char* name;
+        const bool gpu;
+        const bool active;
+        bool counting;
+        std::chrono::steady_clock::time_point start;
+        uint64_t counters[PerfCounters::NUM_COUNTERS];
+    };
+
+protected:
+    static std::atomic<bool> recording;
+    static std::atomic<bool> counting;
+};
+
+}   // namespace mpr
+
+#define MPR_TRACE_CAT_(a, b) a ## b
+#define MPR_TRACE_CAT(a, b) MPR_TRACE_CAT_(a, b)
+
+// Records a CPU event for the rest of the enclosing block
+#define MPR_TRACE(name) \
+    mpr::Trace::Scope MPR_TRACE_CAT(mpr_trace_, __LINE__)(name)
+
+// Records an event for the rest of the enclosing block, including any
+// GPU work that it launches.  In profiling builds, this is also a stage
+// for opcode counts (see profile.hpp).
+#ifdef MPR_PROFILE
+#define MPR_TRACE_GPU(name) \
+    mpr::Trace::Scope MPR_TRACE_CAT(mpr_trace_, __LINE__)(name, true); \
+    mpr::Profile::Stage MPR_TRACE_CAT(mpr_profile_, __LINE__)(name)
+#else
+#define MPR_TRACE_GPU(name) \
+    mpr::Trace::Scope MPR_TRACE_CAT(mpr_trace_, __LINE__)(name, true)
+#endif
@@ -15,6 +15,7 @@ Copyright (C) 2019-2020  Matt Keeter
 #include <cuda_runtime.h>
 
 #include <memory>
+#include <vector>
 
 #define CUDA_CHECK(f) { gpuCheck((f), __FILE__, __LINE__); }
 inline void gpuCheck(cudaError_t code, const char *file, int line) {
@@ -24,18 +25,48 @@ inline void gpuCheck(cudaError_t code, const char *file, int line) {
     }
 }
 
+/*  Global tally of memory allocated with CUDA_MALLOC (and not yet freed
+ *  with CUDA_FREE), which is updated from any thread */
+void cudaTrackAlloc(void* ptr, size_t bytes);
+void cudaTrackFree(void* ptr);
+size_t cudaBytesAllocated();
+size_t cudaPeakBytesAllocated();
+
 #define CUDA_MALLOC(T, c) cudaMallocManagedChecked<T>(c, __FILE__, __LINE__)
 template <typename T>
 inline T* cudaMallocManagedChecked(size_t count, const char *file, int line) {
     void* ptr;
     gpuCheck(cudaMallocManaged(&ptr, sizeof(T) * count), file, line);
     //printf("%p allocated %lu at [%s:%i]\n", ptr, sizeof(T) * count, file, line);
+    cudaTrackAlloc(ptr, sizeof(T) * count);
     return static_cast<T*>(ptr);
 }
 
+/*  Advises the driver that a managed buffer is used by the current device,
+ *  then prefetches it there on the calling thread's stream.  Buffers which
+ *  are only touched by kernels are then mapped in bulk (with large GPU
+ *  pages), rather than faulted in piece by piece during the first render.
+ *
+ *  This is skipped on devices without concurrent managed access (where
+ *  managed memory is migrated wholesale at every launch anyway), or if
+ *  it has been turned off with cudaSetPreferDevice(false). */
+void cudaPreferDevice(void* ptr, size_t bytes);
+void cudaSetPreferDevice(bool enabled);
+
+/*  Allocates managed memory which is mostly used by the GPU (such as the
+ *  tape buffer and tile lists), with cudaPreferDevice */
+#define CUDA_MALLOC_DEVICE(T, c) cudaMallocDeviceChecked<T>(c, __FILE__, __LINE__)
+template <typename T>
+inline T* cudaMallocDeviceChecked(size_t count, const char *file, int line) {
+    T* ptr = cudaMallocManagedChecked<T>(count, file, line);
+    cudaPreferDevice(ptr, sizeof(T) * count);
+    return ptr;
+}
+
 #define CUDA_FREE(c) cudaFreeChecked((void*)c, __FILE__, __LINE__)
 inline void cudaFreeChecked(void* ptr, const char *file, int line) {
     //printf("%p freed [%s:%i]\n", ptr, file, line);
+    cudaTrackFree(ptr);
     gpuCheck(cudaFree(ptr), file, line);
 }
 
@@ -49,6 +80,28 @@ struct Deleter {
 template <typename T>
 using Ptr = std::unique_ptr<T, Deleter>;
 
+/*  Memory held by an object, broken down by buffer */
+struct MemoryUsage {
+    struct Buffer {
+        const char* name;
+        size_t bytes;       // Currently allocated
+        size_t peak_bytes;  // Largest allocation since the object was built
+    };
+    std::vector<Buffer> buffers;
+
+    void add(const char* name, size_t bytes, size_t peak_bytes) {
+        buffers.push_back({name, bytes, peak_bytes});
+    }
+    void add(const char* name, size_t bytes) { add(name, bytes, bytes); }
+
+    /*  Returns totals across every buffer */
+    size_t bytes() const;
+    size_t peak_bytes() const;
+
+    /*  Prints a table of buffers to the given file */
+    void print(FILE* f=stdout) const;
+};
+
 // Helper function to do constexpr integer powers
 inline constexpr unsigned __host__ __device__ pow(unsigned p, unsigned n) {
     return n ? p * pow(p, n - 1) : 1;
@@ -51,3 +51,121 @@ echo "Bear sculpt"
 ./benchmark/render_3d_table ../benchmark/files/bear.frep
 mkdir -p bear
 mv *.png bear
+
+echo "------------------------------------------------------------"
+echo "Gears (3D, 24 views from an octree)"
+./benchmark/render_3d_views ../benchmark/files/involute_gear_3d.frep
+
+echo "------------------------------------------------------------"
+echo "Bear sculpt (24 views from an octree)"
+./benchmark/render_3d_views ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                 Sphere tracing benchmarks                  "
+echo "============================================================"
+echo "Gears (3D)"
+# The gears are built from distance-like 2D profiles, so we declare a
+# Lipschitz bound; the mismatched count shows whether it holds.
+./benchmark/render_3d_sphere ../benchmark/files/involute_gear_3d.frep 1
+mkdir -p gears_3d_sphere
+mv *.png gears_3d_sphere
+
+echo "------------------------------------------------------------"
+echo "Bear sculpt"
+./benchmark/render_3d_sphere ../benchmark/files/bear.frep
+mkdir -p bear_sphere
+mv *.png bear_sphere
+
+echo "============================================================"
+echo "                Clause scheduling benchmarks                "
+echo "============================================================"
+./benchmark/tape_scheduling ../benchmark/files/prospero.frep \
+    ../benchmark/files/involute_gear_2d.frep \
+    ../benchmark/files/architecture.frep \
+    ../benchmark/files/involute_gear_3d.frep \
+    ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                Multi-output tape benchmarks                "
+echo "============================================================"
+./benchmark/render_multi
+
+echo "============================================================"
+echo "                  Point query benchmarks                    "
+echo "============================================================"
+./benchmark/query_points ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                 Mass property benchmarks                   "
+echo "============================================================"
+./benchmark/mass_properties
+
+echo "============================================================"
+echo "                 Interference benchmarks                    "
+echo "============================================================"
+./benchmark/interference
+
+echo "============================================================"
+echo "                   View fitting benchmarks                  "
+echo "============================================================"
+./benchmark/fit_view ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                  Aspect ratio benchmarks                   "
+echo "============================================================"
+./benchmark/render_aspect ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                  Depth resolution benchmarks               "
+echo "============================================================"
+./benchmark/render_depth ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                  Level of detail benchmarks                "
+echo "============================================================"
+./benchmark/render_lod ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                   Context resize benchmarks                "
+echo "============================================================"
+./benchmark/context_resize
+
+echo "============================================================"
+echo "                    Context pool benchmarks                 "
+echo "============================================================"
+./benchmark/context_pool ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                  Multi-GPU strip benchmarks                "
+echo "============================================================"
+./benchmark/strip_render ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                     Memory usage report                    "
+echo "============================================================"
+./benchmark/memory_usage ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                 Memory placement benchmarks                "
+echo "============================================================"
+./benchmark/memory_placement ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                       Timeline trace                       "
+echo "============================================================"
+./benchmark/trace_render ../benchmark/files/bear.frep trace.json
+
+echo "============================================================"
+echo "                 Host performance counters                  "
+echo "============================================================"
+./benchmark/perf_counters ../benchmark/files/bear.frep perf_counters.json
+
+echo "============================================================"
+echo "         Opcode profile (requires -DMPR_PROFILE=ON)         "
+echo "============================================================"
+./benchmark/opcode_profile ../benchmark/files/bear.frep
+
+echo "============================================================"
+echo "                    Tape cache benchmarks                   "
+echo "============================================================"
+./benchmark/tape_cache ../benchmark/files/bear.frep
@@ -0,0 +1,239 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <climits>
+
+#include "bounds.hpp"
+#include "clause.hpp"
+#include "context.hpp"
+#include "parameters.hpp"
+#include "tape.hpp"
+
+#include "gpu_eval.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
+
+using namespace mpr;
+
+/*
+ *  eval_bounds_i
+ *
+ *  Evaluates every active cell in one level, with one thread per cell.
+ *  Cells are stored as TileNodes, with `position` being the cell's Morton
+ *  index within its level (and `next` unused).
+ *
+ *  Empty cells are discarded.  Filled cells (and ambiguous cells in the
+ *  deepest level) are added to `bounds`, which accumulates integer bounds
+ *  in units of cells in the deepest level, as
+ *  [xmin, ymin, zmin, xmax, ymax, zmax].  Other ambiguous cells are pruned
+ *  (like in eval_tiles_i) and their eight children are written to
+ *  `out_cells`.
+ */
+__global__
+void eval_bounds_i(uint64_t* const __restrict__ tape_data,
+                   int32_t* const __restrict__ tape_index,
+
+                   const TileNode* const __restrict__ in_cells,
+                   const int32_t in_cell_count,
+                   const int32_t level,
+                   const int32_t depth,
+                   const float3 lower,
+                   const float3 upper,
+
+                   TileNode* const __restrict__ out_cells,
+                   int32_t* const __restrict__ out_cell_count,
+                   int32_t* const __restrict__ bounds)
+{
+    const int32_t cell_index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (cell_index >= in_cell_count) {
+        return;
+    }
+
+    const TileNode cell = in_cells[cell_index];
+    const int3 c = octree_unpack(cell.position);
+    const int32_t n = 1 << level;
+
+    Interval slots[128];
+    slots[((const uint8_t*)tape_data)[1]] =
+        octree_cell_bounds(lower.x, upper.x, c.x, n);
+    slots[((const uint8_t*)tape_data)[2]] =
+        octree_cell_bounds(lower.y, upper.y, c.y, n);
+    slots[((const uint8_t*)tape_data)[3]] =
+        octree_cell_bounds(lower.z, upper.z, c.z, n);
+
+    uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
+    int choice_index = 0;
+    bool has_any_choice = false;
+    const uint64_t* __restrict__ data = walk_tape_i(
+            &tape_data[cell.tape], slots,
+            choices, choice_index, has_any_choice);
+
+    const Interval r = slots[I_OUT(data)];
+    if (r.lower() > 0.0f) {
+        return;
+    }
+
+    if (r.upper() < 0.0f || level == depth) {
+        const int32_t shift = depth - level;
+        atomicMin(&bounds[0], c.x << shift);
+        atomicMin(&bounds[1], c.y << shift);
+        atomicMin(&bounds[2], c.z << shift);
+        atomicMax(&bounds[3], ((c.x + 1) << shift) - 1);
+        atomicMax(&bounds[4], ((c.y + 1) << shift) - 1);
+        atomicMax(&bounds[5], ((c.z + 1) << shift) - 1);
+        return;
+    }
+
+    int32_t tape = cell.tape;
+    if (has_any_choice) {
+        const int32_t t = push_tape(tape_data, tape_index, data,
+                                    choices, choice_index, (int*)slots);
+        if (t != -1) {
+            tape = t;
+        }
+    }
+
+    const int32_t o = atomicAdd(out_cell_count, 8);
+    for (int32_t i=0; i < 8; ++i) {
+        out_cells[o + i].position = cell.position * 8 + i;
+        out_cells[o + i].tape = tape;
+        out_cells[o + i].next = -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace mpr {
+
+constexpr int32_t Bounds::MAX_DEPTH;
+
+Bounds::Bounds(const Tape& tape, Context& ctx, int32_t depth,
+               const Eigen::Vector3f& lower, const Eigen::Vector3f& upper)
+    : lower(lower), upper(upper), empty(true)
+{
+    if (depth < 0 || depth > MAX_DEPTH) {
+        fprintf(stderr, "Invalid bounds depth %i (clamping to [0, %i])\n",
+                depth, MAX_DEPTH);
+        depth = std::max(0, std::min(depth, MAX_DEPTH));
+    }
+
+    cudaMemcpyAsync(ctx.tape_data.get(), tape.data.get(),
+                    sizeof(uint64_t) * tape.length,
+                    cudaMemcpyDeviceToDevice);
+
+    run(ctx, tape.length, depth, lower, upper);
+    if (empty) {
+        return;
+    }
+
+    // Refine within the first result, grown by one cell on each side so
+    // that rounding can't clip the shape, and clamped to the search region
+    const Eigen::Vector3f cell = (upper - lower) / (1 << depth);
+    run(ctx, tape.length, depth,
+        (this->lower - cell).cwiseMax(lower),
+        (this->upper + cell).cwiseMin(upper));
+}
+
+void Bounds::run(Context& ctx, int32_t tape_length, int32_t depth,
+                 const Eigen::Vector3f& lo, const Eigen::Vector3f& hi)
+{
+    // Discard any tapes that were pushed in a previous pass
+    *ctx.tape_index = tape_length;
+
+    Ptr<int32_t[]> counters(CUDA_MALLOC(int32_t, 7));
+    int32_t* const cell_count = &counters[0];
+    int32_t* const bounds = &counters[1];
+    for (unsigned i=0; i < 3; ++i) {
+        bounds[i] = INT_MAX;
+        bounds[i + 3] = INT_MIN;
+    }
+
+    // Double-buffered lists of active cells, starting with the root
+    size_t cells_size = 8;
+    size_t next_size = 8;
+    Ptr<TileNode[]> cells(CUDA_MALLOC(TileNode, cells_size));
+    Ptr<TileNode[]> next(CUDA_MALLOC(TileNode, next_size));
+    cells[0].position = 0;
+    cells[0].tape = 0;
+    cells[0].next = -1;
+    int32_t count = 1;
+
+    const float3 lo_ = make_float3(lo.x(), lo.y(), lo.z());
+    const float3 hi_ = make_float3(hi.x(), hi.y(), hi.z());
+    for (int32_t level=0; level <= depth && count; ++level) {
+        // Make sure that every active cell could be subdivided
+        if (count * 8 > next_size) {
+            next_size = count * 8;
+            next.reset(CUDA_MALLOC(TileNode, next_size));
+        }
+        *cell_count = 0;
+
+        const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+        eval_bounds_i<<<num_blocks, NUM_THREADS>>>(
+            ctx.tape_data.get(),
+            ctx.tape_index.get(),
+            cells.get(), count,
+            level, depth, lo_, hi_,
+            next.get(), cell_count,
+            bounds);
+        CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+
+        count = *cell_count;
+        std::swap(cells, next);
+        std::swap(cells_size, next_size);
+    }
+
+    empty = bounds[0] > bounds[3];
+    if (!empty) {
+        const Eigen::Vector3f size = (hi - lo) / (1 << depth);
+        lower = lo + Eigen::Vector3f(
+                bounds[0], bounds[1], bounds[2]).cwiseProduct(size);
+        upper = lo + Eigen::Vector3f(
+                bounds[3] + 1, bounds[4] + 1, bounds[5] + 1).cwiseProduct(size);
+    }
+}
+
+Eigen::Matrix4f Bounds::fitView(const Context& ctx,
+                                const Eigen::Matrix3f& rotation) const
+{
+    // render3D maps the render volume through the matrix.  The longer image
+    // side spans [-1, 1] (as does Z), and the shorter side spans less, so
+    // we pick a scale which covers the box's extent along every rotated
+    // view axis within that axis's span.
+    const Eigen::Vector3f center = (lower + upper) / 2;
+    const Eigen::Vector3f half = (upper - lower) / 2;
+    const Eigen::Vector3f span(float(ctx.image_width_px) / ctx.image_size_px,
+                               float(ctx.image_height_px) / ctx.image_size_px,
+                               1.0f);
+    const float scale = (rotation.cwiseAbs().transpose() * half)
+        .cwiseQuotient(span).maxCoeff();
+
+    Eigen::Matrix4f out = Eigen::Matrix4f::Identity();
+    out.topLeftCorner<3, 3>() = rotation * scale;
+    out.topRightCorner<3, 1>() = center;
+    return out;
+}
+
+Eigen::Matrix3f Bounds::fitView2D(const Context& ctx) const {
+    const Eigen::Vector2f center = (lower + upper).head<2>() / 2;
+    const Eigen::Vector2f span(float(ctx.image_width_px) / ctx.image_size_px,
+                               float(ctx.image_height_px) / ctx.image_size_px);
+    const float scale = ((upper - lower).head<2>() / 2)
+        .cwiseQuotient(span).maxCoeff();
+
+    Eigen::Matrix3f out = Eigen::Matrix3f::Identity();
+    out.topLeftCorner<2, 2>() *= scale;
+    out.topRightCorner<2, 1>() = center;
+    return out;
+}
+
+}   // namespace mpr
@@ -9,43 +9,202 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 Copyright (C) 2019-2020  Matt Keeter
 */
+#include <algorithm>
+
 #include "context.hpp"
 #include "parameters.hpp"
 
 namespace mpr {
 
-Context::Context(int32_t image_size_px)
-    : image_size_px(image_size_px)
+constexpr uint8_t Context::LOD_FULL;
+
+bool RenderBudget::exceeded(double elapsed_ms, int64_t tiles) const {
+    return (max_ms > 0 && elapsed_ms > max_ms) ||
+           (max_tiles > 0 && tiles > max_tiles);
+}
+
+// Returns the number of tiles needed to cover the given size, rounding up
+static size_t tile_count(int32_t size_px, int32_t tile_size_px) {
+    return (size_px + tile_size_px - 1) / tile_size_px;
+}
+
+// Shrinks the buffer to hold exactly `count` items, if it's larger than that.
+// If `keep` is set, the first `count` items are copied into the new buffer;
+// otherwise, its contents are not preserved.  If `device` is set, the buffer
+// is placed on the GPU (see cudaPreferDevice).
+template <typename T>
+static void shrink(Ptr<T[]>& ptr, size_t& capacity, size_t count,
+                   bool device=false, bool keep=false)
 {
-    // Build the four stages
-    for (unsigned i=0; i < 4; ++i) {
-        const unsigned tile_size_px = 64 / (1 << (i * 2));
-        stages[i].filled.reset(CUDA_MALLOC(
-                int32_t,
-                pow(image_size_px / tile_size_px, 2)));
+    if (count < capacity) {
+        capacity = count;
+        Ptr<T[]> old(std::move(ptr));
+        if (!keep) {
+            old.reset();    // Free the old buffer first, to reduce peak usage
+        }
+        if (count) {
+            ptr.reset(device ? CUDA_MALLOC_DEVICE(T, count)
+                             : CUDA_MALLOC(T, count));
+            if (keep) {
+                CUDA_CHECK(cudaMemcpy(ptr.get(), old.get(), sizeof(T) * count,
+                                      cudaMemcpyDefault));
+            }
+        }
     }
+}
 
-    normals.reset(CUDA_MALLOC(uint32_t, image_size_px * image_size_px));
+// Makes sure that the buffer can hold at least `count` items.  If it can't,
+// then it is reallocated (without preserving its contents) with at least
+// twice its previous capacity.  If `device` is set, the buffer is placed on
+// the GPU (see cudaPreferDevice).
+template <typename T>
+static void reserve(Ptr<T[]>& ptr, size_t& capacity, size_t count,
+                    bool device=false)
+{
+    if (count > capacity) {
+        capacity = std::max(count, capacity * 2);
+        ptr.reset();    // Free the old buffer first, to reduce peak usage
+        ptr.reset(device ? CUDA_MALLOC_DEVICE(T, capacity)
+                         : CUDA_MALLOC(T, capacity));
+    }
+}
 
+Context::Context(int32_t image_size_px)
+    : Context(image_size_px, image_size_px)
+{
+    // Nothing to do here
+}
+
+Context::Context(int32_t image_width_px, int32_t image_height_px)
+    : Context(image_width_px, image_height_px,
+              std::max(image_width_px, image_height_px))
+{
+    // Nothing to do here
+}
+
+Context::Context(int32_t image_width_px, int32_t image_height_px,
+                 int32_t image_depth_px)
+{
     // Allocate a bunch of memory to store tapes
-    tape_data.reset(CUDA_MALLOC(uint64_t, NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE));
+    // (which is only touched by kernels and memcpys, so it lives on the GPU)
+    tape_data.reset(CUDA_MALLOC_DEVICE(uint64_t,
+                                       NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE));
     tape_index.reset(CUDA_MALLOC(int32_t, 1));
     *tape_index = 0;
 
     // Allocate an index to keep track of active tiles
     num_active_tiles.reset(CUDA_MALLOC(int32_t, 1));
 
+    // Allocate every buffer which depends on the image size
+    resize(image_width_px, image_height_px, image_depth_px);
+
+    // Prefer the L1 cache!
+    cudaDeviceSetCacheConfig(cudaFuncCachePreferL1);
+}
+
+void Context::resize(int32_t image_size_px) {
+    resize(image_size_px, image_size_px);
+}
+
+void Context::resize(int32_t image_width_px, int32_t image_height_px) {
+    resize(image_width_px, image_height_px,
+           std::max(image_width_px, image_height_px));
+}
+
+void Context::resize(int32_t image_width_px, int32_t image_height_px,
+                     int32_t image_depth_px)
+{
+    this->image_width_px = image_width_px;
+    this->image_height_px = image_height_px;
+    this->image_size_px = std::max(image_width_px, image_height_px);
+    this->image_depth_px = image_depth_px;
+
+    // Each of the four stages has a 2D array large enough to hold the
+    // (rounded-up) number of tiles on each axis.  Only the final stage's
+    // array is read back by the host, so the others live on the GPU.
+    for (unsigned i=0; i < 4; ++i) {
+        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        reserve(stages[i].filled, stages[i].filled_array_size,
+                tile_count(image_width_px, tile_size_px) *
+                tile_count(image_height_px, tile_size_px), i < 3);
+    }
+
+    const size_t pixels = image_width_px * image_height_px;
+    reserve(normals, normals_array_size, pixels);
+    reserve(ids, ids_array_size, pixels);
+    reserve(lod, lod_array_size, tile_count(image_width_px, 64) *
+                                 tile_count(image_height_px, 64));
+
     // The first array of tiles must have enough space to hold all of the
     // 64^3 tiles in the volume, which shouldn't be too much.
-    stages[0].tiles.reset(CUDA_MALLOC(
-            TileNode,
-            pow(image_size_px / 64, 3)));
+    reserve(stages[0].tiles, stages[0].tile_array_size,
+            tile_count(image_width_px, 64) *
+            tile_count(image_height_px, 64) *
+            tile_count(image_depth_px, 64), true);
 
     // We leave the other stage_t's tile arrays unallocated for now, since
     // they're initialized to all zeros and will be resized to fit later.
+}
 
-    // Prefer the L1 cache!
-    cudaDeviceSetCacheConfig(cudaFuncCachePreferL1);
+MemoryUsage Context::memoryUsage() const {
+    static const char* FILLED_NAMES[4] = {
+        "stages[0].filled", "stages[1].filled",
+        "stages[2].filled", "stages[3].filled"};
+    static const char* TILES_NAMES[4] = {
+        "stages[0].tiles", "stages[1].tiles",
+        "stages[2].tiles", "stages[3].tiles"};
+
+    MemoryUsage out;
+    out.add("tape_data",
+            sizeof(uint64_t) * NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE);
+    for (unsigned i=0; i < 4; ++i) {
+        out.add(FILLED_NAMES[i], sizeof(int32_t) * stages[i].filled_array_size);
+        out.add(TILES_NAMES[i], sizeof(TileNode) * stages[i].tile_array_size);
+    }
+    // values holds either Intervals or float2s, which are the same size
+    out.add("values", sizeof(float2) * values_size);
+    out.add("normals", sizeof(uint32_t) * normals_array_size);
+    out.add("ids", sizeof(int32_t) * ids_array_size);
+    out.add("lod", sizeof(uint8_t) * lod_array_size);
+
+    // Buffers only shrink in trim(), so the peak is either their current
+    // size or their size when trim() was last called.
+    for (unsigned i=0; i < trimmed.buffers.size(); ++i) {
+        out.buffers[i].peak_bytes = std::max(out.buffers[i].peak_bytes,
+                                             trimmed.buffers[i].peak_bytes);
+    }
+    return out;
+}
+
+void Context::trim() {
+    trimmed = memoryUsage();
+
+    // The final image, normals, IDs, and level of detail are the results
+    // of the last render, so their contents are kept.
+    for (unsigned i=0; i < 4; ++i) {
+        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        shrink(stages[i].filled, stages[i].filled_array_size,
+               tile_count(image_width_px, tile_size_px) *
+               tile_count(image_height_px, tile_size_px), i < 3, i == 3);
+    }
+
+    const size_t pixels = image_width_px * image_height_px;
+    shrink(normals, normals_array_size, pixels, false, true);
+    shrink(ids, ids_array_size, pixels, false, true);
+    shrink(lod, lod_array_size, tile_count(image_width_px, 64) *
+                                tile_count(image_height_px, 64), false, true);
+    shrink(stages[0].tiles, stages[0].tile_array_size,
+           tile_count(image_width_px, 64) *
+           tile_count(image_height_px, 64) *
+           tile_count(image_depth_px, 64), true);
+
+    // Later stages and the values array are sized (and regrown) by each
+    // render, so we can free them completely.
+    for (unsigned i=1; i < 4; ++i) {
+        shrink(stages[i].tiles, stages[i].tile_array_size, 0);
+    }
+    values.reset();
+    values_size = 0;
 }
 
 } // namespace mpr
@@ -9,24 +9,103 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 Copyright (C) 2019-2020  Matt Keeter
 */
+#include <chrono>
+
 #include "clause.hpp"
 #include "context.hpp"
+#include "octree.hpp"
 #include "parameters.hpp"
 #include "tape.hpp"
+#include "trace.hpp"
 
 #include "gpu_deriv.hpp"
+#include "gpu_eval.hpp"
 #include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
 #include "gpu_opcode.hpp"
 
 using namespace mpr;
 
+/*
+ *  The grid of tiles used at one stage of rendering.  The number of tiles
+ *  on each axis is rounded up to cover the whole image, so tiles along the
+ *  far edges may only be partially inside it.
+ *
+ *  X and Y share a scale, so that pixels are square: the image's longer
+ *  side spans +/-1 in render space and the shorter side is centered within
+ *  it.  Z always spans +/-1 over the image's depth.
+ */
+struct TileGrid {
+    __host__ __device__
+    TileGrid(int3 size_px, int32_t tile_size_px, int32_t image_size_px)
+        : size_px(size_px), tile_size_px(tile_size_px),
+          tiles(make_int3((size_px.x + tile_size_px - 1) / tile_size_px,
+                          (size_px.y + tile_size_px - 1) / tile_size_px,
+                          (size_px.z + tile_size_px - 1) / tile_size_px)),
+          image_size_px(image_size_px)
+    {
+        // Nothing to do here
+    }
+
+    /*  Returns the grid for tiles which are `n` times smaller per side */
+    __host__ __device__
+    TileGrid subdivided(int32_t n) const {
+        return TileGrid(size_px, tile_size_px / n, image_size_px);
+    }
+
+    /*  Converts (possibly fractional) pixel positions into render space */
+    __device__ float x(float px) const
+        { return (2.0f * px - size_px.x) / image_size_px; }
+    __device__ float y(float py) const
+        { return (2.0f * py - size_px.y) / image_size_px; }
+    __device__ float z(float pz) const
+        { return 2.0f * pz / size_px.z - 1.0f; }
+
+    /*  Returns the render-space bounds of the tile at the given position,
+     *  clipped to the image (so that partial tiles don't see geometry
+     *  which is outside of the image). */
+    __device__ Interval tile_x(int32_t t) const {
+        return {x(t * tile_size_px), x(min((t + 1) * tile_size_px, size_px.x))};
+    }
+    __device__ Interval tile_y(int32_t t) const {
+        return {y(t * tile_size_px), y(min((t + 1) * tile_size_px, size_px.y))};
+    }
+    __device__ Interval tile_z(int32_t t) const {
+        return {z(t * tile_size_px), z(min((t + 1) * tile_size_px, size_px.z))};
+    }
+
+    int3 size_px;           // Image width, height, and depth
+    int32_t tile_size_px;   // Size of a single tile (in pixels)
+    int3 tiles;             // Number of tiles along each axis
+    int32_t image_size_px;  // The longer of the image's width and height
+};
+
+/*
+ *  Builds the grid of tiles with the given size for a context.  In 2D, the
+ *  depth should be 1, so that there's a single layer of tiles.
+ */
+static TileGrid tile_grid(const Context& ctx, int32_t tile_size_px,
+                          int32_t depth_px)
+{
+    return TileGrid(make_int3(ctx.image_width_px, ctx.image_height_px,
+                              depth_px),
+                    tile_size_px, ctx.image_size_px);
+}
+
+static inline __device__
+int4 unpack(int32_t pos, int3 tiles)
+{
+    return make_int4(pos % tiles.x,
+                    (pos / tiles.x) % tiles.y,
+                    (pos / tiles.x) / tiles.y,
+                     pos % (tiles.x * tiles.y));
+}
+
 static inline __device__
 int4 unpack(int32_t pos, int32_t tiles_per_side)
 {
-    return make_int4(pos % tiles_per_side,
-                    (pos / tiles_per_side) % tiles_per_side,
-                    (pos / tiles_per_side) / tiles_per_side,
-                     pos % (tiles_per_side * tiles_per_side));
+    return unpack(pos, make_int3(tiles_per_side, tiles_per_side,
+                                 tiles_per_side));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -78,7 +157,7 @@ void preload_tiles(TileNode* const __restrict__ in_tiles,
 __global__
 void calculate_intervals_3d(const TileNode* const __restrict__ in_tiles,
                             const uint32_t in_tile_count,
-                            const uint32_t tiles_per_side,
+                            const TileGrid grid,
                             const Eigen::Matrix4f mat,
                             Interval* const __restrict__ values)
 {
@@ -87,13 +166,10 @@ void calculate_intervals_3d(const TileNode* const __restrict__ in_tiles,
         return;
     }
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
-    const Interval ix = {(pos.x / (float)tiles_per_side - 0.5f) * 2.0f,
-                   ((pos.x + 1) / (float)tiles_per_side - 0.5f) * 2.0f};
-    const Interval iy = {(pos.y / (float)tiles_per_side - 0.5f) * 2.0f,
-                   ((pos.y + 1) / (float)tiles_per_side - 0.5f) * 2.0f};
-    const Interval iz = {(pos.z / (float)tiles_per_side - 0.5f) * 2.0f,
-                   ((pos.z + 1) / (float)tiles_per_side - 0.5f) * 2.0f};
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
+    const Interval ix = grid.tile_x(pos.x);
+    const Interval iy = grid.tile_y(pos.y);
+    const Interval iz = grid.tile_z(pos.z);
 
     Interval ix_, iy_, iz_, iw_;
     ix_ = mat(0, 0) * ix +
@@ -122,7 +198,7 @@ void calculate_intervals_3d(const TileNode* const __restrict__ in_tiles,
 __global__
 void calculate_intervals_2d(const TileNode* const __restrict__ in_tiles,
                             const uint32_t in_tile_count,
-                            const uint32_t tiles_per_side,
+                            const TileGrid grid,
                             const Eigen::Matrix3f mat,
                             const float z,
                             Interval* const __restrict__ values)
@@ -132,11 +208,9 @@ void calculate_intervals_2d(const TileNode* const __restrict__ in_tiles,
         return;
     }
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
-    const Interval ix = {(pos.x / (float)tiles_per_side - 0.5f) * 2.0f,
-                   ((pos.x + 1) / (float)tiles_per_side - 0.5f) * 2.0f};
-    const Interval iy = {(pos.y / (float)tiles_per_side - 0.5f) * 2.0f,
-                   ((pos.y + 1) / (float)tiles_per_side - 0.5f) * 2.0f};
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
+    const Interval ix = grid.tile_x(pos.x);
+    const Interval iy = grid.tile_y(pos.y);
 
     Interval ix_, iy_, iw_;
     ix_ = mat(0, 0) * ix +
@@ -190,7 +264,7 @@ __global__
 void eval_tiles_i(uint64_t* const __restrict__ tape_data,
                   int32_t* const __restrict__ tape_index,
                   int32_t* const __restrict__ image,
-                  const uint32_t tiles_per_side,
+                  const int3 tiles,
 
                   TileNode* const __restrict__ in_tiles,
                   const int32_t in_tile_count,
@@ -215,76 +289,11 @@ void eval_tiles_i(uint64_t* const __restrict__ tape_data,
     // Pick out the tape based on the pointer stored in the tiles list
     const uint64_t* __restrict__ data = &tape_data[in_tiles[tile_index].tape];
 
-    constexpr static int CHOICE_ARRAY_SIZE = 256;
     uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
     int choice_index = 0;
     bool has_any_choice = false;
 
-    while (1) {
-        const uint64_t d = *++data;
-        if (!OP(&d)) {
-            break;
-        }
-        switch (OP(&d)) {
-            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
-
-#define lhs slots[I_LHS(&d)]
-#define rhs slots[I_RHS(&d)]
-#define imm IMM(&d)
-#define out slots[I_OUT(&d)]
-
-            case GPU_OP_SQUARE_LHS: out = square(lhs); break;
-            case GPU_OP_SQRT_LHS:   out = sqrt(lhs); break;
-            case GPU_OP_NEG_LHS:    out = -lhs; break;
-            case GPU_OP_SIN_LHS:    out = sin(lhs); break;
-            case GPU_OP_COS_LHS:    out = cos(lhs); break;
-            case GPU_OP_ASIN_LHS:   out = asin(lhs); break;
-            case GPU_OP_ACOS_LHS:   out = acos(lhs); break;
-            case GPU_OP_ATAN_LHS:   out = atan(lhs); break;
-            case GPU_OP_EXP_LHS:    out = exp(lhs); break;
-            case GPU_OP_ABS_LHS:    out = abs(lhs); break;
-            case GPU_OP_LOG_LHS:    out = log(lhs); break;
-
-            // Commutative opcodes
-            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
-            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
-            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
-            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
-
-#define CHOICE(f, a, b) {                                               \
-    int c = 0;                                                          \
-    out = f(a, b, c);                                                   \
-    if (choice_index < CHOICE_ARRAY_SIZE * 16) {                        \
-        choices[choice_index / 16] |= (c << ((choice_index % 16) * 2)); \
-    }                                                                   \
-    choice_index++;                                                     \
-    has_any_choice |= (c != 0);                                         \
-    break;                                                              \
-}
-            case GPU_OP_MIN_LHS_IMM: CHOICE(min, lhs, imm);
-            case GPU_OP_MIN_LHS_RHS: CHOICE(min, lhs, rhs);
-            case GPU_OP_MAX_LHS_IMM: CHOICE(max, lhs, imm);
-            case GPU_OP_MAX_LHS_RHS: CHOICE(max, lhs, rhs);
-
-            // Non-commutative opcodes
-            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
-            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
-            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
-            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
-            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
-            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
-
-            case GPU_OP_COPY_IMM: out = Interval(imm); break;
-            case GPU_OP_COPY_LHS: out = lhs; break;
-            case GPU_OP_COPY_RHS: out = rhs; break;
-
-            default: assert(false);
-        }
-#undef lhs
-#undef rhs
-#undef imm
-#undef out
-    }
+    data = walk_tape_i(data, slots, choices, choice_index, has_any_choice);
 
     // Check the result
     const uint8_t i_out = I_OUT(data);
@@ -297,7 +306,7 @@ void eval_tiles_i(uint64_t* const __restrict__ tape_data,
 
     // Masked
     if (DIMENSION == 3) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, tiles);
         if (image[pos.w] > pos.z) {
             in_tiles[tile_index].position = -1;
             return;
@@ -306,7 +315,7 @@ void eval_tiles_i(uint64_t* const __restrict__ tape_data,
 
     // Filled
     if (slots[i_out].upper() < 0.0f) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, tiles);
         in_tiles[tile_index].position = -1;
         if (DIMENSION == 3) {
             atomicMax(&image[pos.w], pos.z);
@@ -322,140 +331,122 @@ void eval_tiles_i(uint64_t* const __restrict__ tape_data,
 
     ////////////////////////////////////////////////////////////////////////////
     // Tape pushing!
-    // Use this array to track which slots are active
-    int* const __restrict__ active = (int*)slots;
-    for (unsigned i=0; i < 128; ++i) {
-        active[i] = false;
+    const int32_t out = push_tape(tape_data, tape_index, data,
+                                  choices, choice_index, (int*)slots);
+    if (out == -1) {
+        return;
     }
-    active[i_out] = true;
 
-    // Check to make sure the tape isn't full
-    // This doesn't mean that we'll successfully claim a chunk, because
-    // other threads could claim chunks before us, but it's a way to check
-    // quickly (and prevents tape_index from getting absurdly large).
-    if (*tape_index >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+    // Record the beginning of the tape in the output tile
+    in_tiles[tile_index].tape = out;
+}
+
+/*
+ *  eval_tiles_center
+ *
+ *  Resolves every active tile in `in_tiles` with a single float evaluation
+ *  at its center (using its pruned tape), rather than subdividing it.  This
+ *  is used when a render runs out of budget, so that ambiguous tiles are
+ *  drawn as blocks instead of being left empty.
+ *
+ *  Every active tile is marked as inactive (with no next tile), so later
+ *  lookups stop at this stage.  `lod` has one value per 64^2 column of the
+ *  image, and is set to `stage` in columns with an approximated tile.
+ */
+template <int DIMENSION>
+__global__
+void eval_tiles_center(const uint64_t* const __restrict__ tape_data,
+                       int32_t* const __restrict__ image,
+                       const TileGrid grid,
+                       const uint8_t stage,
+                       uint8_t* const __restrict__ lod,
+
+                       TileNode* const __restrict__ in_tiles,
+                       const int32_t in_tile_count,
+
+                       const Interval* __restrict__ values)
+{
+    const int32_t tile_index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (tile_index >= in_tile_count) {
         return;
     }
 
-    // Claim a chunk of tape
-    int32_t out_index = atomicAdd(tape_index, SUBTAPE_CHUNK_SIZE);
-    int32_t out_offset = SUBTAPE_CHUNK_SIZE;
-
-    // If we've run out of tape, then immediately return
-    if (out_index + out_offset >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+    if (in_tiles[tile_index].position == -1) {
         return;
     }
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
+    in_tiles[tile_index].position = -1;
+    in_tiles[tile_index].next = -1;
 
-    // Write out the end of the tape, which is the same as the ending
-    // of the previous tape (0 opcode, with i_out as the last slot)
-    out_offset--;
-    tape_data[out_index + out_offset] = *data;
+    const int32_t lod_x = pos.x * grid.tile_size_px / 64;
+    const int32_t lod_y = pos.y * grid.tile_size_px / 64;
+    lod[lod_x + lod_y * ((grid.size_px.x + 63) / 64)] = stage;
 
-    while (1) {
-        uint64_t d = *--data;
-        if (!OP(&d)) {
-            break;
-        }
-        const uint8_t op = OP(&d);
-        if (op == GPU_OP_JUMP) {
-            data += JUMP_TARGET(&d);
-            continue;
-        }
+    // The values array stores the tile's bounds after transforming by the
+    // view matrix, so we sample at their midpoints.
+    float slots[128];
+    slots[((const uint8_t*)tape_data)[1]] = values[tile_index * 3].mid();
+    slots[((const uint8_t*)tape_data)[2]] = values[tile_index * 3 + 1].mid();
+    slots[((const uint8_t*)tape_data)[3]] = values[tile_index * 3 + 2].mid();
 
-        const bool has_choice = op >= GPU_OP_MIN_LHS_IMM &&
-                                op <= GPU_OP_MAX_LHS_RHS;
-        choice_index -= has_choice;
-
-        const uint8_t i_out = I_OUT(&d);
-        if (!active[i_out]) {
-            continue;
+    if (walk_tape_f(&tape_data[in_tiles[tile_index].tape], slots) < 0.0f) {
+        if (DIMENSION == 3) {
+            atomicMax(&image[pos.w], pos.z);
+        } else {
+            image[pos.w] = 1;
         }
+    }
+}
 
-        assert(!has_choice || choice_index >= 0);
-
-        const int choice = (has_choice && choice_index < CHOICE_ARRAY_SIZE * 16)
-            ? ((choices[choice_index / 16] >>
-              ((choice_index % 16) * 2)) & 3)
-            : 0;
-
-        // If we're about to write a new piece of data to the tape,
-        // (and are done with the current chunk), then we need to
-        // add another link to the linked list.
-        --out_offset;
-        if (out_offset == 0) {
-            const int32_t prev_index = out_index;
-
-            // Early exit if we can't finish writing out this tape
-            if (*tape_index >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
-                return;
-            }
-            out_index = atomicAdd(tape_index, SUBTAPE_CHUNK_SIZE);
-            out_offset = SUBTAPE_CHUNK_SIZE;
+/*
+ *  assign_octree_tapes
+ *
+ *  For every active tile which is still using a tape from the octree (i.e.
+ *  one which wasn't pushed during this render), finds the deepest octree
+ *  cell which contains the tile's world-space bounds (stored in `values` by
+ *  calculate_intervals_3d).  If that cell is empty, the tile is skipped; if
+ *  it is filled, the tile is written to the image; otherwise, the tile
+ *  starts from that cell's (already pruned) tape.
+ */
+__global__
+void assign_octree_tapes(const int32_t* const __restrict__ cells,
+                         const int32_t depth,
+                         const float3 lower,
+                         const float3 upper,
+                         const int32_t octree_tape_length,
 
-            // Later exit if we claimed a chunk that exceeds the tape array
-            if (out_index + out_offset >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
-                return;
-            }
-            --out_offset;
+                         int32_t* const __restrict__ image,
+                         const int3 tiles,
 
-            // Forward-pointing link
-            OP(&tape_data[out_index + out_offset]) = GPU_OP_JUMP;
-            const int32_t delta = (int32_t)prev_index -
-                                  (int32_t)(out_index + out_offset);
-            JUMP_TARGET(&tape_data[out_index + out_offset]) = delta;
+                         TileNode* const __restrict__ in_tiles,
+                         const int32_t in_tile_count,
 
-            // Backward-pointing link
-            OP(&tape_data[prev_index]) = GPU_OP_JUMP;
-            JUMP_TARGET(&tape_data[prev_index]) = -delta;
-
-            // We've written the jump, so adjust the offset again
-            --out_offset;
-        }
-
-        active[i_out] = false;
-        if (choice == 0) {
-            const uint8_t i_lhs = I_LHS(&d);
-            if (i_lhs) {
-                active[i_lhs] = true;
-            }
-            const uint8_t i_rhs = I_RHS(&d);
-            if (i_rhs) {
-                active[i_rhs] = true;
-            }
-        } else if (choice == 1 /* LHS */) {
-            // The non-immediate is always the LHS in commutative ops, and
-            // min/max (the only clauses that produce a choice) are commutative
-            const uint8_t i_lhs = I_LHS(&d);
-            active[i_lhs] = true;
-            if (i_lhs == i_out) {
-                ++out_offset;
-                continue;
-            } else {
-                OP(&d) = GPU_OP_COPY_LHS;
-            }
-        } else if (choice == 2 /* RHS */) {
-            const uint8_t i_rhs = I_RHS(&d);
-            if (i_rhs) {
-                active[i_rhs] = true;
-                if (i_rhs == i_out) {
-                    ++out_offset;
-                    continue;
-                } else {
-                    OP(&d) = GPU_OP_COPY_RHS;
-                }
-            } else {
-                OP(&d) = GPU_OP_COPY_IMM;
-            }
-        }
-        tape_data[out_index + out_offset] = d;
+                         const Interval* __restrict__ values)
+{
+    const int32_t tile_index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (tile_index >= in_tile_count) {
+        return;
     }
 
-    // Write the beginning of the tape
-    out_offset--;
-    tape_data[out_index + out_offset] = *data;
+    if (in_tiles[tile_index].position == -1 ||
+        in_tiles[tile_index].tape >= octree_tape_length)
+    {
+        return;
+    }
 
-    // Record the beginning of the tape in the output tile
-    in_tiles[tile_index].tape = out_index + out_offset;
+    const int32_t cell = octree_lookup(cells, depth, lower, upper,
+                                       values[tile_index * 3],
+                                       values[tile_index * 3 + 1],
+                                       values[tile_index * 3 + 2]);
+    if (cell == Octree::CELL_EMPTY) {
+        in_tiles[tile_index].position = -1;
+    } else if (cell == Octree::CELL_FILLED) {
+        const int4 pos = unpack(in_tiles[tile_index].position, tiles);
+        in_tiles[tile_index].position = -1;
+        atomicMax(&image[pos.w], pos.z);
+    } else {
+        in_tiles[tile_index].tape = cell;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -470,7 +461,7 @@ void eval_tiles_i(uint64_t* const __restrict__ tape_data,
  */
 __global__
 void mask_filled_tiles(int32_t* const __restrict__ image,
-                       const uint32_t tiles_per_side,
+                       const int3 tiles,
 
                        TileNode* const __restrict__ in_tiles,
                        const int32_t in_tile_count)
@@ -486,7 +477,7 @@ void mask_filled_tiles(int32_t* const __restrict__ image,
         return;
     }
 
-    const int4 pos = unpack(tile, tiles_per_side);
+    const int4 pos = unpack(tile, tiles);
 
     // If this tile is completely masked by the image, then skip it
     if (image[pos.w] > pos.z) {
@@ -560,12 +551,17 @@ void assign_next_nodes(TileNode* const __restrict__ in_tiles,
  *  Subtiles inherit the `tape` value from their parent tiles, since they're
  *  contained within the parent and can reuse its tape.  They are assigned
  *  `next` = -1, because we don't yet know whether they have children.
+ *
+ *  Parent tiles on the edge of the image may be partially outside of it;
+ *  subtiles which are entirely outside the image (i.e. beyond the edge of
+ *  the `subtiles` grid) are marked as inactive with position = -1.
  */
 __global__
 void subdivide_active_tiles_3d(
         const TileNode* const __restrict__ in_tiles,
         const int32_t in_tile_count,
-        const int32_t tiles_per_side,
+        const int3 tiles,
+        const int3 subtiles,
         TileNode* const __restrict__ out_tiles)
 {
     const int32_t index = threadIdx.x + blockIdx.x * blockDim.x;
@@ -575,20 +571,21 @@ void subdivide_active_tiles_3d(
         return;
     }
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
-    const int32_t subtiles_per_side = tiles_per_side * 4;
+    const int4 pos = unpack(in_tiles[tile_index].position, tiles);
 
     const int4 sub = unpack(subtile_index, 4);
     const int32_t sx = pos.x * 4 + sub.x;
     const int32_t sy = pos.y * 4 + sub.y;
     const int32_t sz = pos.z * 4 + sub.z;
+    const bool outside = sx >= subtiles.x || sy >= subtiles.y ||
+                         sz >= subtiles.z;
     const int32_t next_tile =
         sx +
-        sy * subtiles_per_side +
-        sz * subtiles_per_side * subtiles_per_side;
+        sy * subtiles.x +
+        sz * subtiles.x * subtiles.y;
 
     const int t = in_tiles[tile_index].next * 64 + subtile_index;
-    out_tiles[t].position = next_tile;
+    out_tiles[t].position = outside ? -1 : next_tile;
     out_tiles[t].tape = in_tiles[tile_index].tape;
     out_tiles[t].next = -1;
 }
@@ -597,7 +594,8 @@ __global__
 void subdivide_active_tiles_2d(
         const TileNode* const __restrict__ in_tiles,
         const int32_t in_tile_count,
-        const int32_t tiles_per_side,
+        const int3 tiles,
+        const int3 subtiles,
         TileNode* const __restrict__ out_tiles)
 {
     const int32_t index = threadIdx.x + blockIdx.x * blockDim.x;
@@ -607,17 +605,17 @@ void subdivide_active_tiles_2d(
         return;
     }
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+    const int4 pos = unpack(in_tiles[tile_index].position, tiles);
     assert(pos.z == 0);
-    const int32_t subtiles_per_side = tiles_per_side * 8;
 
     const int4 sub = unpack(subtile_index, 8);
     const int32_t sx = pos.x * 8 + sub.x;
     const int32_t sy = pos.y * 8 + sub.y;
-    const int32_t next_tile = sx + sy * subtiles_per_side;
+    const bool outside = sx >= subtiles.x || sy >= subtiles.y;
+    const int32_t next_tile = sx + sy * subtiles.x;
 
     const int t = in_tiles[tile_index].next * 64 + subtile_index;
-    out_tiles[t].position = next_tile;
+    out_tiles[t].position = outside ? -1 : next_tile;
     out_tiles[t].tape = in_tiles[tile_index].tape;
     out_tiles[t].next = -1;
 }
@@ -656,38 +654,43 @@ void copy_active_tiles(TileNode* const __restrict__ in_tiles,
  *  copy_filled
  *
  *  Copies a lower-resolution (4x undersampled) image into a higher-resolution
- *  image, expanding every active (non-zero) "pixel" by 4x.
+ *  image, expanding every active (non-zero) "pixel" by 4x.  Each image is
+ *  sized to its stage's tile grid (`prev_tiles` and `tiles`), which is
+ *  rounded up independently at each stage.
  *
  *  The higher-resolution image must be empty (all 0) when this is called;
  *  no comparison of Z values is done.
  */
 __global__
 void copy_filled_3d(const int32_t* __restrict__ prev,
+                    const int3 prev_tiles,
                     int32_t* __restrict__ image,
-                    const int32_t image_size_px)
+                    const int3 tiles)
 {
     const int32_t x = threadIdx.x + blockIdx.x * blockDim.x;
     const int32_t y = threadIdx.y + blockIdx.y * blockDim.y;
 
-    if (x < image_size_px && y < image_size_px) {
-        int32_t t = prev[x / 4 + y / 4 * (image_size_px / 4)];
+    if (x < tiles.x && y < tiles.y) {
+        int32_t t = prev[x / 4 + y / 4 * prev_tiles.x];
         if (t) {
-            image[x + y * image_size_px] = t * 4 + 3;
+            // Clamp to the top of the image, in case the tile was partial
+            image[x + y * tiles.x] = min(t * 4 + 3, tiles.z - 1);
         }
     }
 }
 __global__
 void copy_filled_2d(const int32_t* __restrict__ prev,
+                    const int3 prev_tiles,
                     int32_t* __restrict__ image,
-                    const int32_t image_size_px)
+                    const int3 tiles)
 {
     const int32_t x = threadIdx.x + blockIdx.x * blockDim.x;
     const int32_t y = threadIdx.y + blockIdx.y * blockDim.y;
 
-    if (x < image_size_px && y < image_size_px &&
-        prev[x / 8 + y / 8 * (image_size_px / 8)])
+    if (x < tiles.x && y < tiles.y &&
+        prev[x / 8 + y / 8 * prev_tiles.x])
     {
-        image[x + y * image_size_px] = 1;
+        image[x + y * tiles.x] = 1;
     }
 }
 
@@ -707,7 +710,7 @@ void copy_filled_2d(const int32_t* __restrict__ prev,
 __global__
 void calculate_voxels(const TileNode* const __restrict__ in_tiles,
                       const uint32_t in_tile_count,
-                      const uint32_t tiles_per_side,
+                      const TileGrid grid,
                       const Eigen::Matrix4f mat,
                       float2* const __restrict__ values)
 {
@@ -722,18 +725,16 @@ void calculate_voxels(const TileNode* const __restrict__ in_tiles,
     if (tile_index >= in_tile_count) {
         return;
     }
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
     const int4 sub = unpack(threadIdx.x % 32, 4);
 
     const int32_t px = pos.x * 4 + sub.x;
     const int32_t py = pos.y * 4 + sub.y;
     const int32_t pz_a = pos.z * 4 + sub.z;
 
-    const float size_recip = 1.0f / (tiles_per_side * 4);
-
-    const float fx = ((px + 0.5f) * size_recip - 0.5f) * 2.0f;
-    const float fy = ((py + 0.5f) * size_recip - 0.5f) * 2.0f;
-    const float fz_a = ((pz_a + 0.5f) * size_recip - 0.5f) * 2.0f;
+    const float fx = grid.x(px + 0.5f);
+    const float fy = grid.y(py + 0.5f);
+    const float fz_a = grid.z(pz_a + 0.5f);
 
     // Otherwise, calculate the X/Y/Z values
     const float fw_a = mat(3, 0) * fx +
@@ -748,7 +749,7 @@ void calculate_voxels(const TileNode* const __restrict__ in_tiles,
 
     // Do the same calculation for the second pixel
     const int32_t pz_b = pz_a + 2;
-    const float fz_b = ((pz_b + 0.5f) * size_recip - 0.5f) * 2.0f;
+    const float fz_b = grid.z(pz_b + 0.5f);
     const float fw_b = mat(3, 0) * fx +
                        mat(3, 1) * fy +
                        mat(3, 2) * fz_b + mat(3, 3);
@@ -764,7 +765,7 @@ void calculate_voxels(const TileNode* const __restrict__ in_tiles,
 __global__
 void calculate_pixels(const TileNode* const __restrict__ in_tiles,
                       const uint32_t in_tile_count,
-                      const uint32_t tiles_per_side,
+                      const TileGrid grid,
                       const Eigen::Matrix3f mat, const float z,
                       float2* const __restrict__ values)
 {
@@ -779,7 +780,7 @@ void calculate_pixels(const TileNode* const __restrict__ in_tiles,
     if (tile_index >= in_tile_count) {
         return;
     }
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
     const int4 sub = unpack(threadIdx.x % 32, 8);
 
     const int32_t px = pos.x * 8 + sub.x;
@@ -787,10 +788,8 @@ void calculate_pixels(const TileNode* const __restrict__ in_tiles,
     assert(sub.y < 4);
     assert(sub.z == 0);
 
-    const float size_recip = 1.0f / (tiles_per_side * 8);
-
-    const float fx = ((px + 0.5f) * size_recip - 0.5f) * 2.0f;
-    const float fy_a = ((py_a + 0.5f) * size_recip - 0.5f) * 2.0f;
+    const float fx = grid.x(px + 0.5f);
+    const float fy_a = grid.y(py_a + 0.5f);
 
     // Otherwise, calculate the X/Y/Z values
     const float fw_a = mat(2, 0) * fx + mat(2, 1) * fy_a + mat(2, 2);
@@ -801,7 +800,7 @@ void calculate_pixels(const TileNode* const __restrict__ in_tiles,
 
     // Do the same calculation for the second pixel
     const int32_t py_b = py_a + 4;
-    const float fy_b = ((py_b + 0.5f) * size_recip - 0.5f) * 2.0f;
+    const float fy_b = grid.y(py_b + 0.5f);
     const float fw_b = mat(2, 0) * fx + mat(2, 1) * fy_b + mat(2, 2);
 
     for (unsigned i=0; i < 2; ++i) {
@@ -812,6 +811,90 @@ void calculate_pixels(const TileNode* const __restrict__ in_tiles,
     values[voxel_index * 3 + 2] = make_float2(z, z);
 }
 
+/*
+ *  hoist_clauses_f
+ *
+ *  Evaluates clauses from the start of a tape up to the given marker
+ *  (GPU_OP_MARK_X or GPU_OP_MARK_XY), once per thread rather than once per
+ *  voxel, broadcasting each result into both halves of its float2 slot.
+ *
+ *  This is only valid if every axis used before the marker has the same
+ *  value for both of the thread's voxels.  Clauses are grouped by the
+ *  model's own axes, so this only holds for orthographic views which keep
+ *  those axes aligned with the screen (e.g. the default view); any rotated
+ *  view mixes Z into the model's X and Y, and never hoists.  The tape must
+ *  have TAPE_FLAG_MARKERS set.
+ *
+ *  Returns a pointer to the marker, from which evaluation can continue.
+ */
+__device__ __forceinline__
+const uint64_t* hoist_clauses_f(const uint64_t* __restrict__ data,
+                                float2* const __restrict__ slots,
+                                const uint8_t marker)
+{
+    while (1) {
+        const uint64_t d = *++data;
+        const uint8_t op = OP(&d);
+        assert(op);
+        if (op == marker) {
+            return data;
+        }
+        PROFILE_CLAUSE(Profile::FLOAT, d);
+
+        float out;
+        switch (op) {
+            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+            case GPU_OP_MARK_X: continue;
+
+#define lhs slots[I_LHS(&d)].x
+#define rhs slots[I_RHS(&d)].x
+#define imm IMM(&d)
+
+            case GPU_OP_SQUARE_LHS: out = lhs * lhs; break;
+            case GPU_OP_SQRT_LHS: out = sqrtf(lhs); break;
+            case GPU_OP_NEG_LHS: out = -lhs; break;
+            case GPU_OP_SIN_LHS: out = sinf(lhs); break;
+            case GPU_OP_COS_LHS: out = cosf(lhs); break;
+            case GPU_OP_ASIN_LHS: out = asinf(lhs); break;
+            case GPU_OP_ACOS_LHS: out = acosf(lhs); break;
+            case GPU_OP_ATAN_LHS: out = atanf(lhs); break;
+            case GPU_OP_EXP_LHS: out = expf(lhs); break;
+            case GPU_OP_ABS_LHS: out = fabsf(lhs); break;
+            case GPU_OP_LOG_LHS: out = logf(lhs); break;
+
+            // Commutative opcodes
+            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
+            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
+            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
+            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
+            case GPU_OP_MIN_LHS_IMM: out = fminf(lhs, imm); break;
+            case GPU_OP_MIN_LHS_RHS: out = fminf(lhs, rhs); break;
+            case GPU_OP_MAX_LHS_IMM: out = fmaxf(lhs, imm); break;
+            case GPU_OP_MAX_LHS_RHS: out = fmaxf(lhs, rhs); break;
+
+            // Non-commutative opcodes
+            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
+            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
+            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+
+            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
+            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
+            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+
+            case GPU_OP_COPY_IMM: out = imm; break;
+            case GPU_OP_COPY_LHS: out = lhs; break;
+            case GPU_OP_COPY_RHS: out = rhs; break;
+            case GPU_OP_TAG_LHS: out = lhs; break;
+
+            default: assert(false); continue;
+#undef lhs
+#undef rhs
+#undef imm
+        }
+        slots[I_OUT(&d)] = make_float2(out, out);
+    }
+}
+
 /*
  *  eval_voxels_f
  *
@@ -823,13 +906,14 @@ void calculate_pixels(const TileNode* const __restrict__ in_tiles,
  *  writing float2 data (which improves memory access patterns).
  *
  *  Filled voxels are written to `image`, using atomic operations to accumulate
- *  the voxel with the tallest Z value.
+ *  the voxel with the tallest Z value.  Voxels in partial tiles which fall
+ *  outside of the image are evaluated, but never written.
  */
 template <unsigned DIMENSION>
 __global__
 void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
                    int32_t* const __restrict__ image,
-                   const uint32_t tiles_per_side,
+                   const TileGrid grid,
 
                    TileNode* const __restrict__ in_tiles,
                    const int32_t in_tile_count,
@@ -850,15 +934,18 @@ void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
 
     // Check whether this pixel is masked in the output image
     if (DIMENSION == 3) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         const int4 sub = unpack(threadIdx.x % 32, 4);
 
         const int32_t px = pos.x * 4 + sub.x;
         const int32_t py = pos.y * 4 + sub.y;
         const int32_t pz = pos.z * 4 + sub.z;
 
-        // Early return if this pixel won't ever be filled
-        if (image[px + py * tiles_per_side * 4] >= pz + 2) {
+        // Early return if this pixel is outside the image, or won't ever
+        // be filled
+        if (px >= grid.size_px.x || py >= grid.size_px.y ||
+            image[px + py * grid.size_px.x] >= pz + 2)
+        {
             return;
         }
     }
@@ -871,11 +958,30 @@ void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
     slots[((const uint8_t*)tape_data)[2]] = values[voxel_index * 3 + 1];
     slots[((const uint8_t*)tape_data)[3]] = values[voxel_index * 3 + 2];
 
+    // If the tape is sorted by axis dependencies, then clauses which only
+    // depend on X (or X and Y) can be evaluated once for both voxels when
+    // those axes have the same value for both.  This happens in axis-aligned
+    // orthographic views, where the two voxels share a screen-space column
+    // and only differ in Z (3D) or Y (2D).  Results aren't shared between
+    // threads, so at most two of a column's four voxels share the work.
+    if (TAPE_FLAGS(tape_data) & TAPE_FLAG_MARKERS) {
+        const float2 vx = values[voxel_index * 3];
+        const float2 vy = values[voxel_index * 3 + 1];
+        const bool same_x = vx.x == vx.y;
+        const bool same_y = vy.x == vy.y;
+        if (same_x && same_y) {
+            data = hoist_clauses_f(data, slots, GPU_OP_MARK_XY);
+        } else if (same_x) {
+            data = hoist_clauses_f(data, slots, GPU_OP_MARK_X);
+        }
+    }
+
     while (1) {
         const uint64_t d = *++data;
         if (!OP(&d)) {
             break;
         }
+        PROFILE_CLAUSE(Profile::FLOAT, d);
         switch (OP(&d)) {
             case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
 
@@ -918,6 +1024,7 @@ void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
             case GPU_OP_COPY_IMM: out = make_float2(imm, imm); break;
             case GPU_OP_COPY_LHS: out = make_float2(lhs.x, lhs.y); break;
             case GPU_OP_COPY_RHS: out = make_float2(rhs.x, rhs.y); break;
+            case GPU_OP_TAG_LHS: out = make_float2(lhs.x, lhs.y); break;
 
 #undef lhs
 #undef rhs
@@ -929,42 +1036,98 @@ void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
     // Check the result
     const uint8_t i_out = I_OUT(data);
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
     if (DIMENSION == 3) {
         const int4 sub = unpack(threadIdx.x % 32, 4);
-        // The second voxel is always higher in Z, so it masks the lower voxel
-        if (slots[i_out].y < 0.0f) {
-            const int32_t px = pos.x * 4 + sub.x;
-            const int32_t py = pos.y * 4 + sub.y;
-            const int32_t pz = pos.z * 4 + sub.z + 2;
-
-            atomicMax(&image[px + py * tiles_per_side * 4], pz);
-        } else if (slots[i_out].x < 0.0f) {
-            const int32_t px = pos.x * 4 + sub.x;
-            const int32_t py = pos.y * 4 + sub.y;
-            const int32_t pz = pos.z * 4 + sub.z;
+        const int32_t px = pos.x * 4 + sub.x;
+        const int32_t py = pos.y * 4 + sub.y;
+        const int32_t pz = pos.z * 4 + sub.z;
 
-            atomicMax(&image[px + py * tiles_per_side * 4], pz);
+        // The second voxel is always higher in Z, so it masks the lower voxel
+        // (unless it's above the top of the image)
+        if (slots[i_out].y < 0.0f && pz + 2 < grid.size_px.z) {
+            atomicMax(&image[px + py * grid.size_px.x], pz + 2);
+        } else if (slots[i_out].x < 0.0f && pz < grid.size_px.z) {
+            atomicMax(&image[px + py * grid.size_px.x], pz);
         }
     } else if (DIMENSION == 2) {
         const int4 sub = unpack(threadIdx.x % 32, 8);
-        if (slots[i_out].y < 0.0f) {
-            const int32_t px = pos.x * 8 + sub.x;
-            const int32_t py = pos.y * 8 + sub.y + 4;
-
-            image[px + py * tiles_per_side * 8] = 1;
+        const int32_t px = pos.x * 8 + sub.x;
+        const int32_t py = pos.y * 8 + sub.y;
+        if (px >= grid.size_px.x) {
+            return;
         }
-        if (slots[i_out].x < 0.0f) {
-            const int32_t px = pos.x * 8 + sub.x;
-            const int32_t py = pos.y * 8 + sub.y;
-
-            image[px + py * tiles_per_side * 8] = 1;
+        if (slots[i_out].y < 0.0f && py + 4 < grid.size_px.y) {
+            image[px + (py + 4) * grid.size_px.x] = 1;
+        }
+        if (slots[i_out].x < 0.0f && py < grid.size_px.y) {
+            image[px + py * grid.size_px.x] = 1;
         }
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ *  find_voxel_tile
+ *
+ *  Searches through the `tiles`, `subtiles`, `microtiles` structure to find
+ *  the deepest TileNode which contains the given voxel, storing that node's
+ *  size (64, 16, or 4 voxels per side) in `tile_size`.
+ *
+ *  The returned node's tape is valid anywhere within the node; if its
+ *  position is -1, then it was marked as empty, filled, or masked.
+ */
+__device__ inline
+const TileNode* find_voxel_tile(const int32_t px,
+                                const int32_t py,
+                                const int32_t pz,
+                                const int3 size_px,
+
+                                const TileNode* const __restrict__ tiles,
+                                const TileNode* const __restrict__ subtiles,
+                                const TileNode* const __restrict__ microtiles,
+
+                                int32_t& tile_size)
+{
+    const int32_t tile_x = px / 64;
+    const int32_t tile_y = py / 64;
+    const int32_t tile_z = pz / 64;
+    const int32_t tiles_x = (size_px.x + 63) / 64;
+    const int32_t tiles_y = (size_px.y + 63) / 64;
+    const int32_t tile = tile_x +
+                         tile_y * tiles_x +
+                         tile_z * tiles_x * tiles_y;
+
+    if (tiles[tile].next == -1) {
+        tile_size = 64;
+        return &tiles[tile];
+    }
+
+    const int32_t sx = (px % 64) / 16;
+    const int32_t sy = (py % 64) / 16;
+    const int32_t sz = (pz % 64) / 16;
+    const int32_t subtile = tiles[tile].next * 64 +
+                            sx +
+                            sy * 4 +
+                            sz * 16;
+
+    if (subtiles[subtile].next == -1) {
+        tile_size = 16;
+        return &subtiles[subtile];
+    }
+
+    const int32_t ux = (px % 16) / 4;
+    const int32_t uy = (py % 16) / 4;
+    const int32_t uz = (pz % 16) / 4;
+    const int32_t microtile = subtiles[subtile].next * 64 +
+                            ux +
+                            uy * 4 +
+                            uz * 16;
+    tile_size = 4;
+    return &microtiles[microtile];
+}
+
 /*
  *  eval_pixels_d
  *
@@ -972,168 +1135,324 @@ void eval_voxels_f(const uint64_t* const __restrict__ tape_data,
  *  (using automatic differentiation), interpreting the result as its normal
  *  and saving it to the `output` image.
  *
- *  We search through the `tiles`, `subtiles`, `microtiles` structure to
- *  find the shortest tape useful for each pixel, as an optimization.
+ *  We search through the `tiles`, `subtiles`, `microtiles` structure to
+ *  find the shortest tape useful for each pixel, as an optimization.
+ */
+__global__
+void eval_pixels_d(const uint64_t* const __restrict__ tape_data,
+                   const int32_t* const __restrict__ image,
+                   uint32_t* const __restrict__ output,
+                   const TileGrid grid,
+
+                   Eigen::Matrix4f mat,
+
+                   const TileNode* const __restrict__ tiles,
+                   const TileNode* const __restrict__ subtiles,
+                   const TileNode* const __restrict__ microtiles)
+{
+    const int32_t px = threadIdx.x + blockIdx.x * blockDim.x;
+    const int32_t py = threadIdx.y + blockIdx.y * blockDim.y;
+    if (px >= grid.size_px.x || py >= grid.size_px.y) {
+        return;
+    }
+
+    const int32_t pxy = px + py * grid.size_px.x;
+    int32_t pz = image[pxy];
+    if (pz == 0) {
+        return;
+    }
+    // Move slightly in front of the surface, unless we're at the top of the
+    // region (in which case moving would put us in an invalid tile)
+    if (pz < grid.size_px.z - 1) {
+        pz += 1;
+    }
+
+    Deriv slots[128];
+
+    {   // Calculate size and load into initial slots
+        const float fx = grid.x(px + 0.5f);
+        const float fy = grid.y(py + 0.5f);
+        const float fz = grid.z(pz + 0.5f);
+
+        // Otherwise, calculate the X/Y/Z values
+        const float fw_ = mat(3, 0) * fx +
+                          mat(3, 1) * fy +
+                          mat(3, 2) * fz + mat(3, 3);
+        for (unsigned i=0; i < 3; ++i) {
+            slots[((const uint8_t*)tape_data)[i + 1]] = Deriv(
+                (mat(i, 0) * fx +
+                 mat(i, 1) * fy +
+                 mat(i, 2) * fz + mat(i, 3)) / fw_);
+        }
+        slots[((const uint8_t*)tape_data)[1]].v.x = 1.0f;
+        slots[((const uint8_t*)tape_data)[2]].v.y = 1.0f;
+        slots[((const uint8_t*)tape_data)[3]].v.z = 1.0f;
+    }
+
+
+    // Pick out the tape based on the pointer stored in the tiles list
+    int32_t tile_size;
+    const TileNode* tile = find_voxel_tile(px, py, pz, grid.size_px,
+                                           tiles, subtiles, microtiles,
+                                           tile_size);
+    const Deriv result = walk_tape_d(&tape_data[tile->tape], slots);
+    float norm = sqrtf(powf(result.dx(), 2) +
+                       powf(result.dy(), 2) +
+                       powf(result.dz(), 2));
+    uint8_t dx = (result.dx() / norm) * 127 + 128;
+    uint8_t dy = (result.dy() / norm) * 127 + 128;
+    uint8_t dz = (result.dz() / norm) * 127 + 128;
+    output[pxy] = (0xFF << 24) | (dz << 16) | (dy << 8) | dx;
+}
+
+/*
+ *  eval_pixels_id_3d
+ *
+ *  For each active pixel in `image`, evaluates a multi-output tape at the
+ *  pixel's filled voxel and saves the index of the output which produced
+ *  the result in `output`.  Like eval_pixels_d, this uses the shortest tape
+ *  found in the `tiles`, `subtiles`, `microtiles` structure.
  */
 __global__
-void eval_pixels_d(const uint64_t* const __restrict__ tape_data,
-                   const int32_t* const __restrict__ image,
-                   uint32_t* const __restrict__ output,
-                   const uint32_t image_size_px,
+void eval_pixels_id_3d(const uint64_t* const __restrict__ tape_data,
+                       const int32_t* const __restrict__ image,
+                       int32_t* const __restrict__ output,
+                       const TileGrid grid,
 
-                   Eigen::Matrix4f mat,
+                       Eigen::Matrix4f mat,
 
-                   const TileNode* const __restrict__ tiles,
-                   const TileNode* const __restrict__ subtiles,
-                   const TileNode* const __restrict__ microtiles)
+                       const TileNode* const __restrict__ tiles,
+                       const TileNode* const __restrict__ subtiles,
+                       const TileNode* const __restrict__ microtiles)
 {
     const int32_t px = threadIdx.x + blockIdx.x * blockDim.x;
     const int32_t py = threadIdx.y + blockIdx.y * blockDim.y;
-    if (px >= image_size_px || py >= image_size_px) {
+    if (px >= grid.size_px.x || py >= grid.size_px.y) {
         return;
     }
 
-    const int32_t pxy = px + py * image_size_px;
-    int32_t pz = image[pxy];
+    const int32_t pxy = px + py * grid.size_px.x;
+    const int32_t pz = image[pxy];
     if (pz == 0) {
+        output[pxy] = -1;
         return;
     }
-    // Move slightly in front of the surface, unless we're at the top of the
-    // region (in which case moving would put us in an invalid tile)
-    if (pz < image_size_px - 1) {
-        pz += 1;
-    }
 
-    Deriv slots[128];
+    float slots[128];
+    int32_t tags[128];
 
     {   // Calculate size and load into initial slots
-        const float size_recip = 1.0f / image_size_px;
-
-        const float fx = ((px + 0.5f) * size_recip - 0.5f) * 2.0f;
-        const float fy = ((py + 0.5f) * size_recip - 0.5f) * 2.0f;
-        const float fz = ((pz + 0.5f) * size_recip - 0.5f) * 2.0f;
+        const float fx = grid.x(px + 0.5f);
+        const float fy = grid.y(py + 0.5f);
+        const float fz = grid.z(pz + 0.5f);
 
-        // Otherwise, calculate the X/Y/Z values
         const float fw_ = mat(3, 0) * fx +
                           mat(3, 1) * fy +
                           mat(3, 2) * fz + mat(3, 3);
         for (unsigned i=0; i < 3; ++i) {
-            slots[((const uint8_t*)tape_data)[i + 1]] = Deriv(
+            slots[((const uint8_t*)tape_data)[i + 1]] =
                 (mat(i, 0) * fx +
                  mat(i, 1) * fy +
-                 mat(i, 2) * fz + mat(i, 3)) / fw_);
+                 mat(i, 2) * fz + mat(i, 3)) / fw_;
         }
-        slots[((const uint8_t*)tape_data)[1]].v.x = 1.0f;
-        slots[((const uint8_t*)tape_data)[2]].v.y = 1.0f;
-        slots[((const uint8_t*)tape_data)[3]].v.z = 1.0f;
     }
 
+    int32_t tile_size;
+    const TileNode* tile = find_voxel_tile(px, py, pz, grid.size_px,
+                                           tiles, subtiles, microtiles,
+                                           tile_size);
+    output[pxy] = walk_tape_tag(&tape_data[tile->tape], slots, tags);
+}
 
-    const uint64_t* __restrict__ data = tape_data;
+/*
+ *  eval_pixels_id_2d
+ *
+ *  2D equivalent of eval_pixels_id_3d, which looks up each pixel's tape in
+ *  the 64^2 (`tiles`) and 8^2 (`subtiles`) stages.
+ */
+__global__
+void eval_pixels_id_2d(const uint64_t* const __restrict__ tape_data,
+                       const int32_t* const __restrict__ image,
+                       int32_t* const __restrict__ output,
+                       const TileGrid grid,
 
-    {   // Pick out the tape based on the pointer stored in the tiles list
-        const int32_t tile_x = px / 64;
-        const int32_t tile_y = py / 64;
-        const int32_t tile_z = pz / 64;
-        const int32_t tile = tile_x +
-                             tile_y * (image_size_px / 64) +
-                             tile_z * (image_size_px / 64) * (image_size_px / 64);
+                       Eigen::Matrix3f mat, const float z,
 
-        if (tiles[tile].next == -1) {
-            data = &tape_data[tiles[tile].tape];
-        } else {
-            const int32_t sx = (px % 64) / 16;
-            const int32_t sy = (py % 64) / 16;
-            const int32_t sz = (pz % 64) / 16;
-            const int32_t subtile = tiles[tile].next * 64 +
-                                    sx +
-                                    sy * 4 +
-                                    sz * 16;
-
-            if (subtiles[subtile].next == -1) {
-                data = &tape_data[subtiles[subtile].tape];
-            } else {
-                const int32_t ux = (px % 16) / 4;
-                const int32_t uy = (py % 16) / 4;
-                const int32_t uz = (pz % 16) / 4;
-                const int32_t microtile = subtiles[subtile].next * 64 +
-                                        ux +
-                                        uy * 4 +
-                                        uz * 16;
-                data = &tape_data[microtiles[microtile].tape];
-            }
-        }
+                       const TileNode* const __restrict__ tiles,
+                       const TileNode* const __restrict__ subtiles)
+{
+    const int32_t px = threadIdx.x + blockIdx.x * blockDim.x;
+    const int32_t py = threadIdx.y + blockIdx.y * blockDim.y;
+    if (px >= grid.size_px.x || py >= grid.size_px.y) {
+        return;
     }
 
-    while (1) {
-        const uint64_t d = *++data;
-        if (!OP(&d)) {
-            break;
+    const int32_t pxy = px + py * grid.size_px.x;
+    if (image[pxy] == 0) {
+        output[pxy] = -1;
+        return;
+    }
+
+    float slots[128];
+    int32_t tags[128];
+
+    {   // Calculate size and load into initial slots
+        const float fx = grid.x(px + 0.5f);
+        const float fy = grid.y(py + 0.5f);
+
+        const float fw_ = mat(2, 0) * fx + mat(2, 1) * fy + mat(2, 2);
+        for (unsigned i=0; i < 2; ++i) {
+            slots[((const uint8_t*)tape_data)[i + 1]] =
+                (mat(i, 0) * fx + mat(i, 1) * fy + mat(i, 2)) / fw_;
         }
-        switch (OP(&d)) {
-            case GPU_OP_JUMP: data += JUMP_TARGET(&d); continue;
+        slots[((const uint8_t*)tape_data)[3]] = z;
+    }
 
-#define lhs slots[I_LHS(&d)]
-#define rhs slots[I_RHS(&d)]
-#define imm IMM(&d)
-#define out slots[I_OUT(&d)]
+    // Pick the deepest tile containing this pixel (there's no per-pixel
+    // stage in the tile structure, since 8^2 tiles are evaluated in place)
+    const int32_t tile = (px / 64) + (py / 64) * ((grid.size_px.x + 63) / 64);
+    const TileNode* node = &tiles[tile];
+    if (node->next != -1) {
+        node = &subtiles[node->next * 64 +
+                         (px % 64) / 8 +
+                         ((py % 64) / 8) * 8];
+    }
+    output[pxy] = walk_tape_tag(&tape_data[node->tape], slots, tags);
+}
 
-            case GPU_OP_SQUARE_LHS: out = lhs * lhs; break;
-            case GPU_OP_SQRT_LHS: out = sqrt(lhs); break;
-            case GPU_OP_NEG_LHS: out = -lhs; break;
-            case GPU_OP_SIN_LHS: out = sin(lhs); break;
-            case GPU_OP_COS_LHS: out = cos(lhs); break;
-            case GPU_OP_ASIN_LHS: out = asin(lhs); break;
-            case GPU_OP_ACOS_LHS: out = acos(lhs); break;
-            case GPU_OP_ATAN_LHS: out = atan(lhs); break;
-            case GPU_OP_EXP_LHS: out = exp(lhs); break;
-            case GPU_OP_ABS_LHS: out = abs(lhs); break;
-            case GPU_OP_LOG_LHS: out = log(lhs); break;
+// Returns the world-space position of a voxel in the column at (fx, fy)
+__device__ inline float3 voxel_position(const Eigen::Matrix4f& mat,
+                                        const float fx, const float fy,
+                                        const int32_t pz,
+                                        const TileGrid& grid)
+{
+    const float fz = grid.z(pz + 0.5f);
+    const float fw_ = mat(3, 0) * fx +
+                      mat(3, 1) * fy +
+                      mat(3, 2) * fz + mat(3, 3);
+    return make_float3(
+        (mat(0, 0) * fx + mat(0, 1) * fy + mat(0, 2) * fz + mat(0, 3)) / fw_,
+        (mat(1, 0) * fx + mat(1, 1) * fy + mat(1, 2) * fz + mat(1, 3)) / fw_,
+        (mat(2, 0) * fx + mat(2, 1) * fy + mat(2, 2) * fz + mat(2, 3)) / fw_);
+}
 
-            // Commutative opcodes
-            case GPU_OP_ADD_LHS_IMM: out = lhs + imm; break;
-            case GPU_OP_ADD_LHS_RHS: out = lhs + rhs; break;
-            case GPU_OP_MUL_LHS_IMM: out = lhs * imm; break;
-            case GPU_OP_MUL_LHS_RHS: out = lhs * rhs; break;
-            case GPU_OP_MIN_LHS_IMM: out = min(lhs, imm); break;
-            case GPU_OP_MIN_LHS_RHS: out = min(lhs, rhs); break;
-            case GPU_OP_MAX_LHS_IMM: out = max(lhs, imm); break;
-            case GPU_OP_MAX_LHS_RHS: out = max(lhs, rhs); break;
+// Returns the world-space distance between two points
+__device__ inline float world_distance(const float3 a, const float3 b) {
+    return sqrtf(powf(a.x - b.x, 2) + powf(a.y - b.y, 2) + powf(a.z - b.z, 2));
+}
 
-            // Non-commutative opcodes
-            case GPU_OP_SUB_LHS_IMM: out = lhs - imm; break;
-            case GPU_OP_SUB_IMM_RHS: out = imm - rhs; break;
-            case GPU_OP_SUB_LHS_RHS: out = lhs - rhs; break;
+/*
+ *  trace_pixels
+ *
+ *  Alternative to calculate_voxels + eval_voxels_f for the last stage of 3D
+ *  rendering, which sphere-traces down each pixel's column rather than
+ *  evaluating every voxel in every active 4x4x4 tile.
+ *
+ *  Each thread walks from the top of its column down to the highest voxel
+ *  which is already known to be filled (from the tile stages).  Voxels in
+ *  inactive tiles (empty, filled, or masked) are skipped a whole tile at a
+ *  time.  Otherwise, the voxel is evaluated with the deepest tile's pruned
+ *  tape.  The caller declares a Lipschitz constant for the field, so
+ *  value / lipschitz bounds the distance to the surface everywhere, and we
+ *  step by the largest whole number of voxels within that distance.
+ *
+ *  The gradient at a single sample says nothing about the field along the
+ *  step (plateaus, differently-scaled min/max branches), so it isn't used
+ *  as a bound; without a declared constant, render3D_sphere uses the voxel
+ *  scan instead.  Voxels are sampled at the same positions as in
+ *  eval_voxels_f, so the resulting depth matches as long as the declared
+ *  constant is correct.
+ */
+__global__
+void trace_pixels(const uint64_t* const __restrict__ tape_data,
+                  int32_t* const __restrict__ image,
+                  const TileGrid grid,
 
-            case GPU_OP_DIV_LHS_IMM: out = lhs / imm; break;
-            case GPU_OP_DIV_IMM_RHS: out = imm / rhs; break;
-            case GPU_OP_DIV_LHS_RHS: out = lhs / rhs; break;
+                  Eigen::Matrix4f mat,
+                  const float lipschitz,
 
-            case GPU_OP_COPY_IMM: out = Deriv(imm); break;
-            case GPU_OP_COPY_LHS: out = lhs; break;
-            case GPU_OP_COPY_RHS: out = rhs; break;
+                  const TileNode* const __restrict__ tiles,
+                  const TileNode* const __restrict__ subtiles,
+                  const TileNode* const __restrict__ microtiles)
+{
+    const int32_t px = threadIdx.x + blockIdx.x * blockDim.x;
+    const int32_t py = threadIdx.y + blockIdx.y * blockDim.y;
+    if (px >= grid.size_px.x || py >= grid.size_px.y) {
+        return;
+    }
 
-#undef lhs
-#undef rhs
-#undef imm
-#undef out
+    const int32_t pxy = px + py * grid.size_px.x;
+    const int32_t floor_z = image[pxy];
+
+    const float fx = grid.x(px + 0.5f);
+    const float fy = grid.y(py + 0.5f);
+
+    float slots[128];
+    int32_t pz = grid.size_px.z - 1;
+    while (pz > floor_z) {
+        int32_t tile_size;
+        const TileNode* tile = find_voxel_tile(px, py, pz, grid.size_px,
+                                               tiles, subtiles, microtiles,
+                                               tile_size);
+        // Skip to the bottom of inactive tiles
+        if (tile->position == -1) {
+            pz = (pz / tile_size) * tile_size - 1;
+            continue;
         }
-    }
 
-    const uint8_t i_out = I_OUT(data);
-    const Deriv result = slots[i_out];
-    float norm = sqrtf(powf(result.dx(), 2) +
-                       powf(result.dy(), 2) +
-                       powf(result.dz(), 2));
-    uint8_t dx = (result.dx() / norm) * 127 + 128;
-    uint8_t dy = (result.dy() / norm) * 127 + 128;
-    uint8_t dz = (result.dz() / norm) * 127 + 128;
-    output[pxy] = (0xFF << 24) | (dz << 16) | (dy << 8) | dx;
+        const float3 p = voxel_position(mat, fx, fy, pz, grid);
+        slots[((const uint8_t*)tape_data)[1]] = p.x;
+        slots[((const uint8_t*)tape_data)[2]] = p.y;
+        slots[((const uint8_t*)tape_data)[3]] = p.z;
+        const float value = walk_tape_f(&tape_data[tile->tape], slots);
+
+        if (value < 0.0f) {
+            image[pxy] = pz;
+            return;
+        }
+
+        // Decide how far we can safely step.  The step is checked against
+        // the actual world-space distance (rather than assuming a constant
+        // voxel size), since perspective changes the spacing along the ray,
+        // and is halved until it fits.
+        const float dist = value / lipschitz;
+        const float voxel = world_distance(
+                p, voxel_position(mat, fx, fy, pz - 1, grid));
+        const float n = dist / voxel;
+        int32_t step = 1;
+        if (n >= 2.0f) {
+            step = (n < grid.size_px.z) ? (int32_t)n : grid.size_px.z;
+            while (step > 1 &&
+                   world_distance(p, voxel_position(mat, fx, fy, pz - step,
+                                                    grid)) > dist)
+            {
+                step /= 2;
+            }
+        }
+        pz -= step;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the number of milliseconds since the given time
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
 void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float z) {
+    render2D(tape, mat, RenderBudget(), z);
+}
+
+void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat,
+                       const RenderBudget& budget, const float z)
+{
+    MPR_TRACE("render2D");
+    const auto start = std::chrono::steady_clock::now();
+
     // Reset the tape index and copy the tape to the beginning of the
     // context's tape buffer area.
     *tape_index = tape.length;
@@ -1143,12 +1462,22 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
 
     // Reset all of the data arrays.  In 2D, we only use stages 0, 2, and 3
     // for 64^2, 8^2, and per-voxel evaluation steps.
+    const TileGrid root = tile_grid(*this, 64, 1);
+    const TileGrid sub = root.subdivided(8);
     CUDA_CHECK(cudaMemsetAsync(stages[0].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px / 64, 2)));
+                               root.tiles.x * root.tiles.y));
     CUDA_CHECK(cudaMemsetAsync(stages[2].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px / 8, 2)));
+                               sub.tiles.x * sub.tiles.y));
     CUDA_CHECK(cudaMemsetAsync(stages[3].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px, 2)));
+                               image_width_px * image_height_px));
+    CUDA_CHECK(cudaMemsetAsync(lod.get(), LOD_FULL, sizeof(uint8_t) *
+                               root.tiles.x * root.tiles.y));
+    num_outputs = tape.num_outputs;
+    if (num_outputs > 1) {
+        MPR_TRACE_GPU("ids");
+        CUDA_CHECK(cudaMemsetAsync(ids.get(), 0xFF, sizeof(int32_t) *
+                                   image_width_px * image_height_px));
+    }
 
     ////////////////////////////////////////////////////////////////////////////
     // Evaluation of 64x64 tiles
@@ -1156,17 +1485,22 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
 
     // Go the whole list of first-stage tiles, assigning each to
     // be [position, tape = 0, next = -1]
-    unsigned count = pow(image_size_px / 64, 2);
+    unsigned count = root.tiles.x * root.tiles.y;
     unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
     preload_tiles<<<num_blocks, NUM_THREADS>>>(stages[0].tiles.get(), count);
 
     // Iterate over 64^2, 8^2 tiles
+    int64_t evaluated = 0;
+    bool out_of_budget = false;
     for (unsigned i=0; i < 3; i += 2) {
-        const unsigned tile_size_px = i ? 8 : 64;
+        MPR_TRACE_GPU(i ? "tiles (8^2)" : "tiles (64^2)");
+        const TileGrid grid = i ? sub : root;
+        const TileGrid next_grid = grid.subdivided(8);
         const unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+        evaluated += count;
 
         if (values_size < num_blocks * NUM_THREADS * 3) {
-            values.reset(CUDA_MALLOC(Interval, num_blocks * NUM_THREADS * 3));
+            values.reset(CUDA_MALLOC_DEVICE(Interval, num_blocks * NUM_THREADS * 3));
             values_size = num_blocks * NUM_THREADS * 3;
         }
 
@@ -1177,7 +1511,7 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
         calculate_intervals_2d<<<num_blocks, NUM_THREADS>>>(
             stages[i].tiles.get(),
             count,
-            image_size_px / tile_size_px,
+            grid,
             mat, z,
             reinterpret_cast<Interval*>(values.get()));
 
@@ -1186,7 +1520,7 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
             tape_data.get(),
             tape_index.get(),
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
 
             stages[i].tiles.get(),
             count,
@@ -1212,13 +1546,43 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
             active_tile_count *= 64;
         }
 
+        // If the next stage would go over budget, then resolve the remaining
+        // tiles at this stage and copy them down to the final image.
+        if (active_tile_count &&
+            budget.exceeded(elapsed_ms(start), evaluated + active_tile_count))
+        {
+            eval_tiles_center<2><<<num_blocks, NUM_THREADS>>>(
+                tape_data.get(),
+                stages[i].filled.get(),
+                grid,
+                i, lod.get(),
+
+                stages[i].tiles.get(),
+                count,
+
+                reinterpret_cast<Interval*>(values.get()));
+            for (unsigned j=i; j < 3; j = j ? 3 : 2) {
+                const TileGrid g = j ? sub : root;
+                const TileGrid next_g = g.subdivided(8);
+                const dim3 blocks((next_g.tiles.x + 31) / 32,
+                                  (next_g.tiles.y + 31) / 32);
+                copy_filled_2d<<<blocks, dim3(32, 32)>>>(
+                        stages[j].filled.get(),
+                        g.tiles,
+                        stages[j ? 3 : 2].filled.get(),
+                        next_g.tiles);
+            }
+            out_of_budget = true;
+            break;
+        }
+
         // Make sure that the subtiles buffer has enough room
         // This wastes a small amount of data for the per-pixel evaluation,
         // where the `next` indexes aren't used, but it's relatively small.
         const int next = i ? 3 : 2;
         if (active_tile_count > stages[next].tile_array_size) {
             stages[next].tile_array_size = active_tile_count;
-            stages[next].tiles.reset(CUDA_MALLOC(TileNode, active_tile_count));
+            stages[next].tiles.reset(CUDA_MALLOC_DEVICE(TileNode, active_tile_count));
         }
 
         if (i < 2) {
@@ -1226,7 +1590,8 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
             subdivide_active_tiles_2d<<<num_blocks*64, NUM_THREADS>>>(
                 stages[i].tiles.get(),
                 count,
-                image_size_px / tile_size_px,
+                grid.tiles,
+                next_grid.tiles,
                 stages[next].tiles.get());
         } else {
             // Special case for per-pixel evaluation, which
@@ -1242,80 +1607,157 @@ void Context::render2D(const Tape& tape, const Eigen::Matrix3f& mat, const float
             // by 64x).  This is cleaner that accumulating all of the levels
             // in a single pass, and could (possibly?) help with skipping
             // fully occluded tiles.
-            const unsigned next_tile_size = tile_size_px / 8;
-            const uint32_t u = ((image_size_px / next_tile_size) / 32);
-            copy_filled_2d<<<dim3(u + 1, u + 1), dim3(32, 32)>>>(
+            const dim3 blocks((next_grid.tiles.x + 31) / 32,
+                              (next_grid.tiles.y + 31) / 32);
+            copy_filled_2d<<<blocks, dim3(32, 32)>>>(
                     stages[i].filled.get(),
+                    grid.tiles,
                     stages[next].filled.get(),
-                    image_size_px / next_tile_size);
+                    next_grid.tiles);
         }
 
-        // Assign the next number of tiles to evaluate
+        // Assign the next number of tiles to evaluate.  If every tile was
+        // resolved at this stage, then carry the filled image down to the
+        // final stage and skip the pixel stage (but still label outputs).
         count = active_tile_count;
-		if (count == 0)
-			return; // early out
+        if (count == 0) {
+            if (i == 0) {
+                const TileGrid next_g = sub.subdivided(8);
+                const dim3 blocks((next_g.tiles.x + 31) / 32,
+                                  (next_g.tiles.y + 31) / 32);
+                copy_filled_2d<<<blocks, dim3(32, 32)>>>(
+                        stages[2].filled.get(),
+                        sub.tiles,
+                        stages[3].filled.get(),
+                        next_g.tiles);
+            }
+            break;
+        }
     }
 
-    // Time to render individual pixels!
-    num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
-    const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
-    if (values_size < num_values) {
-        values.reset(CUDA_MALLOC(float2, num_values));
-        values_size = num_values;
-    }
-    calculate_pixels<<<num_blocks, NUM_TILES * 32>>>(
-        stages[3].tiles.get(),
-        count,
-        image_size_px / 8,
-        mat, z,
-        reinterpret_cast<float2*>(values.get()));
-    eval_voxels_f<2><<<num_blocks, NUM_TILES * 32>>>(
-        tape_data.get(),
-        stages[3].filled.get(),
-        image_size_px / 8,
+    if (!out_of_budget && count) {
+        MPR_TRACE_GPU("pixels");
+        // Time to render individual pixels!  (If we ran out of budget, then
+        // every tile has already been resolved.)
+        num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
+        const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
+        if (values_size < num_values) {
+            values.reset(CUDA_MALLOC_DEVICE(float2, num_values));
+            values_size = num_values;
+        }
+        calculate_pixels<<<num_blocks, NUM_TILES * 32>>>(
+            stages[3].tiles.get(),
+            count,
+            sub,
+            mat, z,
+            reinterpret_cast<float2*>(values.get()));
+        eval_voxels_f<2><<<num_blocks, NUM_TILES * 32>>>(
+            tape_data.get(),
+            stages[3].filled.get(),
+            sub,
 
-        stages[3].tiles.get(),
-        count,
+            stages[3].tiles.get(),
+            count,
 
-        reinterpret_cast<float2*>(values.get()));
-    CUDA_CHECK(cudaDeviceSynchronize());
+            reinterpret_cast<float2*>(values.get()));
+    }
+
+    // Label every filled pixel with the output that produced it
+    if (num_outputs > 1) {
+        const dim3 blocks((image_width_px + 15) / 16,
+                          (image_height_px + 15) / 16);
+        eval_pixels_id_2d<<<blocks, dim3(16, 16)>>>(
+                tape_data.get(),
+                stages[3].filled.get(),
+                ids.get(),
+                sub.subdivided(8),
+                mat, z,
+                stages[0].tiles.get(),
+                stages[2].tiles.get());
+    }
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 }
 
 void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
+    render3D(tape, mat, RenderBudget());
+}
+
+void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat,
+                       const RenderBudget& budget)
+{
+    MPR_TRACE("render3D");
+
     // Reset the tape index and copy the tape to the beginning of the
     // context's tape buffer area.
     *tape_index = tape.length;
+    num_outputs = tape.num_outputs;
     cudaMemcpyAsync(tape_data.get(), tape.data.get(),
                     sizeof(uint64_t) * tape.length,
                     cudaMemcpyDeviceToDevice);
 
+    run3D(mat, nullptr, budget);
+}
+
+void Context::render3D(const Octree& octree, const Eigen::Matrix4f& mat) {
+    MPR_TRACE("render3D (octree)");
+
+    // Copy every tape in the octree (including the root tape at index 0)
+    // into the context's tape buffer, then start pushing after them.
+    *tape_index = octree.tape_length;
+    num_outputs = 1;
+    cudaMemcpyAsync(tape_data.get(), octree.tape_data.get(),
+                    sizeof(uint64_t) * octree.tape_length,
+                    cudaMemcpyDeviceToDevice);
+
+    run3D(mat, &octree, RenderBudget());
+}
+
+int32_t Context::renderTiles3D(const Eigen::Matrix4f& mat,
+                                const Octree* octree,
+                                const RenderBudget& budget)
+{
+    const auto start = std::chrono::steady_clock::now();
+
     ////////////////////////////////////////////////////////////////////////////
     // Evaluation of 64x64x64 tiles
     ////////////////////////////////////////////////////////////////////////////
 
     // Reset all of the data arrays
+    const TileGrid root = tile_grid(*this, 64, image_depth_px);
     for (unsigned i=0; i < 4; ++i) {
-        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        const TileGrid grid = root.subdivided(1 << (i * 2));
         CUDA_CHECK(cudaMemsetAsync(stages[i].filled.get(), 0, sizeof(int32_t) *
-                                   pow(image_size_px / tile_size_px, 2)));
+                                   grid.tiles.x * grid.tiles.y));
     }
     CUDA_CHECK(cudaMemsetAsync(normals.get(), 0, sizeof(uint32_t) *
-                               pow(image_size_px, 2)));
+                               image_width_px * image_height_px));
+    CUDA_CHECK(cudaMemsetAsync(lod.get(), LOD_FULL, sizeof(uint8_t) *
+                               root.tiles.x * root.tiles.y));
+    if (num_outputs > 1) {
+        CUDA_CHECK(cudaMemsetAsync(ids.get(), 0xFF, sizeof(int32_t) *
+                                   image_width_px * image_height_px));
+    }
 
     // Go the whole list of first-stage tiles, assigning each to
     // be [position, tape = 0, next = -1]
-    unsigned count = pow(image_size_px / 64, 3);
+    unsigned count = root.tiles.x * root.tiles.y * root.tiles.z;
     unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
     preload_tiles<<<num_blocks, NUM_THREADS>>>(stages[0].tiles.get(), count);
 
     // Iterate over 64^3, 16^3, 4^3 tiles
+    int64_t evaluated = 0;
     for (unsigned i=0; i < 3; ++i) {
+        static const char* STAGE_NAMES[3] = {
+            "tiles (64^3)", "tiles (16^3)", "tiles (4^3)"};
+        MPR_TRACE_GPU(STAGE_NAMES[i]);
         //printf("BEGINNING STAGE %u\n", i);
-        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        const TileGrid grid = root.subdivided(1 << (i * 2));
+        const TileGrid next_grid = grid.subdivided(4);
         const unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+        evaluated += count;
 
         if (values_size < num_blocks * NUM_THREADS * 3) {
-            values.reset(CUDA_MALLOC(Interval, num_blocks * NUM_THREADS * 3));
+            values.reset(CUDA_MALLOC_DEVICE(Interval, num_blocks * NUM_THREADS * 3));
             values_size = num_blocks * NUM_THREADS * 3;
         }
 
@@ -1326,17 +1768,38 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
         calculate_intervals_3d<<<num_blocks, NUM_THREADS>>>(
             stages[i].tiles.get(),
             count,
-            image_size_px / tile_size_px,
+            grid,
             mat,
             reinterpret_cast<Interval*>(values.get()));
 
+        // If we're rendering from an octree, then pick the initial tape for
+        // each tile based on its world-space bounds.
+        if (octree) {
+            assign_octree_tapes<<<num_blocks, NUM_THREADS>>>(
+                octree->cells.get(),
+                octree->depth,
+                make_float3(octree->lower.x(), octree->lower.y(),
+                            octree->lower.z()),
+                make_float3(octree->upper.x(), octree->upper.y(),
+                            octree->upper.z()),
+                octree->tape_length,
+
+                stages[i].filled.get(),
+                grid.tiles,
+
+                stages[i].tiles.get(),
+                count,
+
+                reinterpret_cast<Interval*>(values.get()));
+        }
+
         // Mark every tile which is covered in the image as masked,
         // which means it will be skipped later on.  We do this again below,
         // but it's basically free, so we should do it here and simplify
         // the logic in eval_tiles_i.
         mask_filled_tiles<<<num_blocks, NUM_THREADS>>>(
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
             stages[i].tiles.get(),
             count);
 
@@ -1345,7 +1808,7 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
             tape_data.get(),
             tape_index.get(),
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
 
             stages[i].tiles.get(),
             count,
@@ -1360,7 +1823,7 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
         // the next phase.
         mask_filled_tiles<<<num_blocks, NUM_THREADS>>>(
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
             stages[i].tiles.get(),
             count);
 
@@ -1380,12 +1843,41 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
             active_tile_count *= 64;
         }
 
+        // If the next stage would go over budget, then resolve the remaining
+        // tiles at this stage and copy them down to the final image.
+        if (active_tile_count &&
+            budget.exceeded(elapsed_ms(start), evaluated + active_tile_count))
+        {
+            eval_tiles_center<3><<<num_blocks, NUM_THREADS>>>(
+                tape_data.get(),
+                stages[i].filled.get(),
+                grid,
+                i, lod.get(),
+
+                stages[i].tiles.get(),
+                count,
+
+                reinterpret_cast<Interval*>(values.get()));
+            for (unsigned j=i; j < 3; ++j) {
+                const TileGrid g = root.subdivided(1 << (j * 2));
+                const TileGrid next_g = g.subdivided(4);
+                const dim3 blocks((next_g.tiles.x + 31) / 32,
+                                  (next_g.tiles.y + 31) / 32);
+                copy_filled_3d<<<blocks, dim3(32, 32)>>>(
+                        stages[j].filled.get(),
+                        g.tiles,
+                        stages[j + 1].filled.get(),
+                        next_g.tiles);
+            }
+            return -1;
+        }
+
         // Make sure that the subtiles buffer has enough room
         // This wastes a small amount of data for the per-pixel evaluation,
         // where the `next` indexes aren't used, but it's relatively small.
         if (active_tile_count > stages[i + 1].tile_array_size) {
             stages[i + 1].tile_array_size = active_tile_count;
-            stages[i + 1].tiles.reset(CUDA_MALLOC(TileNode, active_tile_count));
+            stages[i + 1].tiles.reset(CUDA_MALLOC_DEVICE(TileNode, active_tile_count));
         }
 
         if (i < 2) {
@@ -1393,7 +1885,8 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
             subdivide_active_tiles_3d<<<num_blocks*64, NUM_THREADS>>>(
                 stages[i].tiles.get(),
                 count,
-                image_size_px / tile_size_px,
+                grid.tiles,
+                next_grid.tiles,
                 stages[i + 1].tiles.get());
         } else {
             // Special case for per-pixel evaluation, which
@@ -1409,56 +1902,142 @@ void Context::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
             // by 64x).  This is cleaner that accumulating all of the levels
             // in a single pass, and could (possibly?) help with skipping
             // fully occluded tiles.
-            const unsigned next_tile_size = tile_size_px / 4;
-            const uint32_t u = ((image_size_px / next_tile_size) / 32);
-            copy_filled_3d<<<dim3(u + 1, u + 1), dim3(32, 32)>>>(
+            const dim3 blocks((next_grid.tiles.x + 31) / 32,
+                              (next_grid.tiles.y + 31) / 32);
+            copy_filled_3d<<<blocks, dim3(32, 32)>>>(
                     stages[i].filled.get(),
+                    grid.tiles,
                     stages[i + 1].filled.get(),
-                    image_size_px / next_tile_size);
+                    next_grid.tiles);
         }
 
-        // Assign the next number of tiles to evaluate
+        // Assign the next number of tiles to evaluate.  If every tile was
+        // resolved at this stage, then carry the filled image down to the
+        // final stage, since normals and output IDs are read from there.
         count = active_tile_count;
-		if (count == 0)
-			return; // early out
+        if (count == 0) {
+            for (unsigned j=i + 1; j < 3; ++j) {
+                const TileGrid g = root.subdivided(1 << (j * 2));
+                const TileGrid next_g = g.subdivided(4);
+                const dim3 blocks((next_g.tiles.x + 31) / 32,
+                                  (next_g.tiles.y + 31) / 32);
+                copy_filled_3d<<<blocks, dim3(32, 32)>>>(
+                        stages[j].filled.get(),
+                        g.tiles,
+                        stages[j + 1].filled.get(),
+                        next_g.tiles);
+            }
+            return 0;
+        }
     }
 
+    return count;
+}
+
+void Context::renderNormals3D(const Eigen::Matrix4f& mat) {
+    MPR_TRACE_GPU("normals");
+
+    // Render normals (and output IDs, for multi-output tapes) into every
+    // filled pixel
+    const TileGrid grid = tile_grid(*this, 1, image_depth_px);
+    const dim3 blocks((image_width_px + 15) / 16, (image_height_px + 15) / 16);
+    eval_pixels_d<<<blocks, dim3(16, 16)>>>(
+            tape_data.get(),
+            stages[3].filled.get(),
+            normals.get(),
+            grid,
+            mat,
+            stages[0].tiles.get(),
+            stages[1].tiles.get(),
+            stages[2].tiles.get());
+    if (num_outputs > 1) {
+        eval_pixels_id_3d<<<blocks, dim3(16, 16)>>>(
+                tape_data.get(),
+                stages[3].filled.get(),
+                ids.get(),
+                grid,
+                mat,
+                stages[0].tiles.get(),
+                stages[1].tiles.get(),
+                stages[2].tiles.get());
+    }
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+}
+
+void Context::render3D_sphere(const Tape& tape, const Eigen::Matrix4f& mat,
+                              const float lipschitz) {
+    MPR_TRACE("render3D_sphere");
+
+    // Reset the tape index and copy the tape to the beginning of the
+    // context's tape buffer area.
+    *tape_index = tape.length;
+    num_outputs = tape.num_outputs;
+    cudaMemcpyAsync(tape_data.get(), tape.data.get(),
+                    sizeof(uint64_t) * tape.length,
+                    cudaMemcpyDeviceToDevice);
+
+    const int32_t count = renderTiles3D(mat, nullptr, RenderBudget());
+    if (count > 0 && lipschitz <= 0.0f) {
+        // Without a distance bound, there's nothing to gain over the
+        // regular voxel scan
+        renderVoxels3D(mat, count);
+    } else if (count > 0) {
+        MPR_TRACE_GPU("trace_pixels");
+        // Sphere-trace down each pixel's column, instead of evaluating every
+        // voxel in the remaining active tiles.
+        const dim3 blocks((image_width_px + 15) / 16, (image_height_px + 15) / 16);
+        trace_pixels<<<blocks, dim3(16, 16)>>>(
+                tape_data.get(),
+                stages[3].filled.get(),
+                tile_grid(*this, 1, image_depth_px),
+                mat, lipschitz,
+                stages[0].tiles.get(),
+                stages[1].tiles.get(),
+                stages[2].tiles.get());
+    }
+
+    renderNormals3D(mat);
+}
+
+void Context::run3D(const Eigen::Matrix4f& mat, const Octree* octree,
+                    const RenderBudget& budget)
+{
+    const int32_t count = renderTiles3D(mat, octree, budget);
+
+    // If every tile was resolved before the voxel stage (or we ran out of
+    // budget), then skip it, but we still need normals and output IDs.
+    if (count > 0) {
+        renderVoxels3D(mat, count);
+    }
+    renderNormals3D(mat);
+}
+
+void Context::renderVoxels3D(const Eigen::Matrix4f& mat, int32_t count) {
+    MPR_TRACE_GPU("voxels");
+
     // Time to render individual pixels!
-    num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
+    const unsigned num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
     const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
     if (values_size < num_values) {
-        values.reset(CUDA_MALLOC(float2, num_values));
+        values.reset(CUDA_MALLOC_DEVICE(float2, num_values));
         values_size = num_values;
     }
+    const TileGrid grid = tile_grid(*this, 4, image_depth_px);
     calculate_voxels<<<num_blocks, NUM_TILES * 32>>>(
         stages[3].tiles.get(),
         count,
-        image_size_px / 4,
+        grid,
         mat,
         reinterpret_cast<float2*>(values.get()));
     eval_voxels_f<3><<<num_blocks, NUM_TILES * 32>>>(
         tape_data.get(),
         stages[3].filled.get(),
-        image_size_px / 4,
+        grid,
 
         stages[3].tiles.get(),
         count,
 
         reinterpret_cast<float2*>(values.get()));
-
-    {   // Then render normals into those pixels
-        const uint32_t u = ((image_size_px + 15) / 16);
-        eval_pixels_d<<<dim3(u, u), dim3(16, 16)>>>(
-                tape_data.get(),
-                stages[3].filled.get(),
-                normals.get(),
-                image_size_px,
-                mat,
-                stages[0].tiles.get(),
-                stages[1].tiles.get(),
-                stages[2].tiles.get());
-    }
-    CUDA_CHECK(cudaDeviceSynchronize());
 }
 
 
@@ -1475,13 +2054,14 @@ void Context::render2D_brute(const Tape& tape,
 
     // Reset the final image array, since we'll be rendering directly to it
     CUDA_CHECK(cudaMemsetAsync(stages[3].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px, 2)));
+                               image_width_px * image_height_px));
 
     // We'll only be evaluating 8x8 tiles, so preload all of them
-    unsigned count = pow(image_size_px / 8, 2);
+    const TileGrid grid = tile_grid(*this, 8, 1);
+    unsigned count = grid.tiles.x * grid.tiles.y;
     if (count > stages[3].tile_array_size) {
         stages[3].tile_array_size = count;
-        stages[3].tiles.reset(CUDA_MALLOC(TileNode, count));
+        stages[3].tiles.reset(CUDA_MALLOC_DEVICE(TileNode, count));
     }
     unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
     preload_tiles<<<num_blocks, NUM_THREADS>>>(stages[3].tiles.get(), count);
@@ -1490,25 +2070,25 @@ void Context::render2D_brute(const Tape& tape,
     num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
     const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
     if (values_size < num_values) {
-        values.reset(CUDA_MALLOC(float2, num_values));
+        values.reset(CUDA_MALLOC_DEVICE(float2, num_values));
         values_size = num_values;
     }
     calculate_pixels<<<num_blocks, NUM_TILES * 32>>>(
         stages[3].tiles.get(),
         count,
-        image_size_px / 8,
+        grid,
         mat, z,
         reinterpret_cast<float2*>(values.get()));
     eval_voxels_f<2><<<num_blocks, NUM_TILES * 32>>>(
         tape_data.get(),
         stages[3].filled.get(),
-        image_size_px / 8,
+        grid,
 
         stages[3].tiles.get(),
         count,
 
         reinterpret_cast<float2*>(values.get()));
-    CUDA_CHECK(cudaDeviceSynchronize());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1519,20 +2099,20 @@ __global__
 void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
                           int32_t* const __restrict__ tape_index,
                           int32_t* const __restrict__ image,
-                          const uint32_t tiles_per_side,
+                          const TileGrid grid,
 
                           TileNode* const __restrict__ in_tiles,
                           const int32_t in_tile_count,
 
                           const Interval* __restrict__ values,
 
-                          const int tile_size_px,
                           float* __restrict__ const heatmap)
 {
     const int32_t tile_index = threadIdx.x + blockIdx.x * blockDim.x;
     if (tile_index >= in_tile_count) {
         return;
     }
+    const int tile_size_px = grid.tile_size_px;
 
     // Check to see if we're masked
     if (in_tiles[tile_index].position == -1) {
@@ -1611,6 +2191,10 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
             case GPU_OP_COPY_IMM: out = Interval(imm); break;
             case GPU_OP_COPY_LHS: out = lhs; break;
             case GPU_OP_COPY_RHS: out = rhs; break;
+            case GPU_OP_TAG_LHS: out = lhs; break;
+
+            case GPU_OP_MARK_X:
+            case GPU_OP_MARK_XY: continue;
 
             default: assert(false);
         }
@@ -1624,13 +2208,15 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
     const uint8_t i_out = I_OUT(data);
 
     {   // Write the work to the heatmap
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         for (int x=0; x < tile_size_px; ++x) {
             for (int y=0; y < tile_size_px; ++y) {
                 int px = x + pos.x * tile_size_px;
                 int py = y + pos.y * tile_size_px;
-                atomicAdd(&heatmap[px + py * tile_size_px * tiles_per_side],
-                          work / powf(tile_size_px, 2.0f));
+                if (px < grid.size_px.x && py < grid.size_px.y) {
+                    atomicAdd(&heatmap[px + py * grid.size_px.x],
+                              work / powf(tile_size_px, 2.0f));
+                }
             }
         }
         work = 0;
@@ -1644,7 +2230,7 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
 
     // Masked
     if (DIMENSION == 3) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         if (image[pos.w] > pos.z) {
             in_tiles[tile_index].position = -1;
             return;
@@ -1653,7 +2239,7 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
 
     // Filled
     if (slots[i_out].upper() < 0.0f) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         in_tiles[tile_index].position = -1;
         if (DIMENSION == 3) {
             atomicMax(&image[pos.w], pos.z);
@@ -1714,8 +2300,9 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
                                 op <= GPU_OP_MAX_LHS_RHS;
         choice_index -= has_choice;
 
+        // Markers are always kept, since leaf evaluation relies on them
         const uint8_t i_out = I_OUT(&d);
-        if (!active[i_out]) {
+        if (!active[i_out] && op != GPU_OP_MARK_X && op != GPU_OP_MARK_XY) {
             continue;
         }
 
@@ -1735,13 +2322,15 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
 
             // Early exit if we can't finish writing out this tape
             if (*tape_index >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
-                const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+                const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
                 for (int x=0; x < tile_size_px; ++x) {
                     for (int y=0; y < tile_size_px; ++y) {
                         int px = x + pos.x * tile_size_px;
                         int py = y + pos.y * tile_size_px;
-                        atomicAdd(&heatmap[px + py * tile_size_px * tiles_per_side],
-                                  work / powf(tile_size_px, 2.0f));
+                        if (px < grid.size_px.x && py < grid.size_px.y) {
+                            atomicAdd(&heatmap[px + py * grid.size_px.x],
+                                      work / powf(tile_size_px, 2.0f));
+                        }
                     }
                 }
                 return;
@@ -1751,13 +2340,15 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
 
             // Later exit if we claimed a chunk that exceeds the tape array
             if (out_index + out_offset >= NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
-                const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+                const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
                 for (int x=0; x < tile_size_px; ++x) {
                     for (int y=0; y < tile_size_px; ++y) {
                         int px = x + pos.x * tile_size_px;
                         int py = y + pos.y * tile_size_px;
-                        atomicAdd(&heatmap[px + py * tile_size_px * tiles_per_side],
-                                  work / powf(tile_size_px, 2.0f));
+                        if (px < grid.size_px.x && py < grid.size_px.y) {
+                            atomicAdd(&heatmap[px + py * grid.size_px.x],
+                                      work / powf(tile_size_px, 2.0f));
+                        }
                     }
                 }
                 return;
@@ -1817,13 +2408,15 @@ void eval_tiles_i_heatmap(uint64_t* const __restrict__ tape_data,
     }
 
     {   // Accumulate the work of walking backwards through the tape
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         for (int x=0; x < tile_size_px; ++x) {
             for (int y=0; y < tile_size_px; ++y) {
                 int px = x + pos.x * tile_size_px;
                 int py = y + pos.y * tile_size_px;
-                atomicAdd(&heatmap[px + py * tile_size_px * tiles_per_side],
-                          work / powf(tile_size_px, 2.0f));
+                if (px < grid.size_px.x && py < grid.size_px.y) {
+                    atomicAdd(&heatmap[px + py * grid.size_px.x],
+                              work / powf(tile_size_px, 2.0f));
+                }
             }
         }
     }
@@ -1840,7 +2433,7 @@ template <unsigned DIMENSION>
 __global__
 void eval_voxels_f_heatmap(const uint64_t* const __restrict__ tape_data,
                            int32_t* const __restrict__ image,
-                           const uint32_t tiles_per_side,
+                           const TileGrid grid,
 
                            TileNode* const __restrict__ in_tiles,
                            const int32_t in_tile_count,
@@ -1863,15 +2456,18 @@ void eval_voxels_f_heatmap(const uint64_t* const __restrict__ tape_data,
 
     // Check whether this pixel is masked in the output image
     if (DIMENSION == 3) {
-        const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+        const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
         const int4 sub = unpack(threadIdx.x % 32, 4);
 
         const int32_t px = pos.x * 4 + sub.x;
         const int32_t py = pos.y * 4 + sub.y;
         const int32_t pz = pos.z * 4 + sub.z;
 
-        // Early return if this pixel won't ever be filled
-        if (image[px + py * tiles_per_side * 4] >= pz + 2) {
+        // Early return if this pixel is outside the image, or won't ever
+        // be filled
+        if (px >= grid.size_px.x || py >= grid.size_px.y ||
+            image[px + py * grid.size_px.x] >= pz + 2)
+        {
             return;
         }
     }
@@ -1933,6 +2529,7 @@ void eval_voxels_f_heatmap(const uint64_t* const __restrict__ tape_data,
             case GPU_OP_COPY_IMM: out = make_float2(imm, imm); break;
             case GPU_OP_COPY_LHS: out = make_float2(lhs.x, lhs.y); break;
             case GPU_OP_COPY_RHS: out = make_float2(rhs.x, rhs.y); break;
+            case GPU_OP_TAG_LHS: out = make_float2(lhs.x, lhs.y); break;
 
 #undef lhs
 #undef rhs
@@ -1944,44 +2541,40 @@ void eval_voxels_f_heatmap(const uint64_t* const __restrict__ tape_data,
     // Check the result
     const uint8_t i_out = I_OUT(data);
 
-    const int4 pos = unpack(in_tiles[tile_index].position, tiles_per_side);
+    const int4 pos = unpack(in_tiles[tile_index].position, grid.tiles);
     if (DIMENSION == 3) {
         const int4 sub = unpack(threadIdx.x % 32, 4);
+        const int32_t px = pos.x * 4 + sub.x;
+        const int32_t py = pos.y * 4 + sub.y;
+        const int32_t pz = pos.z * 4 + sub.z;
+
         // The second voxel is always higher in Z, so it masks the lower voxel
-        if (slots[i_out].y < 0.0f) {
-            const int32_t px = pos.x * 4 + sub.x;
-            const int32_t py = pos.y * 4 + sub.y;
-            const int32_t pz = pos.z * 4 + sub.z + 2;
-
-            atomicMax(&image[px + py * tiles_per_side * 4], pz);
-        } else if (slots[i_out].x < 0.0f) {
-            const int32_t px = pos.x * 4 + sub.x;
-            const int32_t py = pos.y * 4 + sub.y;
-            const int32_t pz = pos.z * 4 + sub.z;
-
-            atomicMax(&image[px + py * tiles_per_side * 4], pz);
-        }
-        const int px = pos.x * 4 + sub.x;
-        const int py = pos.y * 4 + sub.y;
-        atomicAdd(&heatmap[px + py * tiles_per_side * 4], work);
+        // (unless it's above the top of the image)
+        if (slots[i_out].y < 0.0f && pz + 2 < grid.size_px.z) {
+            atomicMax(&image[px + py * grid.size_px.x], pz + 2);
+        } else if (slots[i_out].x < 0.0f && pz < grid.size_px.z) {
+            atomicMax(&image[px + py * grid.size_px.x], pz);
+        }
+        atomicAdd(&heatmap[px + py * grid.size_px.x], work);
     } else if (DIMENSION == 2) {
         const int4 sub = unpack(threadIdx.x % 32, 8);
-        if (slots[i_out].y < 0.0f) {
-            const int32_t px = pos.x * 8 + sub.x;
-            const int32_t py = pos.y * 8 + sub.y + 4;
-
-            image[px + py * tiles_per_side * 8] = 1;
+        const int32_t px = pos.x * 8 + sub.x;
+        const int32_t py = pos.y * 8 + sub.y;
+        if (px >= grid.size_px.x) {
+            return;
         }
-        if (slots[i_out].x < 0.0f) {
-            const int32_t px = pos.x * 8 + sub.x;
-            const int32_t py = pos.y * 8 + sub.y;
-
-            image[px + py * tiles_per_side * 8] = 1;
+        if (py + 4 < grid.size_px.y) {
+            if (slots[i_out].y < 0.0f) {
+                image[px + (py + 4) * grid.size_px.x] = 1;
+            }
+            atomicAdd(&heatmap[px + (py + 4) * grid.size_px.x], work / 2.0f);
+        }
+        if (py < grid.size_px.y) {
+            if (slots[i_out].x < 0.0f) {
+                image[px + py * grid.size_px.x] = 1;
+            }
+            atomicAdd(&heatmap[px + py * grid.size_px.x], work / 2.0f);
         }
-        const int px = pos.x * 8 + sub.x;
-        const int py = pos.y * 8 + sub.y;
-        atomicAdd(&heatmap[px + py * tiles_per_side * 8], work / 2.0f);
-        atomicAdd(&heatmap[px + (py + 4) * tiles_per_side * 8], work / 2.0f);
     }
 }
 
@@ -1990,8 +2583,9 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
                                        const float z)
 {
     // Build the heatmap for this render
-    Ptr<float[]> heatmap(CUDA_MALLOC(float, pow(image_size_px, 2)));
-    cudaMemset(heatmap.get(), 0, sizeof(float) * pow(image_size_px, 2));
+    const size_t num_pixels = image_width_px * image_height_px;
+    Ptr<float[]> heatmap(CUDA_MALLOC(float, num_pixels));
+    cudaMemset(heatmap.get(), 0, sizeof(float) * num_pixels);
 
     // Reset the tape index and copy the tape to the beginning of the
     // context's tape buffer area.
@@ -2002,12 +2596,14 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
 
     // Reset all of the data arrays.  In 2D, we only use stages 0, 2, and 3
     // for 64^2, 8^2, and per-voxel evaluation steps.
+    const TileGrid root = tile_grid(*this, 64, 1);
+    const TileGrid sub = root.subdivided(8);
     CUDA_CHECK(cudaMemsetAsync(stages[0].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px / 64, 2)));
+                               root.tiles.x * root.tiles.y));
     CUDA_CHECK(cudaMemsetAsync(stages[2].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px / 8, 2)));
+                               sub.tiles.x * sub.tiles.y));
     CUDA_CHECK(cudaMemsetAsync(stages[3].filled.get(), 0, sizeof(int32_t) *
-                               pow(image_size_px, 2)));
+                               num_pixels));
 
     ////////////////////////////////////////////////////////////////////////////
     // Evaluation of 64x64 tiles
@@ -2015,17 +2611,18 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
 
     // Go the whole list of first-stage tiles, assigning each to
     // be [position, tape = 0, next = -1]
-    unsigned count = pow(image_size_px / 64, 2);
+    unsigned count = root.tiles.x * root.tiles.y;
     unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
     preload_tiles<<<num_blocks, NUM_THREADS>>>(stages[0].tiles.get(), count);
 
     // Iterate over 64^2, 8^2 tiles
     for (unsigned i=0; i < 3; i += 2) {
-        const unsigned tile_size_px = i ? 8 : 64;
+        const TileGrid grid = i ? sub : root;
+        const TileGrid next_grid = grid.subdivided(8);
         const unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
 
         if (values_size < num_blocks * NUM_THREADS * 3) {
-            values.reset(CUDA_MALLOC(Interval, num_blocks * NUM_THREADS * 3));
+            values.reset(CUDA_MALLOC_DEVICE(Interval, num_blocks * NUM_THREADS * 3));
             values_size = num_blocks * NUM_THREADS * 3;
         }
 
@@ -2036,7 +2633,7 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
         calculate_intervals_2d<<<num_blocks, NUM_THREADS>>>(
             stages[i].tiles.get(),
             count,
-            image_size_px / tile_size_px,
+            grid,
             mat, z,
             reinterpret_cast<Interval*>(values.get()));
 
@@ -2045,14 +2642,13 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
             tape_data.get(),
             tape_index.get(),
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid,
 
             stages[i].tiles.get(),
             count,
 
             reinterpret_cast<Interval*>(values.get()),
 
-            tile_size_px,
             heatmap.get());
 
         // Mark the total number of active tiles (from this stage) to 0
@@ -2080,7 +2676,7 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
         const int next = i ? 3 : 2;
         if (active_tile_count > stages[next].tile_array_size) {
             stages[next].tile_array_size = active_tile_count;
-            stages[next].tiles.reset(CUDA_MALLOC(TileNode, active_tile_count));
+            stages[next].tiles.reset(CUDA_MALLOC_DEVICE(TileNode, active_tile_count));
         }
 
         if (i < 2) {
@@ -2088,7 +2684,8 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
             subdivide_active_tiles_2d<<<num_blocks*64, NUM_THREADS>>>(
                 stages[i].tiles.get(),
                 count,
-                image_size_px / tile_size_px,
+                grid.tiles,
+                next_grid.tiles,
                 stages[next].tiles.get());
         } else {
             // Special case for per-pixel evaluation, which
@@ -2104,12 +2701,13 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
             // by 64x).  This is cleaner that accumulating all of the levels
             // in a single pass, and could (possibly?) help with skipping
             // fully occluded tiles.
-            const unsigned next_tile_size = tile_size_px / 8;
-            const uint32_t u = ((image_size_px / next_tile_size) / 32);
-            copy_filled_2d<<<dim3(u + 1, u + 1), dim3(32, 32)>>>(
+            const dim3 blocks((next_grid.tiles.x + 31) / 32,
+                              (next_grid.tiles.y + 31) / 32);
+            copy_filled_2d<<<blocks, dim3(32, 32)>>>(
                     stages[i].filled.get(),
+                    grid.tiles,
                     stages[next].filled.get(),
-                    image_size_px / next_tile_size);
+                    next_grid.tiles);
         }
 
         // Assign the next number of tiles to evaluate
@@ -2122,31 +2720,29 @@ Ptr<float[]> Context::render2D_heatmap(const Tape& tape,
     num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
     const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
     if (values_size < num_values) {
-        values.reset(CUDA_MALLOC(float2, num_values));
+        values.reset(CUDA_MALLOC_DEVICE(float2, num_values));
         values_size = num_values;
     }
     calculate_pixels<<<num_blocks, NUM_TILES * 32>>>(
         stages[3].tiles.get(),
         count,
-        image_size_px / 8,
+        sub,
         mat, z,
         reinterpret_cast<float2*>(values.get()));
     eval_voxels_f_heatmap<2><<<num_blocks, NUM_TILES * 32>>>(
         tape_data.get(),
         stages[3].filled.get(),
-        image_size_px / 8,
+        sub,
 
         stages[3].tiles.get(),
         count,
 
         reinterpret_cast<float2*>(values.get()),
         heatmap.get());
-    CUDA_CHECK(cudaDeviceSynchronize());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 
-    for (unsigned x=0; x < image_size_px; ++x) {
-        for (unsigned y=0; y < image_size_px; ++y) {
-            heatmap[x + y * image_size_px] /= tape.length - 2;
-        }
+    for (size_t i=0; i < num_pixels; ++i) {
+        heatmap[i] /= tape.length - 2;
     }
     return heatmap;
 }
@@ -2155,8 +2751,9 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
                                        const Eigen::Matrix4f& mat)
 {
     // Build the heatmap for this render
-    Ptr<float[]> heatmap(CUDA_MALLOC(float, pow(image_size_px, 2)));
-    cudaMemset(heatmap.get(), 0, sizeof(float) * pow(image_size_px, 2));
+    const size_t num_pixels = image_width_px * image_height_px;
+    Ptr<float[]> heatmap(CUDA_MALLOC(float, num_pixels));
+    cudaMemset(heatmap.get(), 0, sizeof(float) * num_pixels);
 
     // Reset the tape index and copy the tape to the beginning of the
     // context's tape buffer area.
@@ -2170,28 +2767,30 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
     ////////////////////////////////////////////////////////////////////////////
 
     // Reset all of the data arrays
+    const TileGrid root = tile_grid(*this, 64, image_depth_px);
     for (unsigned i=0; i < 4; ++i) {
-        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        const TileGrid grid = root.subdivided(1 << (i * 2));
         CUDA_CHECK(cudaMemsetAsync(stages[i].filled.get(), 0, sizeof(int32_t) *
-                                   pow(image_size_px / tile_size_px, 2)));
+                                   grid.tiles.x * grid.tiles.y));
     }
     CUDA_CHECK(cudaMemsetAsync(normals.get(), 0, sizeof(uint32_t) *
-                               pow(image_size_px, 2)));
+                               num_pixels));
 
     // Go the whole list of first-stage tiles, assigning each to
     // be [position, tape = 0, next = -1]
-    unsigned count = pow(image_size_px / 64, 3);
+    unsigned count = root.tiles.x * root.tiles.y * root.tiles.z;
     unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
     preload_tiles<<<num_blocks, NUM_THREADS>>>(stages[0].tiles.get(), count);
 
     // Iterate over 64^3, 16^3, 4^3 tiles
     for (unsigned i=0; i < 3; ++i) {
         //printf("BEGINNING STAGE %u\n", i);
-        const unsigned tile_size_px = 64 / (1 << (i * 2));
+        const TileGrid grid = root.subdivided(1 << (i * 2));
+        const TileGrid next_grid = grid.subdivided(4);
         const unsigned num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
 
         if (values_size < num_blocks * NUM_THREADS * 3) {
-            values.reset(CUDA_MALLOC(Interval, num_blocks * NUM_THREADS * 3));
+            values.reset(CUDA_MALLOC_DEVICE(Interval, num_blocks * NUM_THREADS * 3));
             values_size = num_blocks * NUM_THREADS * 3;
         }
 
@@ -2202,7 +2801,7 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
         calculate_intervals_3d<<<num_blocks, NUM_THREADS>>>(
             stages[i].tiles.get(),
             count,
-            image_size_px / tile_size_px,
+            grid,
             mat,
             reinterpret_cast<Interval*>(values.get()));
 
@@ -2212,7 +2811,7 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
         // the logic in eval_tiles_i.
         mask_filled_tiles<<<num_blocks, NUM_THREADS>>>(
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
             stages[i].tiles.get(),
             count);
 
@@ -2221,13 +2820,12 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
             tape_data.get(),
             tape_index.get(),
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid,
 
             stages[i].tiles.get(),
             count,
 
             reinterpret_cast<Interval*>(values.get()),
-            tile_size_px,
             heatmap.get());
 
         // Mark the total number of active tiles (from this stage) to 0
@@ -2238,7 +2836,7 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
         // the next phase.
         mask_filled_tiles<<<num_blocks, NUM_THREADS>>>(
             stages[i].filled.get(),
-            image_size_px / tile_size_px,
+            grid.tiles,
             stages[i].tiles.get(),
             count);
 
@@ -2263,7 +2861,7 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
         // where the `next` indexes aren't used, but it's relatively small.
         if (active_tile_count > stages[i + 1].tile_array_size) {
             stages[i + 1].tile_array_size = active_tile_count;
-            stages[i + 1].tiles.reset(CUDA_MALLOC(TileNode, active_tile_count));
+            stages[i + 1].tiles.reset(CUDA_MALLOC_DEVICE(TileNode, active_tile_count));
         }
 
         if (i < 2) {
@@ -2271,7 +2869,8 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
             subdivide_active_tiles_3d<<<num_blocks*64, NUM_THREADS>>>(
                 stages[i].tiles.get(),
                 count,
-                image_size_px / tile_size_px,
+                grid.tiles,
+                next_grid.tiles,
                 stages[i + 1].tiles.get());
         } else {
             // Special case for per-pixel evaluation, which
@@ -2287,12 +2886,13 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
             // by 64x).  This is cleaner that accumulating all of the levels
             // in a single pass, and could (possibly?) help with skipping
             // fully occluded tiles.
-            const unsigned next_tile_size = tile_size_px / 4;
-            const uint32_t u = ((image_size_px / next_tile_size) / 32);
-            copy_filled_3d<<<dim3(u + 1, u + 1), dim3(32, 32)>>>(
+            const dim3 blocks((next_grid.tiles.x + 31) / 32,
+                              (next_grid.tiles.y + 31) / 32);
+            copy_filled_3d<<<blocks, dim3(32, 32)>>>(
                     stages[i].filled.get(),
+                    grid.tiles,
                     stages[i + 1].filled.get(),
-                    image_size_px / next_tile_size);
+                    next_grid.tiles);
         }
 
         // Assign the next number of tiles to evaluate
@@ -2305,19 +2905,20 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
     num_blocks = (count + NUM_TILES - 1) / NUM_TILES;
     const size_t num_values = num_blocks * NUM_TILES * 32 * 3;
     if (values_size < num_values) {
-        values.reset(CUDA_MALLOC(float2, num_values));
+        values.reset(CUDA_MALLOC_DEVICE(float2, num_values));
         values_size = num_values;
     }
+    const TileGrid grid = root.subdivided(16);
     calculate_voxels<<<num_blocks, NUM_TILES * 32>>>(
         stages[3].tiles.get(),
         count,
-        image_size_px / 4,
+        grid,
         mat,
         reinterpret_cast<float2*>(values.get()));
     eval_voxels_f_heatmap<3><<<num_blocks, NUM_TILES * 32>>>(
         tape_data.get(),
         stages[3].filled.get(),
-        image_size_px / 4,
+        grid,
 
         stages[3].tiles.get(),
         count,
@@ -2326,23 +2927,22 @@ Ptr<float[]> Context::render3D_heatmap(const Tape& tape,
         heatmap.get());
 
     {   // Then render normals into those pixels
-        const uint32_t u = ((image_size_px + 15) / 16);
-        eval_pixels_d<<<dim3(u, u), dim3(16, 16)>>>(
+        const dim3 blocks((image_width_px + 15) / 16,
+                          (image_height_px + 15) / 16);
+        eval_pixels_d<<<blocks, dim3(16, 16)>>>(
                 tape_data.get(),
                 stages[3].filled.get(),
                 normals.get(),
-                image_size_px,
+                grid.subdivided(4),
                 mat,
                 stages[0].tiles.get(),
                 stages[1].tiles.get(),
                 stages[2].tiles.get());
     }
-    CUDA_CHECK(cudaDeviceSynchronize());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 
-    for (unsigned x=0; x < image_size_px; ++x) {
-        for (unsigned y=0; y < image_size_px; ++y) {
-            heatmap[x + y * image_size_px] /= tape.length - 2;
-        }
+    for (size_t i=0; i < num_pixels; ++i) {
+        heatmap[i] /= tape.length - 2;
     }
     return heatmap;
 }
@@ -0,0 +1,139 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+
+#include "context.hpp"
+#include "context_pool.hpp"
+
+namespace mpr {
+
+// Returns the largest number of contexts which can render at once on the
+// current device, or 1 if it can't handle host access to managed memory
+// while another thread's kernels are running.
+static unsigned check_max_contexts(unsigned max_contexts) {
+    int device = 0;
+    int concurrent = 0;
+    CUDA_CHECK(cudaGetDevice(&device));
+    CUDA_CHECK(cudaDeviceGetAttribute(
+            &concurrent, cudaDevAttrConcurrentManagedAccess, device));
+    if (max_contexts > 1 && !concurrent) {
+        fprintf(stderr, "Device does not support concurrent managed access; "
+                        "limiting pool to one context\n");
+        return 1;
+    } else if (max_contexts == 0) {
+        fprintf(stderr, "Invalid pool size 0 (using 1 context)\n");
+        return 1;
+    }
+    return max_contexts;
+}
+
+ContextPool::ContextPool(unsigned max_contexts)
+    : max_contexts(check_max_contexts(max_contexts))
+{
+    // Nothing to do here
+}
+
+ContextPool::~ContextPool() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (available.size() != contexts.size()) {
+        fprintf(stderr, "ContextPool destroyed with %u contexts leased\n",
+                (unsigned)(contexts.size() - available.size()));
+    }
+}
+
+ContextPool::Lease ContextPool::lease(int32_t image_size_px) {
+    return lease(image_size_px, image_size_px);
+}
+
+ContextPool::Lease ContextPool::lease(int32_t image_width_px,
+                                      int32_t image_height_px)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]{
+        return !available.empty() || num_contexts < max_contexts; });
+
+    Context* ctx = nullptr;
+    if (!available.empty()) {
+        // Pick the smallest context which already fits the image (best
+        // fit), so that small renders don't take the big contexts, or the
+        // largest one (which needs to grow the least) if none of them fit.
+        const size_t pixels = size_t(image_width_px) * image_height_px;
+        auto itr = available.end();
+        for (auto a = available.begin(); a != available.end(); ++a) {
+            if ((*a)->normals_array_size >= pixels &&
+                (itr == available.end() ||
+                 (*a)->normals_array_size < (*itr)->normals_array_size))
+            {
+                itr = a;
+            }
+        }
+        if (itr == available.end()) {
+            itr = std::max_element(available.begin(), available.end(),
+                [](const Context* a, const Context* b) {
+                    return a->normals_array_size < b->normals_array_size;
+                });
+        }
+        ctx = *itr;
+        available.erase(itr);
+        lock.unlock();
+
+        ctx->resize(image_width_px, image_height_px);
+    } else {
+        // Allocating a context is slow, so we do it without holding the
+        // lock (reserving a slot first, so that we stay under the limit)
+        num_contexts++;
+        lock.unlock();
+
+        std::unique_ptr<Context> c(
+                new Context(image_width_px, image_height_px));
+        ctx = c.get();
+
+        lock.lock();
+        contexts.push_back(std::move(c));
+    }
+    return Lease(this, ctx);
+}
+
+unsigned ContextPool::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return contexts.size();
+}
+
+void ContextPool::release(Context* ctx) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        available.push_back(ctx);
+    }
+    cv.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ContextPool::Lease::Lease(ContextPool* pool, Context* ctx)
+    : pool(pool), ctx(ctx)
+{
+    // Nothing to do here
+}
+
+ContextPool::Lease::Lease(Lease&& other)
+    : pool(other.pool), ctx(other.ctx)
+{
+    other.ctx = nullptr;
+}
+
+ContextPool::Lease::~Lease() {
+    if (ctx) {
+        pool->release(ctx);
+    }
+}
+
+}   // namespace mpr
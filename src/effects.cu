@@ -9,8 +9,11 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 Copyright (C) 2019-2020  Matt Keeter
 */
+#include <algorithm>
+
 #include "context.hpp"
 #include "effects.hpp"
+#include "trace.hpp"
 
 namespace mpr {
 
@@ -20,7 +23,10 @@ void draw_ssao(const int32_t* const __restrict__ depth,
 
                const Eigen::Matrix<float, 64, 3> ssao_kernel,
                const Eigen::Matrix<float, 16*16, 3> ssao_rvecs,
+               const int image_width_px,
+               const int image_height_px,
                const int image_size_px,
+               const int image_depth_px,
 
                int32_t* const __restrict__ output)
 {
@@ -29,22 +35,22 @@ void draw_ssao(const int32_t* const __restrict__ depth,
 
     constexpr float RADIUS = 0.1f;
 
-    if (x >= image_size_px && y >= image_size_px) {
+    if (x >= image_width_px || y >= image_height_px) {
         return;
     }
 
-    const int h = depth[x + y * image_size_px];
+    const int h = depth[x + y * image_width_px];
     if (!h) {
         return;
     }
 
     const float3 pos = make_float3(
-        2.0f * ((x + 0.5f) / image_size_px - 0.5f),
-        2.0f * ((y + 0.5f) / image_size_px - 0.5f),
-        2.0f * ((h + 0.5f) / image_size_px - 0.5f));
+        (2.0f * (x + 0.5f) - image_width_px) / image_size_px,
+        (2.0f * (y + 0.5f) - image_height_px) / image_size_px,
+        2.0f * ((h + 0.5f) / image_depth_px - 0.5f));
 
     // Based on http://john-chapman-graphics.blogspot.com/2013/01/ssao-tutorial.html
-    const uint32_t n = norm[x + y * image_size_px];
+    const uint32_t n = norm[x + y * image_width_px];
 
     // Get normal from image
     const float dx = (float)(n & 0xFF) - 128.0f;
@@ -66,13 +72,16 @@ void draw_ssao(const int32_t* const __restrict__ depth,
             tbn * ssao_kernel.row(i).transpose() * RADIUS +
             Eigen::Vector3f{pos.x, pos.y, pos.z};
 
-        const unsigned px = (sample_pos.x() / 2.0f + 0.5f) * image_size_px;
-        const unsigned py = (sample_pos.y() / 2.0f + 0.5f) * image_size_px;
+        const unsigned px = (sample_pos.x() * image_size_px +
+                             image_width_px) / 2.0f;
+        const unsigned py = (sample_pos.y() * image_size_px +
+                             image_height_px) / 2.0f;
         const unsigned actual_h =
-            (px < image_size_px && py < image_size_px)
-            ? depth[px + py * image_size_px]
+            (px < image_width_px && py < image_height_px)
+            ? depth[px + py * image_width_px]
             : 0;
-        const float actual_z = 2.0f * ((actual_h + 0.5f) / image_size_px - 0.5f);
+        const float actual_z =
+            2.0f * ((actual_h + 0.5f) / image_depth_px - 0.5f);
 
         const auto dz = fabsf(sample_pos.z() - actual_z);
         if (dz < RADIUS) {
@@ -85,7 +94,7 @@ void draw_ssao(const int32_t* const __restrict__ depth,
     }
     occlusion = 1.0 - (occlusion / ssao_kernel.rows());
     const uint8_t o = occlusion * 255;
-    output[x + y * image_size_px] = o;
+    output[x + y * image_width_px] = o;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -93,13 +102,14 @@ void draw_ssao(const int32_t* const __restrict__ depth,
 __global__
 void blur_ssao(const int32_t* const __restrict__ image,
                const int32_t* const __restrict__ ssao,
-               const int image_size_px,
+               const int image_width_px,
+               const int image_height_px,
                int32_t* const __restrict__ output)
 {
     unsigned x = threadIdx.x + blockIdx.x * blockDim.x;
     unsigned y = threadIdx.y + blockIdx.y * blockDim.y;
 
-    if (x >= image_size_px || y >= image_size_px) {
+    if (x >= image_width_px || y >= image_height_px) {
         return;
     }
 
@@ -114,11 +124,11 @@ void blur_ssao(const int32_t* const __restrict__ image,
             for (int j=0; j <= BLUR_RADIUS; ++j) {
                 const int tx = x + xmin + i;
                 const int ty = y + ymin + j;
-                if (tx >= 0 && tx < image_size_px &&
-                    ty >= 0 && ty < image_size_px)
+                if (tx >= 0 && tx < image_width_px &&
+                    ty >= 0 && ty < image_height_px)
                 {
-                    if (image[tx + ty * image_size_px]) {
-                        sum += ssao[tx + ty * image_size_px];
+                    if (image[tx + ty * image_width_px]) {
+                        sum += ssao[tx + ty * image_width_px];
                         count++;
                     }
                 }
@@ -130,11 +140,11 @@ void blur_ssao(const int32_t* const __restrict__ image,
             for (int j=0; j <= BLUR_RADIUS; ++j) {
                 const int tx = xmin + i;
                 const int ty = ymin + j;
-                if (tx >= 0 && tx < image_size_px &&
-                    ty >= 0 && ty < image_size_px)
+                if (tx >= 0 && tx < image_width_px &&
+                    ty >= 0 && ty < image_height_px)
                 {
-                    if (image[tx + ty * image_size_px]) {
-                        const float d = (mean - ssao[tx + ty * image_size_px]);
+                    if (image[tx + ty * image_width_px]) {
+                        const float d = (mean - ssao[tx + ty * image_width_px]);
                         stdev += d * d;
                     }
                 }
@@ -152,7 +162,7 @@ void blur_ssao(const int32_t* const __restrict__ image,
         run((i & 1) ? 0 : -BLUR_RADIUS,
             (i & 2) ? 0 : -BLUR_RADIUS);
     }
-    output[x + y * image_size_px] = value;
+    output[x + y * image_width_px] = value;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -161,26 +171,29 @@ __global__ void draw_shaded(const int32_t* const __restrict__ depth,
                             const uint32_t* const __restrict__ norm,
                             const int32_t* const __restrict__ ssao,
 
+                            const int image_width_px,
+                            const int image_height_px,
                             const int image_size_px,
+                            const int image_depth_px,
 
                             int32_t* const __restrict__ output)
 {
     unsigned x = threadIdx.x + blockIdx.x * blockDim.x;
     unsigned y = threadIdx.y + blockIdx.y * blockDim.y;
 
-    if (x >= image_size_px && y >= image_size_px) {
+    if (x >= image_width_px || y >= image_height_px) {
         return;
     }
 
-    const auto h = depth[x + y * image_size_px];
+    const auto h = depth[x + y * image_width_px];
     if (!h) {
         return;
     }
 
-    const uint8_t s = ssao[x + y * image_size_px];
+    const uint8_t s = ssao[x + y * image_width_px];
 
     // Get normal from image
-    const auto n = norm[x + y * image_size_px];
+    const auto n = norm[x + y * image_width_px];
     float dx = (float)(n & 0xFF) - 128.0f;
     float dy = (float)((n >> 8) & 0xFF) - 128.0f;
     float dz = (float)((n >> 16) & 0xFF) - 128.0f;
@@ -188,9 +201,9 @@ __global__ void draw_shaded(const int32_t* const __restrict__ depth,
 
     // Apply a single light
     const float3 pos_f3 = make_float3(
-        2.0f * ((x + 0.5f) / image_size_px - 0.5f),
-        2.0f * ((y + 0.5f) / image_size_px - 0.5f),
-        2.0f * ((h + 0.5f) / image_size_px - 0.5f));
+        (2.0f * (x + 0.5f) - image_width_px) / image_size_px,
+        (2.0f * (y + 0.5f) - image_height_px) / image_size_px,
+        2.0f * ((h + 0.5f) / image_depth_px - 0.5f));
     const Eigen::Vector3f pos { pos_f3.x, pos_f3.y, pos_f3.z };
 
     const Eigen::Vector3f light_pos { 5, 5, 10 };
@@ -214,7 +227,7 @@ __global__ void draw_shaded(const int32_t* const __restrict__ depth,
 
     uint8_t color = light * 255.0f;
 
-    output[x + y * image_size_px] = (0xFF << 24) |
+    output[x + y * image_width_px] = (0xFF << 24) |
                                     (color << 16) |
                                     (color << 8) |
                                     (color << 0);
@@ -223,7 +236,8 @@ __global__ void draw_shaded(const int32_t* const __restrict__ depth,
 ////////////////////////////////////////////////////////////////////////////////
 
 Effects::Effects()
-    : image_size_px(0),
+    : image_width_px(0),
+      image_height_px(0),
       tmp(nullptr),
       image(nullptr)
 {
@@ -250,50 +264,72 @@ Effects::Effects()
 }
 
 void Effects::resizeTo(const Context& ctx) {
-    if (ctx.image_size_px != image_size_px) {
-        image_size_px = ctx.image_size_px;
-        tmp.reset(CUDA_MALLOC(int32_t, pow(image_size_px, 2)));
-        image.reset(CUDA_MALLOC(int32_t, pow(image_size_px, 2)));
+    // Buffers are only reallocated when they need to grow, like the
+    // Context's image buffers.
+    image_width_px = ctx.image_width_px;
+    image_height_px = ctx.image_height_px;
+    const size_t pixels = image_width_px * image_height_px;
+    if (pixels > image_array_size) {
+        image_array_size = std::max(pixels, image_array_size * 2);
+        tmp.reset(CUDA_MALLOC(int32_t, image_array_size));
+        image.reset(CUDA_MALLOC(int32_t, image_array_size));
     }
 }
 
+MemoryUsage Effects::memoryUsage() const {
+    MemoryUsage out;
+    out.add("tmp", sizeof(int32_t) * image_array_size);
+    out.add("image", sizeof(int32_t) * image_array_size);
+    return out;
+}
+
 void Effects::drawSSAO(const Context& ctx)
 {
+    MPR_TRACE_GPU("ssao");
     resizeTo(ctx);
 
-    const auto bytes = sizeof(int32_t) * pow(image_size_px, 2);
+    const auto bytes = sizeof(int32_t) * image_width_px * image_height_px;
     CUDA_CHECK(cudaMemsetAsync(tmp.get(), 0, bytes));
     CUDA_CHECK(cudaMemsetAsync(image.get(), 0, bytes));
 
-    const unsigned u = (image_size_px + 15) / 16;
-    draw_ssao<<<dim3(u, u), dim3(16, 16)>>>(
+    const dim3 blocks((image_width_px + 15) / 16, (image_height_px + 15) / 16);
+    draw_ssao<<<blocks, dim3(16, 16)>>>(
             ctx.stages[3].filled.get(), ctx.normals.get(),
-            ssao_kernel, ssao_rvecs, image_size_px,
+            ssao_kernel, ssao_rvecs,
+            image_width_px, image_height_px,
+            ctx.image_size_px, ctx.image_depth_px,
             tmp.get());
-    blur_ssao<<<dim3(u, u), dim3(16, 16)>>>(
-            ctx.stages[3].filled.get(), tmp.get(), image_size_px, image.get());
-    CUDA_CHECK(cudaDeviceSynchronize());
+    blur_ssao<<<blocks, dim3(16, 16)>>>(
+            ctx.stages[3].filled.get(), tmp.get(),
+            image_width_px, image_height_px, image.get());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 }
 
 void Effects::drawShaded(const Context& ctx)
 {
+    MPR_TRACE_GPU("shaded");
     resizeTo(ctx);
 
-    const auto bytes = sizeof(int32_t) * pow(image_size_px, 2);
+    const auto bytes = sizeof(int32_t) * image_width_px * image_height_px;
     CUDA_CHECK(cudaMemsetAsync(tmp.get(), 0, bytes));
     CUDA_CHECK(cudaMemsetAsync(image.get(), 0, bytes));
 
-    const unsigned u = (image_size_px + 15) / 16;
-    draw_ssao<<<dim3(u, u), dim3(16, 16)>>>(
+    const dim3 blocks((image_width_px + 15) / 16, (image_height_px + 15) / 16);
+    draw_ssao<<<blocks, dim3(16, 16)>>>(
             ctx.stages[3].filled.get(), ctx.normals.get(),
-            ssao_kernel, ssao_rvecs, image_size_px,
+            ssao_kernel, ssao_rvecs,
+            image_width_px, image_height_px,
+            ctx.image_size_px, ctx.image_depth_px,
             image.get());
-    blur_ssao<<<dim3(u, u), dim3(16, 16)>>>(
-            ctx.stages[3].filled.get(), image.get(), image_size_px, tmp.get());
-    draw_shaded<<<dim3(u, u), dim3(16, 16)>>>(
-            ctx.stages[3].filled.get(), ctx.normals.get(),
-            tmp.get(), image_size_px, image.get());
-    CUDA_CHECK(cudaDeviceSynchronize());
+    blur_ssao<<<blocks, dim3(16, 16)>>>(
+            ctx.stages[3].filled.get(), image.get(),
+            image_width_px, image_height_px, tmp.get());
+    draw_shaded<<<blocks, dim3(16, 16)>>>(
+            ctx.stages[3].filled.get(), ctx.normals.get(), tmp.get(),
+            image_width_px, image_height_px,
+            ctx.image_size_px, ctx.image_depth_px,
+            image.get());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
 }
 
 
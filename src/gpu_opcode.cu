@@ -53,6 +53,9 @@ const char* gpu_op_str(uint8_t op) {
         case GPU_OP_COPY_IMM: return "COPY_IMM";
         case GPU_OP_COPY_LHS: return "COPY_LHS";
         case GPU_OP_COPY_RHS: return "COPY_RHS";
+        case GPU_OP_MARK_X: return "MARK_X";
+        case GPU_OP_MARK_XY: return "MARK_XY";
+        case GPU_OP_TAG_LHS: return "TAG_LHS";
         default: return "UNKNOWN";
     }
 }
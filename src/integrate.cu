@@ -0,0 +1,286 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include "clause.hpp"
+#include "context.hpp"
+#include "integrate.hpp"
+#include "octree.hpp"
+#include "parameters.hpp"
+
+#include "gpu_eval.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
+
+using namespace mpr;
+
+// Each cell (or tile) writes its volume, first moments, second moments
+// (xx, yy, zz, xy, xz, yz), and error bound.
+#define NUM_MOMENTS 11
+
+// Ambiguous octree leaves are split into this many boxes per side
+#define INTEGRATE_SUBDIVISIONS 4
+
+/*
+ *  Accumulates the moments of a solid box with the given center and size
+ *  into `m`, which is laid out as described above.
+ */
+__device__ inline void add_box(float* m, const float3 c, const float3 s)
+{
+    const float v = s.x * s.y * s.z;
+    m[0] += v;
+    m[1] += v * c.x;
+    m[2] += v * c.y;
+    m[3] += v * c.z;
+    m[4] += v * (c.x * c.x + s.x * s.x / 12.0f);
+    m[5] += v * (c.y * c.y + s.y * s.y / 12.0f);
+    m[6] += v * (c.z * c.z + s.z * s.z / 12.0f);
+    m[7] += v * c.x * c.y;
+    m[8] += v * c.x * c.z;
+    m[9] += v * c.y * c.z;
+}
+
+/*
+ *  integrate_cells
+ *
+ *  Integrates every cell in the deepest level of the octree, with one thread
+ *  per cell.  Empty and filled states are inherited by children when the
+ *  octree is built, so the deepest level completely describes the model.
+ *
+ *  Filled cells are added exactly.  Ambiguous cells are split into
+ *  INTEGRATE_SUBDIVISIONS^3 boxes, each of which is evaluated with interval
+ *  arithmetic using the cell's pruned tape; boxes which remain ambiguous
+ *  are sampled at their center and added to the error bound.
+ */
+__global__
+void integrate_cells(const uint64_t* const __restrict__ tape_data,
+                     const int32_t* const __restrict__ cells,
+                     const int32_t depth,
+                     const float3 lower,
+                     const float3 upper,
+                     float* const __restrict__ out)
+{
+    const uint32_t cell_index = threadIdx.x + blockIdx.x * blockDim.x;
+    const int32_t n = 1 << depth;
+    if (cell_index >= (uint32_t)(n * n * n)) {
+        return;
+    }
+
+    float m[NUM_MOMENTS] = {0};
+    const int32_t cell = cells[octree_level_offset(depth) + cell_index];
+    const int3 c = octree_unpack(cell_index);
+    const Interval bx = octree_cell_bounds(lower.x, upper.x, c.x, n);
+    const Interval by = octree_cell_bounds(lower.y, upper.y, c.y, n);
+    const Interval bz = octree_cell_bounds(lower.z, upper.z, c.z, n);
+
+    if (cell == Octree::CELL_FILLED) {
+        add_box(m, make_float3(bx.mid(), by.mid(), bz.mid()),
+                   make_float3(bx.width(), by.width(), bz.width()));
+    } else if (cell >= 0) {
+        const int32_t s = INTEGRATE_SUBDIVISIONS;
+        const float3 size = make_float3(bx.width() / s,
+                                        by.width() / s,
+                                        bz.width() / s);
+        for (int32_t i=0; i < s * s * s; ++i) {
+            const float3 lo = make_float3(bx.lower() + size.x * (i % s),
+                                          by.lower() + size.y * ((i / s) % s),
+                                          bz.lower() + size.z * (i / (s * s)));
+            const float3 mid = make_float3(lo.x + size.x / 2,
+                                           lo.y + size.y / 2,
+                                           lo.z + size.z / 2);
+
+            Interval slots[128];
+            slots[((const uint8_t*)tape_data)[1]] = {lo.x, lo.x + size.x};
+            slots[((const uint8_t*)tape_data)[2]] = {lo.y, lo.y + size.y};
+            slots[((const uint8_t*)tape_data)[3]] = {lo.z, lo.z + size.z};
+
+            uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
+            int choice_index = 0;
+            bool has_any_choice = false;
+            const uint64_t* const end = walk_tape_i(
+                    &tape_data[cell], slots,
+                    choices, choice_index, has_any_choice);
+            const Interval result = slots[I_OUT(end)];
+
+            if (result.upper() < 0.0f) {
+                add_box(m, mid, size);
+            } else if (result.lower() <= 0.0f) {
+                float fs[128];
+                fs[((const uint8_t*)tape_data)[1]] = mid.x;
+                fs[((const uint8_t*)tape_data)[2]] = mid.y;
+                fs[((const uint8_t*)tape_data)[3]] = mid.z;
+                if (walk_tape_f(&tape_data[cell], fs) < 0.0f) {
+                    add_box(m, mid, size);
+                }
+                m[10] += size.x * size.y * size.z;
+            }
+        }
+    }
+
+    for (unsigned i=0; i < NUM_MOMENTS; ++i) {
+        out[cell_index * NUM_MOMENTS + i] = m[i];
+    }
+}
+
+/*
+ *  integrate_tiles_2d
+ *
+ *  Integrates the filled pixels from a 2D render, with one thread per 8^2
+ *  tile.  Pixels are treated as boxes of the given size (in world units),
+ *  centered on their sample points.  Pixels in tiles which were still
+ *  ambiguous at the 8^2 level are added to the error bound.
+ */
+__global__
+void integrate_tiles_2d(const int32_t* const __restrict__ image,
+                        const int32_t image_width_px,
+                        const int32_t image_height_px,
+                        const int32_t image_size_px,
+
+                        const TileNode* const __restrict__ tiles,
+                        const TileNode* const __restrict__ subtiles,
+
+                        const Eigen::Matrix3f mat,
+                        const float2 pixel_size,
+                        float* const __restrict__ out)
+{
+    const uint32_t tile_index = threadIdx.x + blockIdx.x * blockDim.x;
+    const uint32_t tiles_x = (image_width_px + 7) / 8;
+    const uint32_t tiles_y = (image_height_px + 7) / 8;
+    if (tile_index >= tiles_x * tiles_y) {
+        return;
+    }
+    const int32_t tx = tile_index % tiles_x;
+    const int32_t ty = tile_index / tiles_x;
+
+    // Check whether this tile was ambiguous, using the same tile lookup
+    // as eval_pixels_id_2d.
+    const TileNode& t =
+        tiles[(tx / 8) + (ty / 8) * ((image_width_px + 63) / 64)];
+    const bool ambiguous = (t.next != -1) &&
+        (subtiles[t.next * 64 + (tx % 8) + (ty % 8) * 8].position != -1);
+
+    float m[NUM_MOMENTS] = {0};
+    const float3 size = make_float3(pixel_size.x, pixel_size.y, 1.0f);
+    int32_t inside = 0;
+    for (unsigned i=0; i < 64; ++i) {
+        const int32_t px = tx * 8 + i % 8;
+        const int32_t py = ty * 8 + i / 8;
+        if (px >= image_width_px || py >= image_height_px) {
+            continue;
+        }
+        inside++;
+        if (!image[px + py * image_width_px]) {
+            continue;
+        }
+        const float fx = (2.0f * (px + 0.5f) - image_width_px) / image_size_px;
+        const float fy = (2.0f * (py + 0.5f) - image_height_px) / image_size_px;
+        const float fw = mat(2, 0) * fx + mat(2, 1) * fy + mat(2, 2);
+        add_box(m, make_float3(
+                    (mat(0, 0) * fx + mat(0, 1) * fy + mat(0, 2)) / fw,
+                    (mat(1, 0) * fx + mat(1, 1) * fy + mat(1, 2)) / fw,
+                    0.0f),
+                size);
+    }
+    // The Z terms are meaningless in 2D
+    m[3] = m[6] = m[8] = m[9] = 0.0f;
+    if (ambiguous) {
+        m[10] = inside * pixel_size.x * pixel_size.y;
+    }
+
+    for (unsigned i=0; i < NUM_MOMENTS; ++i) {
+        out[tile_index * NUM_MOMENTS + i] = m[i];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace mpr {
+
+Integrator::Integrator() {
+    // Nothing to do here
+}
+
+MassProperties Integrator::volume(const Octree& octree) {
+    const uint32_t count = 1u << (3 * octree.depth);
+    if (tmp_size < count * NUM_MOMENTS) {
+        tmp.reset(CUDA_MALLOC(float, count * NUM_MOMENTS));
+        tmp_size = count * NUM_MOMENTS;
+    }
+
+    const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+    integrate_cells<<<num_blocks, NUM_THREADS>>>(
+        octree.tape_data.get(),
+        octree.cells.get(), octree.depth,
+        make_float3(octree.lower.x(), octree.lower.y(), octree.lower.z()),
+        make_float3(octree.upper.x(), octree.upper.y(), octree.upper.z()),
+        tmp.get());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+
+    return reduce(count);
+}
+
+MassProperties Integrator::area(const Context& ctx,
+                                const Eigen::Matrix3f& mat)
+{
+    const uint32_t count = ((ctx.image_width_px + 7) / 8) *
+                           ((ctx.image_height_px + 7) / 8);
+    if (tmp_size < count * NUM_MOMENTS) {
+        tmp.reset(CUDA_MALLOC(float, count * NUM_MOMENTS));
+        tmp_size = count * NUM_MOMENTS;
+    }
+
+    // Pixel size in world units, assuming that the matrix is affine
+    const float scale = 2.0f / ctx.image_size_px / mat(2, 2);
+    const float2 pixel_size = make_float2(
+            (mat.col(0).head<2>() * scale).norm(),
+            (mat.col(1).head<2>() * scale).norm());
+
+    const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+    integrate_tiles_2d<<<num_blocks, NUM_THREADS>>>(
+        ctx.stages[3].filled.get(),
+        ctx.image_width_px, ctx.image_height_px, ctx.image_size_px,
+        ctx.stages[0].tiles.get(),
+        ctx.stages[2].tiles.get(),
+        mat, pixel_size,
+        tmp.get());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+
+    return reduce(count);
+}
+
+MassProperties Integrator::reduce(uint32_t count) {
+    // Sum in double precision on the host, since there may be millions of
+    // cells with very different magnitudes.
+    double m[NUM_MOMENTS] = {0};
+    for (uint32_t i=0; i < count; ++i) {
+        for (unsigned j=0; j < NUM_MOMENTS; ++j) {
+            m[j] += tmp[i * NUM_MOMENTS + j];
+        }
+    }
+
+    MassProperties out;
+    out.volume = m[0];
+    out.error = m[10];
+    if (m[0] <= 0) {
+        return out;
+    }
+    out.centroid = Eigen::Vector3d(m[1], m[2], m[3]) / m[0];
+
+    // Second moments about the centroid
+    Eigen::Matrix3d s;
+    s << m[4], m[7], m[8],
+         m[7], m[5], m[9],
+         m[8], m[9], m[6];
+    s -= m[0] * out.centroid * out.centroid.transpose();
+    out.inertia = s.trace() * Eigen::Matrix3d::Identity() - s;
+    return out;
+}
+
+}   // namespace mpr
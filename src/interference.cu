@@ -0,0 +1,226 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <climits>
+
+#include "clause.hpp"
+#include "context.hpp"
+#include "interference.hpp"
+#include "parameters.hpp"
+#include "tape.hpp"
+
+#include "gpu_eval.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
+
+using namespace mpr;
+
+// An active cell, with a separate (pruned) tape for each shape
+struct PairCell {
+    int32_t position;   // Morton index within its level
+    int32_t tapes[2];
+};
+
+/*
+ *  eval_pairs_i
+ *
+ *  Evaluates every active cell in one level, with one thread per cell.
+ *
+ *  Each shape's tape is evaluated with interval arithmetic; if either shape
+ *  is empty, the cell is discarded.  If both are filled, the overlap is
+ *  confirmed.  Otherwise, each tape is pruned (if possible) and the cell's
+ *  eight children are written to `out_cells`, unless we're at the deepest
+ *  level, in which case the cell is recorded as a possible overlap.
+ *
+ *  `result` accumulates the strongest Interference::Result, and `bounds`
+ *  accumulates the integer bounds of overlapping cells (in units of cells
+ *  in the deepest level) as [xmin, ymin, zmin, xmax, ymax, zmax].
+ */
+__global__
+void eval_pairs_i(uint64_t* const __restrict__ tape_data,
+                  int32_t* const __restrict__ tape_index,
+
+                  const PairCell* const __restrict__ in_cells,
+                  const int32_t in_cell_count,
+                  const int32_t level,
+                  const int32_t depth,
+                  const float3 lower,
+                  const float3 upper,
+
+                  PairCell* const __restrict__ out_cells,
+                  int32_t* const __restrict__ out_cell_count,
+                  int32_t* const __restrict__ result,
+                  int32_t* const __restrict__ bounds)
+{
+    const int32_t cell_index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (cell_index >= in_cell_count) {
+        return;
+    }
+
+    const PairCell cell = in_cells[cell_index];
+    const int3 c = octree_unpack(cell.position);
+    const int32_t n = 1 << level;
+    const Interval ix = octree_cell_bounds(lower.x, upper.x, c.x, n);
+    const Interval iy = octree_cell_bounds(lower.y, upper.y, c.y, n);
+    const Interval iz = octree_cell_bounds(lower.z, upper.z, c.z, n);
+
+    int32_t tapes[2] = {cell.tapes[0], cell.tapes[1]};
+    bool filled[2];
+    for (unsigned k=0; k < 2; ++k) {
+        // The two shapes may have their axes in different slots, so we
+        // read them from each tape's own header.
+        const uint8_t* const header = (const uint8_t*)&tape_data[tapes[k]];
+        Interval slots[128];
+        slots[header[1]] = ix;
+        slots[header[2]] = iy;
+        slots[header[3]] = iz;
+
+        uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
+        int choice_index = 0;
+        bool has_any_choice = false;
+        const uint64_t* __restrict__ data = walk_tape_i(
+                &tape_data[tapes[k]], slots,
+                choices, choice_index, has_any_choice);
+
+        const Interval r = slots[I_OUT(data)];
+        if (r.lower() > 0.0f) {
+            return;
+        }
+        filled[k] = r.upper() < 0.0f;
+
+        // There's no point in pruning the tape if we won't use it again
+        if (has_any_choice && !filled[k] && level < depth) {
+            const int32_t t = push_tape(tape_data, tape_index, data,
+                                        choices, choice_index, (int*)slots);
+            if (t != -1) {
+                tapes[k] = t;
+            }
+        }
+    }
+
+    const bool confirmed = filled[0] && filled[1];
+    if (confirmed || level == depth) {
+        const int32_t shift = depth - level;
+        atomicMin(&bounds[0], c.x << shift);
+        atomicMin(&bounds[1], c.y << shift);
+        atomicMin(&bounds[2], c.z << shift);
+        atomicMax(&bounds[3], ((c.x + 1) << shift) - 1);
+        atomicMax(&bounds[4], ((c.y + 1) << shift) - 1);
+        atomicMax(&bounds[5], ((c.z + 1) << shift) - 1);
+        atomicMax(result, confirmed ? Interference::CONFIRMED
+                                    : Interference::POSSIBLE);
+        return;
+    }
+
+    // Children of a cell are adjacent in Morton order, so they share tapes
+    const int32_t o = atomicAdd(out_cell_count, 8);
+    for (int32_t i=0; i < 8; ++i) {
+        out_cells[o + i].position = cell.position * 8 + i;
+        out_cells[o + i].tapes[0] = tapes[0];
+        out_cells[o + i].tapes[1] = tapes[1];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace mpr {
+
+constexpr int32_t Interference::MAX_DEPTH;
+
+Interference::Interference(const Tape& a, const Tape& b, Context& ctx,
+                           int32_t depth,
+                           const Eigen::Vector3f& lower,
+                           const Eigen::Vector3f& upper)
+    : result(DISJOINT), overlap_lower(lower), overlap_upper(upper)
+{
+    if (depth < 0 || depth > MAX_DEPTH) {
+        fprintf(stderr, "Invalid interference depth %i (clamping to [0, %i])\n",
+                depth, MAX_DEPTH);
+        depth = std::max(0, std::min(depth, MAX_DEPTH));
+    }
+    if (a.length + b.length > NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE) {
+        fprintf(stderr, "Tapes are too long for the tape buffer\n");
+        result = POSSIBLE;
+        return;
+    }
+
+    // Copy both tapes to the beginning of the context's tape buffer, then
+    // push pruned tapes after them.  Tapes are linked with relative jumps,
+    // so the second tape is valid at an offset.
+    *ctx.tape_index = a.length + b.length;
+    cudaMemcpyAsync(ctx.tape_data.get(), a.data.get(),
+                    sizeof(uint64_t) * a.length,
+                    cudaMemcpyDeviceToDevice);
+    cudaMemcpyAsync(ctx.tape_data.get() + a.length, b.data.get(),
+                    sizeof(uint64_t) * b.length,
+                    cudaMemcpyDeviceToDevice);
+
+    Ptr<int32_t[]> counters(CUDA_MALLOC(int32_t, 8));
+    int32_t* const cell_count = &counters[0];
+    int32_t* const found = &counters[1];
+    int32_t* const bounds = &counters[2];
+    *found = DISJOINT;
+    for (unsigned i=0; i < 3; ++i) {
+        bounds[i] = INT_MAX;
+        bounds[i + 3] = INT_MIN;
+    }
+
+    // Double-buffered lists of active cells, starting with the root
+    size_t cells_size = 8;
+    size_t next_size = 8;
+    Ptr<PairCell[]> cells(CUDA_MALLOC(PairCell, cells_size));
+    Ptr<PairCell[]> next(CUDA_MALLOC(PairCell, next_size));
+    cells[0].position = 0;
+    cells[0].tapes[0] = 0;
+    cells[0].tapes[1] = a.length;
+    int32_t count = 1;
+
+    const float3 lo = make_float3(lower.x(), lower.y(), lower.z());
+    const float3 hi = make_float3(upper.x(), upper.y(), upper.z());
+    for (int32_t level=0; level <= depth && count; ++level) {
+        // Make sure that every active cell could be subdivided
+        if (count * 8 > next_size) {
+            next_size = count * 8;
+            next.reset(CUDA_MALLOC(PairCell, next_size));
+        }
+        *cell_count = 0;
+
+        const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+        eval_pairs_i<<<num_blocks, NUM_THREADS>>>(
+            ctx.tape_data.get(),
+            ctx.tape_index.get(),
+            cells.get(), count,
+            level, depth, lo, hi,
+            next.get(), cell_count,
+            found, bounds);
+        CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+
+        // Return early if we've found a definite overlap
+        if (*found == CONFIRMED) {
+            break;
+        }
+        count = *cell_count;
+        std::swap(cells, next);
+        std::swap(cells_size, next_size);
+    }
+
+    result = static_cast<Result>(*found);
+    if (result != DISJOINT) {
+        const Eigen::Vector3f size = (upper - lower) / (1 << depth);
+        overlap_lower = lower + Eigen::Vector3f(
+                bounds[0], bounds[1], bounds[2]).cwiseProduct(size);
+        overlap_upper = lower + Eigen::Vector3f(
+                bounds[3] + 1, bounds[4] + 1, bounds[5] + 1).cwiseProduct(size);
+    }
+}
+
+}   // namespace mpr
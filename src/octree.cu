@@ -0,0 +1,235 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+
+#include "clause.hpp"
+#include "context.hpp"
+#include "octree.hpp"
+#include "parameters.hpp"
+#include "tape.hpp"
+
+#include "gpu_eval.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
+
+using namespace mpr;
+
+// Written at the start of every saved octree, followed by the version
+static const uint32_t OCTREE_MAGIC = 0x4f52504d; // "MPRO"
+static const uint32_t OCTREE_VERSION = 1;
+
+/*
+ *  eval_cells_i
+ *
+ *  Evaluates every cell in one level of the octree, with one thread per cell.
+ *
+ *  Each cell starts from its parent's state: if the parent is empty or
+ *  filled, then the cell is too.  Otherwise, the cell is evaluated with
+ *  interval arithmetic using the parent's tape (exactly like eval_tiles_i,
+ *  but over a world-space box rather than a screen-space tile), then either
+ *  marked as empty / filled or given a newly pushed tape.
+ *
+ *  Because cells are stored in Morton order, the eight children of a cell
+ *  are adjacent and share a tape, which limits divergence within a warp.
+ */
+__global__
+void eval_cells_i(uint64_t* const __restrict__ tape_data,
+                  int32_t* const __restrict__ tape_index,
+                  int32_t* const __restrict__ cells,
+                  const int32_t level,
+                  const float3 lower,
+                  const float3 upper)
+{
+    const uint32_t cell_index = threadIdx.x + blockIdx.x * blockDim.x;
+    const int32_t n = 1 << level;
+    if (cell_index >= (uint32_t)(n * n * n)) {
+        return;
+    }
+
+    int32_t* const out = &cells[octree_level_offset(level) + cell_index];
+    const int32_t parent = level
+        ? cells[octree_level_offset(level - 1) + cell_index / 8]
+        : 0;
+
+    // Empty and filled cells are inherited by all of their children
+    if (parent < 0) {
+        *out = parent;
+        return;
+    }
+
+    const int3 c = octree_unpack(cell_index);
+    Interval slots[128];
+    slots[((const uint8_t*)tape_data)[1]] =
+        octree_cell_bounds(lower.x, upper.x, c.x, n);
+    slots[((const uint8_t*)tape_data)[2]] =
+        octree_cell_bounds(lower.y, upper.y, c.y, n);
+    slots[((const uint8_t*)tape_data)[3]] =
+        octree_cell_bounds(lower.z, upper.z, c.z, n);
+
+    uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
+    int choice_index = 0;
+    bool has_any_choice = false;
+
+    const uint64_t* __restrict__ data = walk_tape_i(
+            &tape_data[parent], slots, choices, choice_index, has_any_choice);
+
+    // Check the result
+    const uint8_t i_out = I_OUT(data);
+    if (slots[i_out].lower() > 0.0f) {
+        *out = Octree::CELL_EMPTY;
+        return;
+    } else if (slots[i_out].upper() < 0.0f) {
+        *out = Octree::CELL_FILLED;
+        return;
+    }
+
+    // Fall back to the parent's tape if we can't push a shorter one
+    *out = parent;
+    if (!has_any_choice) {
+        return;
+    }
+    const int32_t t = push_tape(tape_data, tape_index, data,
+                                choices, choice_index, (int*)slots);
+    if (t != -1) {
+        *out = t;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace mpr {
+
+constexpr int32_t Octree::MAX_DEPTH;
+
+uint32_t Octree::levelOffset(int32_t level) {
+    return ((1u << (3 * level)) - 1) / 7;
+}
+
+uint32_t Octree::numCells(int32_t depth) {
+    return levelOffset(depth + 1);
+}
+
+Octree::Octree(const Tape& tape, Context& ctx, int32_t depth,
+               const Eigen::Vector3f& lower, const Eigen::Vector3f& upper)
+    : lower(lower), upper(upper), depth(depth)
+{
+    if (depth < 0 || depth > MAX_DEPTH) {
+        fprintf(stderr, "Invalid octree depth %i (clamping to [0, %i])\n",
+                depth, MAX_DEPTH);
+        this->depth = std::max(0, std::min(depth, MAX_DEPTH));
+    }
+
+    // Use the context's tape buffer as scratch space while building,
+    // beginning with the root tape at index 0.
+    *ctx.tape_index = tape.length;
+    cudaMemcpyAsync(ctx.tape_data.get(), tape.data.get(),
+                    sizeof(uint64_t) * tape.length,
+                    cudaMemcpyDeviceToDevice);
+
+    cells.reset(CUDA_MALLOC(int32_t, numCells(this->depth)));
+
+    const float3 lo = make_float3(lower.x(), lower.y(), lower.z());
+    const float3 hi = make_float3(upper.x(), upper.y(), upper.z());
+    for (int32_t level=0; level <= this->depth; ++level) {
+        const uint32_t count = 1u << (3 * level);
+        const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+        eval_cells_i<<<num_blocks, NUM_THREADS>>>(
+            ctx.tape_data.get(),
+            ctx.tape_index.get(),
+            cells.get(),
+            level, lo, hi);
+    }
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+
+    // Every tape that was successfully pushed lives below this index, so
+    // we can copy out the used part of the tape buffer.  Tapes are linked
+    // with relative jumps, so they remain valid once copied back into the
+    // start of a tape buffer.
+    tape_length = std::min(*ctx.tape_index,
+                           (int32_t)(NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE));
+    tape_data.reset(CUDA_MALLOC(uint64_t, tape_length));
+    CUDA_CHECK(cudaMemcpy(tape_data.get(), ctx.tape_data.get(),
+                          sizeof(uint64_t) * tape_length,
+                          cudaMemcpyDeviceToDevice));
+}
+
+bool Octree::save(std::ostream& out) const {
+    const float bounds[6] = {lower.x(), lower.y(), lower.z(),
+                             upper.x(), upper.y(), upper.z()};
+    out.write(reinterpret_cast<const char*>(&OCTREE_MAGIC),
+              sizeof(OCTREE_MAGIC));
+    out.write(reinterpret_cast<const char*>(&OCTREE_VERSION),
+              sizeof(OCTREE_VERSION));
+    out.write(reinterpret_cast<const char*>(&depth), sizeof(depth));
+    out.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+    out.write(reinterpret_cast<const char*>(&tape_length),
+              sizeof(tape_length));
+    out.write(reinterpret_cast<const char*>(tape_data.get()),
+              sizeof(uint64_t) * tape_length);
+    out.write(reinterpret_cast<const char*>(cells.get()),
+              sizeof(int32_t) * numCells(depth));
+    return out.good();
+}
+
+std::unique_ptr<Octree> Octree::load(std::istream& in) {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!in.good() || magic != OCTREE_MAGIC) {
+        fprintf(stderr, "Invalid octree header\n");
+        return nullptr;
+    } else if (version != OCTREE_VERSION) {
+        fprintf(stderr, "Unsupported octree version %u\n", version);
+        return nullptr;
+    }
+
+    std::unique_ptr<Octree> out(new Octree());
+    float bounds[6];
+    in.read(reinterpret_cast<char*>(&out->depth), sizeof(out->depth));
+    in.read(reinterpret_cast<char*>(bounds), sizeof(bounds));
+    in.read(reinterpret_cast<char*>(&out->tape_length),
+            sizeof(out->tape_length));
+    if (!in.good() || out->depth < 0 || out->depth > MAX_DEPTH ||
+        out->tape_length <= 0 ||
+        out->tape_length > NUM_SUBTAPES * SUBTAPE_CHUNK_SIZE)
+    {
+        fprintf(stderr, "Invalid octree parameters\n");
+        return nullptr;
+    }
+    out->lower = Eigen::Vector3f(bounds[0], bounds[1], bounds[2]);
+    out->upper = Eigen::Vector3f(bounds[3], bounds[4], bounds[5]);
+
+    out->tape_data.reset(CUDA_MALLOC(uint64_t, out->tape_length));
+    in.read(reinterpret_cast<char*>(out->tape_data.get()),
+            sizeof(uint64_t) * out->tape_length);
+
+    const uint32_t num_cells = numCells(out->depth);
+    out->cells.reset(CUDA_MALLOC(int32_t, num_cells));
+    in.read(reinterpret_cast<char*>(out->cells.get()),
+            sizeof(int32_t) * num_cells);
+    if (!in.good()) {
+        fprintf(stderr, "Octree data is truncated\n");
+        return nullptr;
+    }
+
+    // Make sure that no cell points outside of the tape data
+    for (uint32_t i=0; i < num_cells; ++i) {
+        if (out->cells[i] < CELL_FILLED || out->cells[i] >= out->tape_length) {
+            fprintf(stderr, "Invalid octree cell %u\n", i);
+            return nullptr;
+        }
+    }
+    return out;
+}
+
+}   // namespace mpr
@@ -0,0 +1,154 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <atomic>
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "perf_counters.hpp"
+
+namespace mpr {
+
+constexpr uint64_t PerfCounters::UNAVAILABLE;
+
+const char* PerfCounters::name(unsigned counter) {
+    switch (counter) {
+        case CYCLES:        return "cycles";
+        case INSTRUCTIONS:  return "instructions";
+        case BRANCH_MISSES: return "branch_misses";
+        case L1D_MISSES:    return "l1d_misses";
+        case LLC_MISSES:    return "llc_misses";
+        default:            return "unknown";
+    }
+}
+
+// Only warn once if counters can't be opened, rather than once per thread
+static std::atomic<bool> perf_warned(false);
+
+#ifdef __linux__
+
+/*
+ *  A group of counters for one thread, led by the cycle counter, so that
+ *  every counter is scheduled onto the PMU at the same time.
+ */
+struct PerfGroup {
+    PerfGroup() {
+        static const struct { uint32_t type; uint64_t config; }
+            EVENTS[PerfCounters::NUM_COUNTERS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        };
+
+        // Mark every counter as closed up front, so that the destructor
+        // doesn't close fd 0 if we bail out early.
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            fds[i] = -1;
+            slot[i] = -1;
+        }
+
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            struct perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = EVENTS[i].type;
+            attr.config = EVENTS[i].config;
+            attr.disabled = (i == 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            // Count this thread on any CPU
+            const int fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+                                   i ? fds[0] : -1, 0);
+            if (fd < 0) {
+                if (i == 0) {
+                    return; // no leader, so skip the ioctls below
+                }
+                continue;
+            }
+            fds[i] = fd;
+            slot[i] = count++;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~PerfGroup() {
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            if (fds[i] != -1) {
+                close(fds[i]);
+            }
+        }
+    }
+
+    bool read(uint64_t (&out)[PerfCounters::NUM_COUNTERS]) const {
+        if (fds[0] == -1) {
+            return false;
+        }
+
+        // Laid out as {nr, time_enabled, time_running, values[nr]}
+        uint64_t buf[3 + PerfCounters::NUM_COUNTERS];
+        if (::read(fds[0], buf, sizeof(buf)) < (ssize_t)(sizeof(uint64_t) * 3)) {
+            return false;
+        }
+
+        // Scale up if the group was multiplexed with other events
+        const double scale = buf[2] ? double(buf[1]) / buf[2] : 1.0;
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            out[i] = (slot[i] == -1 || slot[i] >= (int)buf[0])
+                ? PerfCounters::UNAVAILABLE
+                : uint64_t(buf[3 + slot[i]] * scale);
+        }
+        return true;
+    }
+
+    int fds[PerfCounters::NUM_COUNTERS];
+    int slot[PerfCounters::NUM_COUNTERS];   // Index in the group's read
+    int count = 0;
+};
+
+bool PerfCounters::read(uint64_t (&out)[NUM_COUNTERS]) {
+    thread_local PerfGroup group;
+    if (group.read(out)) {
+        return true;
+    }
+    if (!perf_warned.exchange(true)) {
+        fprintf(stderr, "Hardware performance counters are unavailable "
+                        "(check /proc/sys/kernel/perf_event_paranoid)\n");
+    }
+    return false;
+}
+
+#else   // !__linux__
+
+bool PerfCounters::read(uint64_t (&)[NUM_COUNTERS]) {
+    if (!perf_warned.exchange(true)) {
+        fprintf(stderr, "Hardware performance counters are only "
+                        "supported on Linux\n");
+    }
+    return false;
+}
+
+#endif
+
+}   // namespace mpr
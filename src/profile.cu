@@ -0,0 +1,323 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "profile.hpp"
+#include "tape.hpp"
+#include "util.hpp"
+
+namespace mpr {
+
+#ifdef MPR_PROFILE
+
+__device__ ProfileEntry profile_table[PROFILE_TABLE_SIZE];
+__device__ unsigned long long
+    profile_ops[Profile::NUM_MODES][PROFILE_NUM_OPS];
+
+// Counts for a single stage, accumulated on the host
+struct ProfileStage {
+    unsigned long long ops[Profile::NUM_MODES][PROFILE_NUM_OPS] = {{0}};
+    std::unordered_map<uint64_t, ProfileEntry> clauses;
+};
+
+// Stages are kept in the order in which they first ran
+static std::mutex profile_mutex;
+static std::vector<std::pair<std::string, ProfileStage>> profile_stages;
+
+static ProfileStage& profile_stage(const char* name) {
+    for (auto& s : profile_stages) {
+        if (s.first == name) {
+            return s.second;
+        }
+    }
+    profile_stages.push_back({name, ProfileStage()});
+    return profile_stages.back().second;
+}
+
+static void clear_device_counts() {
+    void* ptr;
+    CUDA_CHECK(cudaGetSymbolAddress(&ptr, profile_table));
+    CUDA_CHECK(cudaMemset(ptr, 0, sizeof(profile_table)));
+    CUDA_CHECK(cudaGetSymbolAddress(&ptr, profile_ops));
+    CUDA_CHECK(cudaMemset(ptr, 0, sizeof(profile_ops)));
+}
+
+void Profile::reset() {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    CUDA_CHECK(cudaDeviceSynchronize());
+    clear_device_counts();
+    profile_stages.clear();
+}
+
+void Profile::collect(const char* name) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    CUDA_CHECK(cudaDeviceSynchronize());
+
+    std::vector<ProfileEntry> table(PROFILE_TABLE_SIZE);
+    unsigned long long ops[NUM_MODES][PROFILE_NUM_OPS];
+    CUDA_CHECK(cudaMemcpyFromSymbol(table.data(), profile_table,
+                                    sizeof(profile_table)));
+    CUDA_CHECK(cudaMemcpyFromSymbol(ops, profile_ops, sizeof(ops)));
+    clear_device_counts();
+
+    bool any = false;
+    for (unsigned m=0; m < NUM_MODES; ++m) {
+        for (unsigned i=0; i < PROFILE_NUM_OPS; ++i) {
+            any |= (ops[m][i] != 0);
+        }
+    }
+    if (!any) {
+        return;
+    }
+
+    auto& stage = profile_stage(name);
+    for (unsigned m=0; m < NUM_MODES; ++m) {
+        for (unsigned i=0; i < PROFILE_NUM_OPS; ++i) {
+            stage.ops[m][i] += ops[m][i];
+        }
+    }
+    for (auto& e : table) {
+        if (!e.clause) {
+            continue;
+        }
+        auto itr = stage.clauses.find(e.clause);
+        if (itr == stage.clauses.end()) {
+            stage.clauses.insert({e.clause, e});
+        } else {
+            for (unsigned m=0; m < NUM_MODES; ++m) {
+                itr->second.count[m] += e.count[m];
+            }
+            for (unsigned c=0; c < 3; ++c) {
+                itr->second.choice[c] += e.choice[c];
+            }
+        }
+    }
+}
+
+Profile::Stage::Stage(const char* name)
+    : name(name)
+{
+    // Anything that ran before this stage doesn't belong to it
+    collect("(other)");
+}
+
+Profile::Stage::~Stage() {
+    collect(name);
+}
+
+static void print_clause(FILE* f, uint64_t d) {
+    const uint8_t op = OP(&d);
+    fprintf(f, "%-12s %3u %3u %3u", gpu_op_str(op),
+            I_OUT(&d), I_LHS(&d), I_RHS(&d));
+    const bool has_imm = (op == GPU_OP_ADD_LHS_IMM ||
+                          op == GPU_OP_MUL_LHS_IMM ||
+                          op == GPU_OP_MIN_LHS_IMM ||
+                          op == GPU_OP_MAX_LHS_IMM ||
+                          op == GPU_OP_SUB_LHS_IMM ||
+                          op == GPU_OP_SUB_IMM_RHS ||
+                          op == GPU_OP_DIV_LHS_IMM ||
+                          op == GPU_OP_DIV_IMM_RHS ||
+                          op == GPU_OP_COPY_IMM);
+    if (has_imm) {
+        fprintf(f, " %-10g", IMM(&d));
+    } else {
+        fprintf(f, " %-10s", "");
+    }
+}
+
+void Profile::report(const Tape& tape, FILE* f, unsigned top) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    static const char* MODE_NAMES[NUM_MODES] = {"interval", "float", "deriv"};
+
+    // Map clauses in the original tape back to their index, so that counts
+    // from pruned tapes can be attributed to them.  Tape::Tape only emits
+    // flat tapes, so there are no jumps to follow.
+    CUDA_CHECK(cudaDeviceSynchronize());
+    std::unordered_map<uint64_t, int32_t> index;
+    for (int32_t i=1; i < tape.length && OP(&tape.data[i]); ++i) {
+        index.insert({tape.data[i], i});
+    }
+    auto find = [&](uint64_t d) {
+        auto itr = index.find(d);
+        if (itr != index.end()) {
+            return itr->second;
+        }
+        // push_tape rewrites min/max clauses that picked one branch into
+        // copies, keeping the rest of the clause, so try each min/max
+        const uint8_t op = OP(&d);
+        if (op == GPU_OP_COPY_LHS || op == GPU_OP_COPY_RHS ||
+            op == GPU_OP_COPY_IMM)
+        {
+            for (uint8_t m=GPU_OP_MIN_LHS_IMM; m <= GPU_OP_MAX_LHS_RHS; ++m) {
+                OP(&d) = m;
+                itr = index.find(d);
+                if (itr != index.end()) {
+                    return itr->second;
+                }
+            }
+        }
+        return -1;
+    };
+
+    // Totals for each clause in the original tape, across every stage, and
+    // interval choices for each clause in each stage
+    std::map<int32_t, ProfileEntry> totals;
+    std::vector<std::map<int32_t, ProfileEntry>> per_stage(
+            profile_stages.size());
+    unsigned long long unmatched = 0;
+    for (unsigned s=0; s < profile_stages.size(); ++s) {
+        for (auto& c : profile_stages[s].second.clauses) {
+            const int32_t i = find(c.first);
+            if (i == -1) {
+                for (unsigned m=0; m < NUM_MODES; ++m) {
+                    unmatched += c.second.count[m];
+                }
+                continue;
+            }
+            for (auto* t : {&totals[i], &per_stage[s][i]}) {
+                t->clause = tape.data[i];
+                for (unsigned m=0; m < NUM_MODES; ++m) {
+                    t->count[m] += c.second.count[m];
+                }
+                for (unsigned k=0; k < 3; ++k) {
+                    t->choice[k] += c.second.choice[k];
+                }
+            }
+        }
+    }
+
+    // Opcode histogram for each stage, from most to least executed
+    for (auto& s : profile_stages) {
+        fprintf(f, "==== %s ====\n", s.first.c_str());
+        fprintf(f, "%-12s %14s %14s %14s\n",
+                "opcode", MODE_NAMES[0], MODE_NAMES[1], MODE_NAMES[2]);
+        std::vector<std::pair<unsigned long long, unsigned>> ops;
+        for (unsigned i=0; i < PROFILE_NUM_OPS; ++i) {
+            unsigned long long sum = 0;
+            for (unsigned m=0; m < NUM_MODES; ++m) {
+                sum += s.second.ops[m][i];
+            }
+            if (sum) {
+                ops.push_back({sum, i});
+            }
+        }
+        std::sort(ops.rbegin(), ops.rend());
+        for (auto& o : ops) {
+            fprintf(f, "%-12s %14llu %14llu %14llu\n", gpu_op_str(o.second),
+                    s.second.ops[INTERVAL][o.second],
+                    s.second.ops[FLOAT][o.second],
+                    s.second.ops[DERIV][o.second]);
+        }
+        fprintf(f, "\n");
+    }
+
+    // Rank clauses by executions across every stage and mode
+    auto total = [](const ProfileEntry& e) {
+        unsigned long long sum = 0;
+        for (unsigned m=0; m < NUM_MODES; ++m) {
+            sum += e.count[m];
+        }
+        return sum;
+    };
+    std::vector<std::pair<unsigned long long, int32_t>> ranked;
+    for (auto& t : totals) {
+        ranked.push_back({total(t.second), t.first});
+    }
+    std::sort(ranked.rbegin(), ranked.rend());
+
+    fprintf(f, "==== Hottest clauses ====\n");
+    fprintf(f, "%6s %-35s %14s %14s %14s %14s\n", "index", "clause",
+            MODE_NAMES[0], MODE_NAMES[1], MODE_NAMES[2], "total");
+    for (unsigned r=0; r < ranked.size() && r < top; ++r) {
+        const auto& e = totals[ranked[r].second];
+        fprintf(f, "%6i ", ranked[r].second);
+        print_clause(f, e.clause);
+        fprintf(f, " %14llu %14llu %14llu %14llu\n",
+                e.count[INTERVAL], e.count[FLOAT], e.count[DERIV],
+                ranked[r].first);
+    }
+    if (unmatched) {
+        fprintf(f, "(%llu executions of clauses which weren't found in "
+                   "the tape)\n", unmatched);
+    }
+    fprintf(f, "\n");
+
+    // Min/max clauses, ranked by interval evaluations, with the fraction
+    // of evaluations in each stage which picked one branch
+    ranked.clear();
+    for (auto& t : totals) {
+        const uint8_t op = OP(&t.second.clause);
+        if (op >= GPU_OP_MIN_LHS_IMM && op <= GPU_OP_MAX_LHS_RHS) {
+            ranked.push_back({t.second.count[INTERVAL], t.first});
+        }
+    }
+    std::sort(ranked.rbegin(), ranked.rend());
+
+    fprintf(f, "==== Min/max pruning ====\n");
+    fprintf(f, "%6s %-35s %-16s %14s %7s %7s %7s\n", "index", "clause",
+            "stage", "evaluated", "both", "lhs", "rhs");
+    for (unsigned r=0; r < ranked.size() && r < top; ++r) {
+        for (unsigned s=0; s < profile_stages.size(); ++s) {
+            auto itr = per_stage[s].find(ranked[r].second);
+            if (itr == per_stage[s].end()) {
+                continue;
+            }
+            const auto& e = itr->second;
+            const unsigned long long n =
+                e.choice[0] + e.choice[1] + e.choice[2];
+            if (!n) {
+                continue;
+            }
+            fprintf(f, "%6i ", ranked[r].second);
+            print_clause(f, e.clause);
+            fprintf(f, " %-16s %14llu %6.1f%% %6.1f%% %6.1f%%\n",
+                    profile_stages[s].first.c_str(), n,
+                    100.0 * e.choice[0] / n,
+                    100.0 * e.choice[1] / n,
+                    100.0 * e.choice[2] / n);
+        }
+    }
+}
+
+#else   // !MPR_PROFILE
+
+void Profile::reset() {
+    // Nothing to do here
+}
+
+void Profile::collect(const char*) {
+    // Nothing to do here
+}
+
+void Profile::report(const Tape&, FILE* f, unsigned) {
+    fprintf(f, "Opcode profiling is disabled "
+               "(rebuild with -DMPR_PROFILE=ON)\n");
+}
+
+Profile::Stage::Stage(const char* name)
+    : name(name)
+{
+    // Nothing to do here
+}
+
+Profile::Stage::~Stage() {
+    // Nothing to do here
+}
+
+#endif
+
+}   // namespace mpr
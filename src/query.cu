@@ -0,0 +1,485 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstring>
+
+#include <cub/device/device_scan.cuh>
+
+#include "clause.hpp"
+#include "octree.hpp"
+#include "parameters.hpp"
+#include "query.hpp"
+
+#include "gpu_eval.hpp"
+#include "gpu_interval.hpp"
+#include "gpu_octree.hpp"
+
+using namespace mpr;
+
+/*
+ *  locate_points
+ *
+ *  Finds the deepest octree cell which contains each point, writing the
+ *  tape which should be used to evaluate it into `tapes` and the index of
+ *  its cell in the deepest level into `keys`.
+ *
+ *  If `classify` is true, points which land in an empty or filled cell are
+ *  written straight into `inside` and given a tape of -1, so that they're
+ *  skipped by the rest of the pipeline.  Otherwise, they keep the tape of
+ *  their deepest ambiguous ancestor.
+ *
+ *  Every point which still needs evaluation is counted in `counts`, which
+ *  has one entry per cell in the deepest level.
+ */
+__global__
+void locate_points(const float3* const __restrict__ points,
+                   const uint32_t count,
+
+                   const int32_t* const __restrict__ cells,
+                   const int32_t depth,
+                   const float3 lower,
+                   const float3 upper,
+
+                   const bool classify,
+                   uint8_t* const __restrict__ inside,
+                   int32_t* const __restrict__ tapes,
+                   int32_t* const __restrict__ keys,
+                   int32_t* const __restrict__ counts)
+{
+    const uint32_t index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (index >= count) {
+        return;
+    }
+
+    const float3 p = points[index];
+    const int32_t n = 1 << depth;
+    int32_t tape = 0;
+    int32_t state = 0;
+
+    // Written so that NaN points are never considered to be in the octree,
+    // in which case they fall back to the root tape.
+    const bool in_bounds = p.x >= lower.x && p.x <= upper.x &&
+                           p.y >= lower.y && p.y <= upper.y &&
+                           p.z >= lower.z && p.z <= upper.z;
+    int3 c = make_int3(0, 0, 0);
+    if (in_bounds) {
+        c = make_int3(octree_cell_coord(p.x, lower.x, upper.x, n),
+                      octree_cell_coord(p.y, lower.y, upper.y, n),
+                      octree_cell_coord(p.z, lower.z, upper.z, n));
+        for (int32_t level=0; level <= depth; ++level) {
+            const int32_t shift = depth - level;
+            const int3 cl = make_int3(c.x >> shift, c.y >> shift,
+                                      c.z >> shift);
+            const int32_t cell =
+                cells[octree_level_offset(level) + octree_pack(cl)];
+            if (cell < 0) {
+                state = cell;
+                break;
+            }
+            tape = cell;
+        }
+    }
+
+    if (classify && state < 0) {
+        inside[index] = (state == Octree::CELL_FILLED);
+        tapes[index] = -1;
+        return;
+    }
+
+    const int32_t key = octree_pack(c);
+    tapes[index] = tape;
+    keys[index] = key;
+    atomicAdd(&counts[key], 1);
+}
+
+/*
+ *  bucket_points
+ *
+ *  Scatters the index of every point which still needs evaluation into
+ *  `order`, grouped by the deepest cell which contains it.  `offsets` must
+ *  contain the exclusive prefix sum of the counts from locate_points, and
+ *  is advanced as points are written.
+ */
+__global__
+void bucket_points(const uint32_t count,
+                   const int32_t* const __restrict__ tapes,
+                   const int32_t* const __restrict__ keys,
+                   int32_t* const __restrict__ offsets,
+                   int32_t* const __restrict__ order)
+{
+    const uint32_t index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (index >= count || tapes[index] == -1) {
+        return;
+    }
+    order[atomicAdd(&offsets[keys[index]], 1)] = index;
+}
+
+/*
+ *  eval_points
+ *
+ *  Evaluates the points listed in `order`, using the tape stored for each
+ *  point.  Because `order` is sorted by octree cell, threads in the same
+ *  warp almost always share a tape, so they walk it in lockstep.
+ *
+ *  Results are written in the original point order, into whichever of
+ *  `inside`, `values`, or `gradients` is selected by MODE.
+ */
+template <unsigned MODE>
+__global__
+void eval_points(const uint64_t* const __restrict__ tape_data,
+                 const float3* const __restrict__ points,
+                 const int32_t* const __restrict__ tapes,
+                 const int32_t* const __restrict__ order,
+                 const uint32_t count,
+
+                 uint8_t* const __restrict__ inside,
+                 float* const __restrict__ values,
+                 float4* const __restrict__ gradients)
+{
+    const uint32_t index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (index >= count) {
+        return;
+    }
+    const int32_t i = order[index];
+    const float3 p = points[i];
+    const uint64_t* const data = &tape_data[tapes[i]];
+
+    if (MODE == 2) {
+        Deriv slots[128];
+        slots[((const uint8_t*)tape_data)[1]] = Deriv(p.x, 1.0f, 0.0f, 0.0f);
+        slots[((const uint8_t*)tape_data)[2]] = Deriv(p.y, 0.0f, 1.0f, 0.0f);
+        slots[((const uint8_t*)tape_data)[3]] = Deriv(p.z, 0.0f, 0.0f, 1.0f);
+        gradients[i] = walk_tape_d(data, slots).v;
+    } else {
+        float slots[128];
+        slots[((const uint8_t*)tape_data)[1]] = p.x;
+        slots[((const uint8_t*)tape_data)[2]] = p.y;
+        slots[((const uint8_t*)tape_data)[3]] = p.z;
+        const float v = walk_tape_f(data, slots);
+        if (MODE == 0) {
+            inside[i] = (v < 0.0f);
+        } else {
+            values[i] = v;
+        }
+    }
+}
+
+/*
+ *  clip_ray
+ *
+ *  Clips the ray segment [t0, t1] (along one axis) to the slab between
+ *  `lower` and `upper`.  The segment is left empty (t0 > t1) if the ray
+ *  misses the slab entirely.
+ */
+__device__ inline void clip_ray(const float o, const float d,
+                                const float lower, const float upper,
+                                float& t0, float& t1)
+{
+    if (d == 0.0f) {
+        if (o < lower || o > upper) {
+            t0 = INFINITY;
+        }
+    } else {
+        float ta = (lower - o) / d;
+        float tb = (upper - o) / d;
+        if (ta > tb) {
+            const float t = ta;
+            ta = tb;
+            tb = t;
+        }
+        t0 = fmaxf(t0, ta);
+        t1 = fminf(t1, tb);
+    }
+}
+
+// Maximum number of pending segments per ray.  Each bisection adds at most
+// one, so this supports rays up to 2^32 times longer than epsilon.
+#define RAY_STACK_SIZE 32
+
+/*
+ *  cast_rays
+ *
+ *  Casts one ray per thread.  The ray is clipped to the octree's bounds,
+ *  then searched front-to-back as a stack of segments: each segment's
+ *  bounding box is looked up in the octree (which picks the pruned tape for
+ *  that region, or proves it empty / filled), then evaluated with interval
+ *  arithmetic.  Ambiguous segments are bisected until they're shorter than
+ *  `epsilon`, at which point their endpoints are evaluated to confirm the
+ *  hit, and the normal is found with a Deriv pass.
+ *
+ *  Directions must be normalized.
+ */
+__global__
+void cast_rays(const uint64_t* const __restrict__ tape_data,
+               const int32_t* const __restrict__ cells,
+               const int32_t depth,
+               const float3 lower,
+               const float3 upper,
+
+               const float3* const __restrict__ origins,
+               const float3* const __restrict__ dirs,
+               const uint32_t count,
+               const float epsilon,
+
+               float4* const __restrict__ hits)
+{
+    const uint32_t index = threadIdx.x + blockIdx.x * blockDim.x;
+    if (index >= count) {
+        return;
+    }
+    hits[index] = make_float4(0.0f, 0.0f, 0.0f, -1.0f);
+
+    const float3 o = origins[index];
+    const float3 d = dirs[index];
+
+    float t0 = 0.0f;
+    float t1 = INFINITY;
+    clip_ray(o.x, d.x, lower.x, upper.x, t0, t1);
+    clip_ray(o.y, d.y, lower.y, upper.y, t0, t1);
+    clip_ray(o.z, d.z, lower.z, upper.z, t0, t1);
+    if (!(t0 <= t1)) {
+        return;
+    }
+
+    float2 stack[RAY_STACK_SIZE];
+    int sp = 0;
+    float2 seg = make_float2(t0, t1);
+
+    float t = -1.0f;
+    int32_t hit_tape = 0;
+    while (t < 0.0f) {
+        const Interval ts(seg.x, seg.y);
+        const Interval ix = ts * d.x + o.x;
+        const Interval iy = ts * d.y + o.y;
+        const Interval iz = ts * d.z + o.z;
+        const int32_t tape = octree_lookup(cells, depth, lower, upper,
+                                           ix, iy, iz);
+        bool empty = (tape == Octree::CELL_EMPTY);
+        bool filled = (tape == Octree::CELL_FILLED);
+        if (!empty && !filled) {
+            Interval slots[128];
+            slots[((const uint8_t*)tape_data)[1]] = ix;
+            slots[((const uint8_t*)tape_data)[2]] = iy;
+            slots[((const uint8_t*)tape_data)[3]] = iz;
+
+            uint32_t choices[CHOICE_ARRAY_SIZE] = {0};
+            int choice_index = 0;
+            bool has_any_choice = false;
+            const uint64_t* const end = walk_tape_i(
+                    &tape_data[tape], slots,
+                    choices, choice_index, has_any_choice);
+            const Interval result = slots[I_OUT(end)];
+            empty = result.lower() > 0.0f;
+            filled = result.upper() < 0.0f;
+        }
+
+        if (filled) {
+            // Segments are searched front-to-back, so the surface is at
+            // (or within epsilon before) the start of this segment.
+            t = seg.x;
+            hit_tape = (tape >= 0) ? tape : 0;
+            break;
+        } else if (!empty) {
+            if (seg.y - seg.x > epsilon && sp < RAY_STACK_SIZE) {
+                const float mid = (seg.x + seg.y) / 2.0f;
+                stack[sp++] = make_float2(mid, seg.y);
+                seg.y = mid;
+                continue;
+            }
+
+            // Confirm the hit with point evaluation, since intervals are
+            // conservative and may be ambiguous near (but off) the surface.
+            float slots[128];
+            slots[((const uint8_t*)tape_data)[1]] = o.x + d.x * seg.x;
+            slots[((const uint8_t*)tape_data)[2]] = o.y + d.y * seg.x;
+            slots[((const uint8_t*)tape_data)[3]] = o.z + d.z * seg.x;
+            const float fa = walk_tape_f(&tape_data[tape], slots);
+            slots[((const uint8_t*)tape_data)[1]] = o.x + d.x * seg.y;
+            slots[((const uint8_t*)tape_data)[2]] = o.y + d.y * seg.y;
+            slots[((const uint8_t*)tape_data)[3]] = o.z + d.z * seg.y;
+            const float fb = walk_tape_f(&tape_data[tape], slots);
+            if (fa <= 0.0f) {
+                t = seg.x;
+            } else if (fb <= 0.0f) {
+                t = seg.x + (seg.y - seg.x) * fa / (fa - fb);
+            }
+            hit_tape = tape;
+            if (t >= 0.0f) {
+                break;
+            }
+        }
+
+        if (sp == 0) {
+            return;
+        }
+        seg = stack[--sp];
+    }
+
+    Deriv slots[128];
+    slots[((const uint8_t*)tape_data)[1]] = Deriv(o.x + d.x * t, 1.0f, 0.0f, 0.0f);
+    slots[((const uint8_t*)tape_data)[2]] = Deriv(o.y + d.y * t, 0.0f, 1.0f, 0.0f);
+    slots[((const uint8_t*)tape_data)[3]] = Deriv(o.z + d.z * t, 0.0f, 0.0f, 1.0f);
+    const Deriv result = walk_tape_d(&tape_data[hit_tape], slots);
+    const float norm = sqrtf(powf(result.dx(), 2) +
+                             powf(result.dy(), 2) +
+                             powf(result.dz(), 2));
+    hits[index] = make_float4(result.dx() / norm,
+                              result.dy() / norm,
+                              result.dz() / norm, t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace mpr {
+
+Query::Query(const Octree& octree)
+    : octree(octree)
+{
+    // Nothing to do here
+}
+
+void Query::contains(const std::vector<Eigen::Vector3f>& pts) {
+    run(pts, QUERY_CONTAINS);
+}
+
+void Query::distance(const std::vector<Eigen::Vector3f>& pts) {
+    run(pts, QUERY_DISTANCE);
+}
+
+void Query::gradient(const std::vector<Eigen::Vector3f>& pts) {
+    run(pts, QUERY_GRADIENT);
+}
+
+void Query::resize(uint32_t count) {
+    // Resize all of the per-point buffers together
+    if (points_size < count) {
+        points.reset(CUDA_MALLOC(float3, count));
+        dirs.reset(CUDA_MALLOC(float3, count));
+        tapes.reset(CUDA_MALLOC(int32_t, count));
+        keys.reset(CUDA_MALLOC(int32_t, count));
+        order.reset(CUDA_MALLOC(int32_t, count));
+        inside.reset(CUDA_MALLOC(uint8_t, count));
+        values.reset(CUDA_MALLOC(float, count));
+        gradients.reset(CUDA_MALLOC(float4, count));
+        hits.reset(CUDA_MALLOC(float4, count));
+        points_size = count;
+    }
+}
+
+void Query::raycast(const std::vector<Eigen::Vector3f>& origins,
+                    const std::vector<Eigen::Vector3f>& ds,
+                    float epsilon)
+{
+    if (origins.size() != ds.size()) {
+        fprintf(stderr, "Mismatched ray origins (%zu) and directions (%zu)\n",
+                origins.size(), ds.size());
+        return;
+    }
+    const uint32_t count = origins.size();
+    if (count == 0) {
+        return;
+    }
+    resize(count);
+
+    for (uint32_t i=0; i < count; ++i) {
+        const Eigen::Vector3f d = ds[i].normalized();
+        points[i] = make_float3(origins[i].x(), origins[i].y(), origins[i].z());
+        dirs[i] = make_float3(d.x(), d.y(), d.z());
+    }
+
+    const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+    cast_rays<<<num_blocks, NUM_THREADS>>>(
+        octree.tape_data.get(),
+        octree.cells.get(), octree.depth,
+        make_float3(octree.lower.x(), octree.lower.y(), octree.lower.z()),
+        make_float3(octree.upper.x(), octree.upper.y(), octree.upper.z()),
+        points.get(), dirs.get(), count, epsilon,
+        hits.get());
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+}
+
+void Query::run(const std::vector<Eigen::Vector3f>& pts, Mode mode) {
+    const uint32_t count = pts.size();
+    num_evaluated = 0;
+    if (count == 0) {
+        return;
+    }
+
+    resize(count);
+    const uint32_t num_keys = 1u << (3 * octree.depth);
+    if (offsets_size < num_keys) {
+        counts.reset(CUDA_MALLOC_DEVICE(int32_t, num_keys));
+        offsets.reset(CUDA_MALLOC_DEVICE(int32_t, num_keys));
+        offsets_size = num_keys;
+    }
+
+    // Points are stored in unified memory, so we can copy them directly
+    for (uint32_t i=0; i < count; ++i) {
+        points[i] = make_float3(pts[i].x(), pts[i].y(), pts[i].z());
+    }
+    CUDA_CHECK(cudaMemsetAsync(counts.get(), 0, sizeof(int32_t) * num_keys));
+
+    const uint32_t num_blocks = (count + NUM_THREADS - 1) / NUM_THREADS;
+    locate_points<<<num_blocks, NUM_THREADS>>>(
+        points.get(), count,
+        octree.cells.get(), octree.depth,
+        make_float3(octree.lower.x(), octree.lower.y(), octree.lower.z()),
+        make_float3(octree.upper.x(), octree.upper.y(), octree.upper.z()),
+        mode == QUERY_CONTAINS,
+        inside.get(), tapes.get(), keys.get(), counts.get());
+
+    // Convert per-cell counts into starting offsets on the GPU, since there
+    // are millions of cells in deep octrees (and we'd otherwise migrate
+    // every one of them to the host and back).
+    size_t scan_bytes = 0;
+    CUDA_CHECK(cub::DeviceScan::ExclusiveSum(
+            nullptr, scan_bytes, counts.get(), offsets.get(),
+            (int)num_keys, cudaStreamPerThread));
+    if (scan_storage_size < scan_bytes) {
+        scan_storage.reset(CUDA_MALLOC_DEVICE(uint8_t, scan_bytes));
+        scan_storage_size = scan_bytes;
+    }
+    CUDA_CHECK(cub::DeviceScan::ExclusiveSum(
+            scan_storage.get(), scan_bytes, counts.get(), offsets.get(),
+            (int)num_keys, cudaStreamPerThread));
+
+    // The total is the last cell's offset plus its count
+    int32_t last_offset, last_count;
+    CUDA_CHECK(cudaMemcpyAsync(&last_offset, &offsets[num_keys - 1],
+                               sizeof(int32_t), cudaMemcpyDeviceToHost,
+                               cudaStreamPerThread));
+    CUDA_CHECK(cudaMemcpyAsync(&last_count, &counts[num_keys - 1],
+                               sizeof(int32_t), cudaMemcpyDeviceToHost,
+                               cudaStreamPerThread));
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+    const int32_t total = last_offset + last_count;
+    num_evaluated = total;
+    if (total == 0) {
+        return;
+    }
+
+    bucket_points<<<num_blocks, NUM_THREADS>>>(
+        count, tapes.get(), keys.get(), offsets.get(), order.get());
+
+    const uint32_t eval_blocks = (total + NUM_THREADS - 1) / NUM_THREADS;
+    switch (mode) {
+#define EVAL(m) eval_points<m><<<eval_blocks, NUM_THREADS>>>(             \
+            octree.tape_data.get(), points.get(), tapes.get(), order.get(), \
+            total, inside.get(), values.get(), gradients.get())
+        case QUERY_CONTAINS: EVAL(0); break;
+        case QUERY_DISTANCE: EVAL(1); break;
+        case QUERY_GRADIENT: EVAL(2); break;
+#undef EVAL
+    }
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+}
+
+}   // namespace mpr
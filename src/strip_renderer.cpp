@@ -0,0 +1,164 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "context.hpp"
+#include "strip_renderer.hpp"
+#include "tape.hpp"
+#include "trace.hpp"
+
+namespace mpr {
+
+// Returns the given devices, or every device if the list is empty
+static std::vector<int> check_devices(std::vector<int> devices) {
+    int count = 0;
+    CUDA_CHECK(cudaGetDeviceCount(&count));
+    if (devices.empty()) {
+        for (int i=0; i < count; ++i) {
+            devices.push_back(i);
+        }
+    }
+    auto bad = std::remove_if(devices.begin(), devices.end(),
+        [&](int d) {
+            if (d < 0 || d >= count) {
+                fprintf(stderr, "Invalid device %i (skipping)\n", d);
+                return true;
+            }
+            return false;
+        });
+    devices.erase(bad, devices.end());
+    if (devices.empty()) {
+        fprintf(stderr, "No valid devices (using device 0)\n");
+        devices.push_back(0);
+    }
+    return devices;
+}
+
+StripRenderer::StripRenderer(int32_t image_width_px, int32_t image_height_px,
+                             int32_t image_depth_px,
+                             std::vector<int> devices,
+                             int32_t strip_height_px)
+    : image_width_px(image_width_px),
+      image_height_px(image_height_px),
+      image_depth_px(image_depth_px),
+      image_size_px(std::max(image_width_px, image_height_px)),
+      strip_height_px(std::max(64, (strip_height_px + 63) / 64 * 64)),
+      image(CUDA_MALLOC(int32_t, image_width_px * image_height_px)),
+      normals(CUDA_MALLOC(uint32_t, image_width_px * image_height_px)),
+      devices(check_devices(devices)),
+      strips_rendered(this->devices.size(), 0)
+{
+    int prev = 0;
+    CUDA_CHECK(cudaGetDevice(&prev));
+    for (int d : this->devices) {
+        // The context's buffers are touched first on its own device
+        CUDA_CHECK(cudaSetDevice(d));
+        contexts.emplace_back(new Context(
+            image_width_px,
+            std::min(this->strip_height_px, image_height_px),
+            image_depth_px));
+    }
+    CUDA_CHECK(cudaSetDevice(prev));
+}
+
+StripRenderer::~StripRenderer() {
+    // Each context must be freed on its own device
+    int prev = 0;
+    CUDA_CHECK(cudaGetDevice(&prev));
+    for (unsigned i=0; i < contexts.size(); ++i) {
+        CUDA_CHECK(cudaSetDevice(devices[i]));
+        contexts[i].reset();
+    }
+    CUDA_CHECK(cudaSetDevice(prev));
+}
+
+template <typename F>
+void StripRenderer::run(F f, bool copy_normals) {
+    const int32_t num_strips =
+        (image_height_px + strip_height_px - 1) / strip_height_px;
+    std::atomic<int32_t> next(0);
+
+    std::vector<std::thread> threads;
+    for (unsigned i=0; i < devices.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            MPR_TRACE("strips");
+            CUDA_CHECK(cudaSetDevice(devices[i]));
+            Context& ctx = *contexts[i];
+            strips_rendered[i] = 0;
+
+            int32_t s;
+            while ((s = next++) < num_strips) {
+                const int32_t y0 = s * strip_height_px;
+                const int32_t h = std::min(strip_height_px,
+                                           image_height_px - y0);
+                ctx.resize(image_width_px, h, image_depth_px);
+
+                // Render space in the strip is [-1, 1] across its longer
+                // side, so we scale and shift it into the full image's
+                // render space (see TileGrid::x and TileGrid::y).
+                const float k = float(ctx.image_size_px) / image_size_px;
+                Eigen::Matrix4f strip = Eigen::Matrix4f::Identity();
+                strip(0, 0) = k;
+                strip(1, 1) = k;
+                strip(1, 3) = float(h + 2 * y0 - image_height_px) /
+                              image_size_px;
+                f(ctx, strip);
+
+                // Strips are whole rows, so they're contiguous in the
+                // full-size image.  This file isn't built by nvcc, so
+                // --default-stream per-thread doesn't apply here, and we
+                // pass the per-thread stream explicitly.
+                const size_t offset = size_t(y0) * image_width_px;
+                const size_t bytes = sizeof(int32_t) * image_width_px * h;
+                CUDA_CHECK(cudaMemcpyAsync(image.get() + offset,
+                                           ctx.stages[3].filled.get(),
+                                           bytes, cudaMemcpyDefault,
+                                           cudaStreamPerThread));
+                if (copy_normals) {
+                    CUDA_CHECK(cudaMemcpyAsync(normals.get() + offset,
+                                               ctx.normals.get(),
+                                               bytes, cudaMemcpyDefault,
+                                           cudaStreamPerThread));
+                }
+                CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+                strips_rendered[i]++;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void StripRenderer::render3D(const Tape& tape, const Eigen::Matrix4f& mat) {
+    MPR_TRACE("StripRenderer::render3D");
+    run([&](Context& ctx, const Eigen::Matrix4f& strip) {
+        ctx.render3D(tape, mat * strip);
+    }, true);
+}
+
+void StripRenderer::render2D(const Tape& tape, const Eigen::Matrix3f& mat,
+                             const float z)
+{
+    MPR_TRACE("StripRenderer::render2D");
+    run([&](Context& ctx, const Eigen::Matrix4f& strip) {
+        // Drop the Z row and column, which 2D rendering doesn't use
+        Eigen::Matrix3f s = Eigen::Matrix3f::Identity();
+        s.topLeftCorner<2, 2>() = strip.topLeftCorner<2, 2>();
+        s.topRightCorner<2, 1>() = strip.topRightCorner<2, 1>();
+        ctx.render2D(tape, mat * s, z);
+    }, false);
+}
+
+}   // namespace mpr
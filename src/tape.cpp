@@ -9,80 +9,286 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 Copyright (C) 2019-2020  Matt Keeter
 */
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <thread>
+
 #include "libfive/tree/tree.hpp"
-#include "libfive/tree/cache.hpp"
 
 #include "clause.hpp"
 #include "tape.hpp"
+#include "trace.hpp"
 #include "gpu_opcode.hpp"
+#include "parameters.hpp"
 
 namespace mpr {
 
-Tape::Tape(const libfive::Tree& tree) {
-    // Hold a single cache lock to avoid needing mutex locks everywhere
-    auto lock = libfive::Cache::instance();
+/*
+ *  Maps tree nodes to their index in DFS order.
+ *
+ *  This is a flat hash table with open addressing, so inserting a node
+ *  doesn't allocate (unlike a std::map, which allocates once per node).
+ */
+struct NodeTable {
+    NodeTable() : keys(1024, nullptr), values(1024), count(0), shift(54) {}
 
-    auto ordered = tree.orderedDfs();
-    std::vector<libfive::Tree::Id> ordered_fast;
-    ordered_fast.reserve(ordered.size());
+    // Returns the node's index, or -1 if it isn't in the table
+    int32_t find(libfive::Tree::Id id) const {
+        const size_t mask = keys.size() - 1;
+        for (size_t i=hash(id); keys[i] != nullptr; i = (i + 1) & mask) {
+            if (keys[i] == id) {
+                return values[i];
+            }
+        }
+        return -1;
+    }
 
-    std::map<libfive::Tree::Id, libfive::Tree::Id> last_used;
-    libfive::Tree::Id axes_used[3] = {nullptr};
-    for (auto& c : ordered) {
-        using namespace libfive::Opcode;
-        // Very simple tracking of active spans, without clause reordering
-        // or any other cleverness.
-        switch (c->op) {
-            case CONSTANT: continue;
-            case VAR_X: axes_used[0] = c.id(); break;
-            case VAR_Y: axes_used[1] = c.id(); break;
-            case VAR_Z: axes_used[2] = c.id(); break;
-
-            // Opcodes which take two arguments store their RHS
-            case OP_ADD:
-            case OP_MUL:
-            case OP_MIN:
-            case OP_MAX:
-            case OP_SUB:
-            case OP_DIV:    last_used[c.rhs().id()] = c.id();
-                            // FALLTHROUGH
-
-            // Unary opcodes (and fallthrough) store their LHS)
-            case OP_SQUARE:
-            case OP_SQRT:
-            case OP_NEG:
-            case OP_SIN:
-            case OP_COS:
-            case OP_ASIN:
-            case OP_ACOS:
-            case OP_ATAN:
-            case OP_EXP:
-            case OP_ABS:
-            case OP_LOG:    last_used[c.lhs().id()] = c.id();
-                            ordered_fast.push_back(c.id());
-                            break;
-            default:    break;
+    // Inserts a node, which must not already be in the table
+    void insert(libfive::Tree::Id id, int32_t index) {
+        if (2 * (count + 1) > keys.size()) {
+            grow();
+        }
+        const size_t mask = keys.size() - 1;
+        size_t i = hash(id);
+        while (keys[i] != nullptr) {
+            i = (i + 1) & mask;
+        }
+        keys[i] = id;
+        values[i] = index;
+        count++;
+    }
+
+protected:
+    // Fibonacci hashing, which picks the top bits of the product
+    size_t hash(libfive::Tree::Id id) const {
+        return ((uint64_t)(uintptr_t)id * 11400714819323198485ull) >> shift;
+    }
+
+    void grow() {
+        std::vector<libfive::Tree::Id> old_keys(keys.size() * 2, nullptr);
+        std::vector<int32_t> old_values(values.size() * 2);
+        std::swap(keys, old_keys);
+        std::swap(values, old_values);
+        count = 0;
+        shift--;
+        for (size_t i=0; i < old_keys.size(); ++i) {
+            if (old_keys[i] != nullptr) {
+                insert(old_keys[i], old_values[i]);
+            }
+        }
+    }
+
+    std::vector<libfive::Tree::Id> keys;
+    std::vector<int32_t> values;
+    size_t count;
+    unsigned shift;
+};
+
+/*
+ *  Appends every node reachable from `root` that isn't already in `table`
+ *  to `order`, in post-order (i.e. after its children), and adds it to the
+ *  table with its index in `order`.
+ *
+ *  This only borrows raw pointers from the tree, so it doesn't touch any
+ *  reference counts (and doesn't need to hold the libfive::Cache lock).
+ */
+static void ordered_dfs(libfive::Tree::Id root, NodeTable& table,
+                        std::vector<libfive::Tree::Id>& order)
+{
+    // Each stack entry stores a node and whether its children are done
+    std::vector<std::pair<libfive::Tree::Id, bool>> todo;
+    todo.push_back({root, false});
+    while (todo.size()) {
+        const auto t = todo.back();
+        todo.pop_back();
+
+        // Nodes may be pushed more than once before they're expanded, but
+        // (since the tree is acyclic) the first copy to be expanded is
+        // always finished before we pop the next.
+        if (!t.second && table.find(t.first) != -1) {
+            continue;
+        }
+        const auto lhs = t.first->lhs.get();
+        const auto rhs = t.first->rhs.get();
+        if (t.second || (lhs == nullptr && rhs == nullptr)) {
+            table.insert(t.first, order.size());
+            order.push_back(t.first);
+        } else {
+            todo.push_back({t.first, true});
+            if (rhs != nullptr && table.find(rhs) == -1) {
+                todo.push_back({rhs, false});
+            }
+            if (lhs != nullptr && table.find(lhs) == -1) {
+                todo.push_back({lhs, false});
+            }
+        }
+    }
+}
+
+/*
+ *  Runs ordered_dfs on a set of subtrees in parallel, then merges their
+ *  results into `table` and `order` (skipping nodes that were found by more
+ *  than one thread).  The merged order is still valid, since each node's
+ *  children appear either earlier in its own thread's results or in the
+ *  results of an earlier thread.
+ */
+static void parallel_dfs(libfive::Tree::Id root, unsigned threads,
+                         NodeTable& table,
+                         std::vector<libfive::Tree::Id>& order)
+{
+    // Split the top of the tree into at least `threads` subtrees, always
+    // expanding the tallest remaining subtree.
+    std::vector<libfive::Tree::Id> subtrees = {root};
+    while (subtrees.size() < threads) {
+        auto best = subtrees.end();
+        for (auto itr = subtrees.begin(); itr != subtrees.end(); ++itr) {
+            if ((*itr)->lhs.get() != nullptr &&
+                (best == subtrees.end() || (*itr)->rank > (*best)->rank))
+            {
+                best = itr;
+            }
+        }
+        if (best == subtrees.end()) {
+            break;
+        }
+        const auto n = *best;
+        subtrees.erase(best);
+        for (auto c : {n->lhs.get(), n->rhs.get()}) {
+            if (c != nullptr &&
+                std::find(subtrees.begin(), subtrees.end(), c) == subtrees.end())
+            {
+                subtrees.push_back(c);
+            }
+        }
+    }
+
+    std::vector<NodeTable> tables(subtrees.size());
+    std::vector<std::vector<libfive::Tree::Id>> orders(subtrees.size());
+    std::vector<std::thread> workers;
+    for (unsigned i=0; i < subtrees.size(); ++i) {
+        workers.emplace_back([&, i]() {
+            MPR_TRACE("dfs (worker)");
+            ordered_dfs(subtrees[i], tables[i], orders[i]);
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    for (auto& o : orders) {
+        for (auto n : o) {
+            if (table.find(n) == -1) {
+                table.insert(n, order.size());
+                order.push_back(n);
+            }
+        }
+    }
+
+    // Add the nodes above the subtrees, which weren't visited by any thread
+    ordered_dfs(root, table, order);
+}
+
+// Pseudo-opcode for the nodes which are added above each output of a
+// multi-output tape, to tag its value with the output's index
+static const int32_t TAG_OUTPUT = libfive::Opcode::LAST_OP + 1;
+
+static bool is_clause(int32_t op) {
+    using namespace libfive::Opcode;
+    if (op == TAG_OUTPUT) {
+        return true;
+    }
+    switch (op) {
+        case OP_ADD:
+        case OP_MUL:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_SUB:
+        case OP_DIV:
+        case OP_SQUARE:
+        case OP_SQRT:
+        case OP_NEG:
+        case OP_SIN:
+        case OP_COS:
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        case OP_EXP:
+        case OP_ABS:
+        case OP_LOG:
+        case VAR_FREE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ *  Builds a flat tape from groups of clauses, which are indices into `nodes`
+ *  and must be topologically sorted (both within each group and across
+ *  groups).  A marker clause is placed between each pair of groups:
+ *  GPU_OP_MARK_X after the first group, then GPU_OP_MARK_XY after the second.
+ *
+ *  `ops` and `values` store each node's opcode and constant value (or
+ *  output index, for TAG_OUTPUT nodes).  `lhs` and `rhs` store the index of
+ *  each node's children (or -1), `axes` stores the index of the X, Y, Z
+ *  nodes (or -1 if they're unused), and `root` is the index of the node
+ *  whose value is the tape's result.
+ *
+ *  Free variables are loaded with GPU_OP_COPY_IMM clauses; the position of
+ *  each such clause in the tape is stored in `vars`.
+ *
+ *  Returns the number of slots used by the tape, or 0 if it would need more
+ *  than `max_slots` (in which case the tape is invalid).
+ */
+static unsigned build_flat(
+        const std::vector<std::vector<int32_t>>& groups,
+        const std::vector<libfive::Tree::Id>& nodes,
+        const std::vector<int32_t>& ops,
+        const std::vector<float>& values,
+        const std::vector<int32_t>& lhs,
+        const std::vector<int32_t>& rhs,
+        const int32_t axes[3],
+        const int32_t root,
+        const unsigned max_slots,
+        std::vector<uint64_t>& flat,
+        std::map<const void*, int32_t>& vars)
+{
+    using namespace libfive::Opcode;
+
+    // Find the last clause which uses each node, as a position in the tape
+    std::vector<int32_t> last_used(nodes.size(), -1);
+    int32_t pos = 0;
+    for (auto& g : groups) {
+        for (auto c : g) {
+            if (lhs[c] != -1) {
+                last_used[lhs[c]] = pos;
+            }
+            if (rhs[c] != -1) {
+                last_used[rhs[c]] = pos;
+            }
+            pos++;
         }
     }
 
     std::vector<uint8_t> free_slots;
-    std::map<libfive::Tree::Id, uint8_t> bound_slots;
-    uint8_t num_slots = 1;
+    std::vector<uint8_t> bound_slots(nodes.size(), 0);
+    unsigned num_slots = 1;
+    bool overflow = false;
 
-    auto getSlot = [&](libfive::Tree::Id id) {
+    auto getSlot = [&](int32_t i) {
         // Pick a slot for the output of this opcode
         uint8_t out = 0;
         if (free_slots.size()) {
             out = free_slots.back();
             free_slots.pop_back();
+        } else if (num_slots == max_slots) {
+            overflow = true;
         } else {
-            if (num_slots == UINT8_MAX) {
-                fprintf(stderr, "Ran out of slots!\n");
-            } else {
-                out = num_slots++;
-            }
+            out = num_slots++;
         }
-        bound_slots[id] = out;
+        bound_slots[i] = out;
         return out;
     };
 
@@ -90,136 +296,436 @@ Tape::Tape(const libfive::Tree& tree) {
     // before beginning an evaluation.
     uint64_t start = 0;
     for (unsigned i=0; i < 3; ++i) {
-        if (axes_used[i] != nullptr) {
-            ((uint8_t*)&start)[i + 1] = getSlot(axes_used[i]);
+        if (axes[i] != -1) {
+            ((uint8_t*)&start)[i + 1] = getSlot(axes[i]);
         }
     }
-    std::vector<uint64_t> flat;
-    flat.reserve(ordered.size());
+    if (groups.size() > 1) {
+        TAPE_FLAGS(&start) |= TAPE_FLAG_MARKERS;
+    }
+    flat.clear();
     flat.push_back(start);
+    vars.clear();
 
-    auto get_reg = [&](const std::shared_ptr<libfive::Tree::Tree_>& tree) {
-        auto itr = bound_slots.find(tree.get());
-        if (itr != bound_slots.end()) {
-            return itr->second;
-        } else {
-            fprintf(stderr, "Could not find bound slots %i\n", tree->op);
-            return static_cast<uint8_t>(0);
+    auto get_reg = [&](int32_t i) {
+        if (!bound_slots[i] && !overflow) {
+            fprintf(stderr, "Could not find bound slots %i\n", ops[i]);
         }
+        return bound_slots[i];
     };
 
-    for (auto& c : ordered_fast) {
-        uint64_t clause = 0;
-        switch (c->op) {
-            using namespace libfive::Opcode;
-
-            case CONSTANT:
-            case VAR_X:
-            case VAR_Y:
-            case VAR_Z:
-                continue;
-
+    pos = 0;
+    for (unsigned g=0; g < groups.size(); ++g) {
+        if (g) {
+            uint64_t marker = 0;
+            OP(&marker) = (g == 1) ? GPU_OP_MARK_X : GPU_OP_MARK_XY;
+            flat.push_back(marker);
+        }
+        for (auto c : groups[g]) {
+            const auto n = nodes[c];
+            uint64_t clause = 0;
+            switch (ops[c]) {
 #define OP_UNARY(p) \
-            case OP_##p: { \
-                OP(&clause) = GPU_OP_##p##_LHS;      \
-                I_LHS(&clause) = get_reg(c->lhs);    \
-                break;                              \
-            }
-            OP_UNARY(SQUARE)
-            OP_UNARY(SQRT);
-            OP_UNARY(NEG);
-            OP_UNARY(SIN);
-            OP_UNARY(COS);
-            OP_UNARY(ASIN);
-            OP_UNARY(ACOS);
-            OP_UNARY(ATAN);
-            OP_UNARY(EXP);
-            OP_UNARY(ABS);
-            OP_UNARY(LOG);
+                case OP_##p: { \
+                    OP(&clause) = GPU_OP_##p##_LHS;      \
+                    I_LHS(&clause) = get_reg(lhs[c]);    \
+                    break;                              \
+                }
+                OP_UNARY(SQUARE)
+                OP_UNARY(SQRT);
+                OP_UNARY(NEG);
+                OP_UNARY(SIN);
+                OP_UNARY(COS);
+                OP_UNARY(ASIN);
+                OP_UNARY(ACOS);
+                OP_UNARY(ATAN);
+                OP_UNARY(EXP);
+                OP_UNARY(ABS);
+                OP_UNARY(LOG);
 
 #define OP_COMMUTATIVE(p) \
-            case OP_##p: { \
-                if (c->lhs->op == CONSTANT) {                   \
-                    OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
-                    I_LHS(&clause) = get_reg(c->rhs);           \
-                    IMM(&clause) = c->lhs->value;               \
-                } else if (c->rhs->op == CONSTANT) {            \
-                    OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
-                    I_LHS(&clause) = get_reg(c->lhs);           \
-                    IMM(&clause) = c->rhs->value;               \
-                } else {                                        \
-                    OP(&clause) = GPU_OP_##p##_LHS_RHS;         \
-                    I_LHS(&clause) = get_reg(c->lhs);           \
-                    I_RHS(&clause) = get_reg(c->rhs);           \
-                }                                               \
-                break;                                          \
-            }
-            OP_COMMUTATIVE(ADD)
-            OP_COMMUTATIVE(MUL)
-            OP_COMMUTATIVE(MIN)
-            OP_COMMUTATIVE(MAX)
+                case OP_##p: { \
+                    if (ops[lhs[c]] == CONSTANT) {                  \
+                        OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
+                        I_LHS(&clause) = get_reg(rhs[c]);           \
+                        IMM(&clause) = values[lhs[c]];              \
+                    } else if (ops[rhs[c]] == CONSTANT) {           \
+                        OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
+                        I_LHS(&clause) = get_reg(lhs[c]);           \
+                        IMM(&clause) = values[rhs[c]];              \
+                    } else {                                        \
+                        OP(&clause) = GPU_OP_##p##_LHS_RHS;         \
+                        I_LHS(&clause) = get_reg(lhs[c]);           \
+                        I_RHS(&clause) = get_reg(rhs[c]);           \
+                    }                                               \
+                    break;                                          \
+                }
+                OP_COMMUTATIVE(ADD)
+                OP_COMMUTATIVE(MUL)
+                OP_COMMUTATIVE(MIN)
+                OP_COMMUTATIVE(MAX)
 
 #define OP_NONCOMMUTATIVE(p) \
-            case OP_##p: { \
-                if (c->lhs->op == CONSTANT) {                   \
-                    OP(&clause) = GPU_OP_##p##_IMM_RHS;         \
-                    I_RHS(&clause) = get_reg(c->rhs);           \
-                    IMM(&clause) = c->lhs->value;               \
-                } else if (c->rhs->op == CONSTANT) {            \
-                    OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
-                    I_LHS(&clause) = get_reg(c->lhs);           \
-                    IMM(&clause) = c->rhs->value;               \
-                } else {                                        \
-                    OP(&clause) = GPU_OP_##p##_LHS_RHS;         \
-                    I_LHS(&clause) = get_reg(c->lhs);           \
-                    I_RHS(&clause) = get_reg(c->rhs);           \
-                }                                               \
-                break;                                          \
-            }
-            OP_NONCOMMUTATIVE(SUB)
-            OP_NONCOMMUTATIVE(DIV)
-
-            case INVALID:
-            case OP_TAN:
-            case OP_RECIP:
-            case OP_ATAN2:
-            case OP_POW:
-            case OP_NTH_ROOT:
-            case OP_MOD:
-            case OP_NANFILL:
-            case OP_COMPARE:
-            case VAR_FREE:
-            case CONST_VAR:
-            case ORACLE:
-            case LAST_OP:
-                fprintf(stderr, "Unimplemented opcode");
-                break;
-        }
+                case OP_##p: { \
+                    if (ops[lhs[c]] == CONSTANT) {                  \
+                        OP(&clause) = GPU_OP_##p##_IMM_RHS;         \
+                        I_RHS(&clause) = get_reg(rhs[c]);           \
+                        IMM(&clause) = values[lhs[c]];              \
+                    } else if (ops[rhs[c]] == CONSTANT) {           \
+                        OP(&clause) = GPU_OP_##p##_LHS_IMM;         \
+                        I_LHS(&clause) = get_reg(lhs[c]);           \
+                        IMM(&clause) = values[rhs[c]];              \
+                    } else {                                        \
+                        OP(&clause) = GPU_OP_##p##_LHS_RHS;         \
+                        I_LHS(&clause) = get_reg(lhs[c]);           \
+                        I_RHS(&clause) = get_reg(rhs[c]);           \
+                    }                                               \
+                    break;                                          \
+                }
+                OP_NONCOMMUTATIVE(SUB)
+                OP_NONCOMMUTATIVE(DIV)
 
-        // Release slots if this was their last use.  We do this now so
-        // that one of them can be reused for the output slots below.
-        for (auto& h : {c->lhs.get(), c->rhs.get()}) {
-            if (h != nullptr &&
-                h->op != libfive::Opcode::CONSTANT &&
-                last_used[h] == c)
-            {
-                auto itr = bound_slots.find(h);
-                free_slots.push_back(itr->second);
-                bound_slots.erase(itr);
+                case TAG_OUTPUT: {
+                    OP(&clause) = GPU_OP_TAG_LHS;
+                    OUTPUT_INDEX(&clause) = values[c];
+                    if (ops[lhs[c]] == CONSTANT) {
+                        // Constant shapes don't have a slot, so we load the
+                        // constant first, then tag it in place (releasing
+                        // the slot so that it's reused for the output).
+                        uint64_t copy = 0;
+                        OP(&copy) = GPU_OP_COPY_IMM;
+                        IMM(&copy) = values[lhs[c]];
+                        I_OUT(&copy) = getSlot(c);
+                        flat.push_back(copy);
+                        I_LHS(&clause) = bound_slots[c];
+                        free_slots.push_back(bound_slots[c]);
+                        bound_slots[c] = 0;
+                    } else {
+                        I_LHS(&clause) = get_reg(lhs[c]);
+                    }
+                    break;
+                }
+
+                // Free variables are loaded as immediates, which can be
+                // changed in place (see Tape::setVar).  They start at 0.
+                case VAR_FREE: {
+                    OP(&clause) = GPU_OP_COPY_IMM;
+                    vars[n] = flat.size();
+                    break;
+                }
+
+                default:
+                    fprintf(stderr, "Unimplemented opcode");
+                    break;
+            }
+
+            // Release slots if this was their last use.  We do this now so
+            // that one of them can be reused for the output slots below.
+            for (auto h : {lhs[c], rhs[c]}) {
+                if (h != -1 && ops[h] != CONSTANT &&
+                    last_used[h] == pos && bound_slots[h])
+                {
+                    free_slots.push_back(bound_slots[h]);
+                    bound_slots[h] = 0;
+                }
             }
-        }
 
-        I_OUT(&clause) = getSlot(c);
-        flat.push_back(clause);
+            I_OUT(&clause) = getSlot(c);
+            flat.push_back(clause);
+            pos++;
+        }
     }
 
     {   // Push the end of the tape, which points to the final clauses's
         // output slot so that we know where to read the result.
+        if (ops[root] == CONSTANT) {
+            uint64_t clause = 0;
+            OP(&clause) = GPU_OP_COPY_IMM;
+            IMM(&clause) = values[root];
+            I_OUT(&clause) = getSlot(root);
+            flat.push_back(clause);
+        }
         uint64_t end = 0;
-        I_OUT(&end) = get_reg(ordered.back().operator->());
+        I_OUT(&end) = get_reg(root);
         flat.push_back(end);
     }
 
+    return overflow ? 0 : num_slots;
+}
+
+/*
+ *  Reorders nodes to reduce the number of slots that are live at once.
+ *
+ *  This is a depth-first traversal (so each subtree stays contiguous, apart
+ *  from nodes that are shared with earlier subtrees) which visits the child
+ *  with the larger Sethi-Ullman number first.  The returned order lists
+ *  every node reachable from the given roots which isn't already marked in
+ *  `done`, after all of its children.
+ */
+static std::vector<int32_t> schedule_nodes(const std::vector<int32_t>& lhs,
+                                           const std::vector<int32_t>& rhs,
+                                           const std::vector<uint8_t>& need,
+                                           const std::vector<int32_t>& roots,
+                                           std::vector<bool>& done)
+{
+    std::vector<int32_t> order;
+    std::vector<std::pair<int32_t, bool>> todo;
+    for (auto r : roots) {
+        todo.push_back({r, false});
+        while (todo.size()) {
+            const auto t = todo.back();
+            todo.pop_back();
+            if (t.second) {
+                order.push_back(t.first);
+                continue;
+            } else if (done[t.first]) {
+                continue;
+            }
+            done[t.first] = true;
+            todo.push_back({t.first, true});
+
+            // The stack is LIFO, so push the child to visit first last
+            int32_t first = lhs[t.first];
+            int32_t second = rhs[t.first];
+            if (second != -1 && need[second] > need[first]) {
+                std::swap(first, second);
+            }
+            for (auto c : {second, first}) {
+                if (c != -1 && !done[c]) {
+                    todo.push_back({c, false});
+                }
+            }
+        }
+    }
+    return order;
+}
+
+Tape::Tape(const libfive::Tree& tree, unsigned threads, bool schedule)
+    : Tape(std::vector<libfive::Tree>{tree}, threads, schedule)
+{
+    // Nothing to do here
+}
+
+Tape::Tape(const std::vector<libfive::Tree>& shapes, unsigned threads,
+           bool schedule)
+    : num_outputs(shapes.size())
+{
+    MPR_TRACE("Tape");
+
+    // Find every node in the trees, in an order where each node comes after
+    // its children.  Nodes are then referred to by their index in this
+    // order, so that the rest of tape construction can use flat arrays
+    // rather than maps.
+    NodeTable table;
+    std::vector<libfive::Tree::Id> nodes;
+    for (auto& t : shapes) {
+        MPR_TRACE("dfs");
+        if (threads > 1) {
+            parallel_dfs(t.id(), threads, table, nodes);
+        } else {
+            ordered_dfs(t.id(), table, nodes);
+        }
+    }
+
+    std::vector<int32_t> ops(nodes.size());
+    std::vector<float> values(nodes.size());
+    std::vector<int32_t> lhs(nodes.size(), -1);
+    std::vector<int32_t> rhs(nodes.size(), -1);
+    std::vector<uint8_t> axis_deps(nodes.size(), 0);
+
+    // need[i] is the Sethi-Ullman number of each node, i.e. the number of
+    // slots needed to evaluate it (treating the tree as if it had no
+    // shared subexpressions).  Constants are stored as immediates, so they
+    // don't need a slot.
+    std::vector<uint8_t> need(nodes.size(), 0);
+
+    // CONST_VAR only matters when solving for free variables, so it's an
+    // alias for its child.  alias[i] is the node that actually computes
+    // node i's value, and children are always looked up through it.
+    std::vector<int32_t> alias(nodes.size());
+
+    // Records a node's children, propagating axis dependencies and need
+    auto link = [&](int32_t i, int32_t a, int32_t b) {
+        alias[i] = i;
+        if (a != -1) {
+            lhs[i] = alias[a];
+            axis_deps[i] |= axis_deps[lhs[i]];
+            need[i] = std::max<uint8_t>(1, need[lhs[i]]);
+        }
+        if (b != -1) {
+            rhs[i] = alias[b];
+            axis_deps[i] |= axis_deps[rhs[i]];
+            const uint8_t x = need[lhs[i]];
+            const uint8_t y = need[rhs[i]];
+            need[i] = (x == y) ? std::min(x + 1, UINT8_MAX)
+                               : std::max<uint8_t>(x, y);
+        }
+    };
+
+    int32_t axes[3] = {-1, -1, -1};
+    for (unsigned i=0; i < nodes.size(); ++i) {
+        using namespace libfive::Opcode;
+        const auto n = nodes[i];
+        ops[i] = n->op;
+        values[i] = n->value;
+        link(i, n->lhs.get() ? table.find(n->lhs.get()) : -1,
+                n->rhs.get() ? table.find(n->rhs.get()) : -1);
+        switch (n->op) {
+            case VAR_X: axes[0] = i; axis_deps[i] = 1; need[i] = 1; break;
+            case VAR_Y: axes[1] = i; axis_deps[i] = 2; need[i] = 1; break;
+            case VAR_Z: axes[2] = i; axis_deps[i] = 4; need[i] = 1; break;
+            case VAR_FREE: need[i] = 1; break;
+            case CONST_VAR: alias[i] = lhs[i]; break;
+            case CONSTANT: break;
+            default:
+                if (!is_clause(n->op)) {
+                    fprintf(stderr, "Unimplemented opcode");
+                }
+                break;
+        }
+    }
+
+    // Appends a new node which isn't part of any libfive tree
+    auto add_node = [&](int32_t op, float value, int32_t a, int32_t b) {
+        const int32_t i = nodes.size();
+        nodes.push_back(nullptr);
+        ops.push_back(op);
+        values.push_back(value);
+        lhs.push_back(-1);
+        rhs.push_back(-1);
+        axis_deps.push_back(0);
+        need.push_back(0);
+        alias.push_back(i);
+        link(i, a, b);
+        return i;
+    };
+
+    // Multiple outputs are combined into a single result by tagging each
+    // one with its index, then taking the min of the tagged values.  This
+    // means that normal interval pruning drops outputs which can't be the
+    // frontmost (or inside) shape in a particular tile.
+    int32_t root = -1;
+    if (shapes.size() == 1) {
+        root = alias[nodes.size() - 1];
+    } else if (shapes.size() > 1) {
+        std::vector<int32_t> outputs;
+        for (unsigned i=0; i < shapes.size(); ++i) {
+            outputs.push_back(add_node(TAG_OUTPUT, i,
+                                       table.find(shapes[i].id()), -1));
+        }
+        // Build a balanced tree of min clauses, to keep slot usage low
+        while (outputs.size() > 1) {
+            std::vector<int32_t> next;
+            for (unsigned i=0; i + 1 < outputs.size(); i += 2) {
+                next.push_back(add_node(libfive::Opcode::OP_MIN, 0.0f,
+                                        outputs[i], outputs[i + 1]));
+            }
+            if (outputs.size() % 2) {
+                next.push_back(outputs.back());
+            }
+            outputs.swap(next);
+        }
+        root = outputs[0];
+    } else {
+        fprintf(stderr, "Cannot build a tape without any shapes\n");
+        root = add_node(libfive::Opcode::CONSTANT, 1.0f, -1, -1);
+    }
+
+    // When scheduling, clauses are first sorted into groups by the axes
+    // that they depend on: [0] depends on X (or nothing), [1] depends on Y
+    // but not Z, and [2] depends on Z.  Leaf evaluators which sample along
+    // Y (in 2D) or Z (in 3D) can then evaluate the earlier groups once per
+    // row or column.  A clause's arguments never depend on more axes than
+    // the clause itself, so each group is scheduled on its own, starting
+    // from the clauses whose values are used by a later group (or the
+    // root); earlier groups are already done, so they're never revisited.
+    std::vector<std::vector<int32_t>> groups;
+    if (schedule) {
+        MPR_TRACE("schedule");
+        auto group_of = [&](int32_t i) {
+            const uint8_t d = axis_deps[i];
+            return (d & 4) ? 2 : (d & 2) ? 1 : 0;
+        };
+        std::vector<std::vector<int32_t>> roots(3);
+        std::vector<bool> is_root(nodes.size(), false);
+        for (unsigned i=0; i < nodes.size(); ++i) {
+            if (!is_clause(ops[i])) {
+                continue;
+            }
+            for (auto c : {lhs[i], rhs[i]}) {
+                if (c != -1 && !is_root[c] && is_clause(ops[c]) &&
+                    group_of(c) < group_of(i))
+                {
+                    is_root[c] = true;
+                    roots[group_of(c)].push_back(c);
+                }
+            }
+        }
+        if (!is_root[root]) {
+            roots[group_of(root)].push_back(root);
+        }
+
+        std::vector<bool> done(nodes.size(), false);
+        groups.resize(3);
+        for (unsigned g=0; g < 3; ++g) {
+            // Values from each group stay live until a later group uses
+            // them, so the roots are visited in Sethi-Ullman order too.
+            std::stable_sort(roots[g].begin(), roots[g].end(),
+                [&](int32_t a, int32_t b) { return need[a] > need[b]; });
+            for (auto i : schedule_nodes(lhs, rhs, need, roots[g], done)) {
+                if (is_clause(ops[i])) {
+                    groups[g].push_back(i);
+                }
+            }
+        }
+    } else {
+        groups.resize(1);
+        for (unsigned i=0; i < nodes.size(); ++i) {
+            if (is_clause(ops[i])) {
+                groups[0].push_back(i);
+            }
+        }
+    }
+
+    // Build the tape with its clauses sorted into groups.  Sorting can
+    // lengthen the span over which values are live, so if this needs more
+    // slots than the evaluators provide, fall back to the plain order.
+    MPR_TRACE("build_flat");
+    std::vector<uint64_t> flat;
+    flat.reserve(nodes.size() + 4);
+    num_slots = build_flat(groups, nodes, ops, values, lhs, rhs, axes, root,
+                           MAX_SLOTS, flat, vars);
+    if (!num_slots) {
+        std::vector<int32_t> ordered;
+        if (groups.size() > 1) {
+            std::vector<bool> done(nodes.size(), false);
+            for (auto i : schedule_nodes(lhs, rhs, need, {root}, done)) {
+                if (is_clause(ops[i])) {
+                    ordered.push_back(i);
+                }
+            }
+        } else {
+            ordered = groups[0];
+        }
+        num_slots = build_flat({ordered}, nodes, ops, values, lhs, rhs,
+                               axes, root, MAX_SLOTS, flat, vars);
+        if (!num_slots) {
+            // A tape with more slots would overflow the evaluators' stack
+            // arrays, so we emit an empty model instead.
+            fprintf(stderr, "Ran out of slots (the tape needs more than %d); "
+                            "using an empty tape instead\n", MAX_SLOTS);
+            uint64_t clause = 0;
+            OP(&clause) = GPU_OP_COPY_IMM;
+            I_OUT(&clause) = 1;
+            IMM(&clause) = 1.0f;
+            uint64_t end = 0;
+            I_OUT(&end) = 1;
+            flat = {0, clause, end};
+            vars.clear();
+            num_slots = 2;
+        }
+    }
+
     data.reset(CUDA_MALLOC(uint64_t, flat.size()));
     CUDA_CHECK(cudaMemcpy(data.get(), flat.data(),
                           sizeof(uint64_t) * flat.size(),
@@ -227,5 +733,215 @@ Tape::Tape(const libfive::Tree& tree) {
     length = flat.size();
 }
 
-} // namespace mpr
+////////////////////////////////////////////////////////////////////////////////
+
+// Evaluates a single clause with constant arguments, for constant folding
+static float eval_constant(uint8_t op, float lhs, float rhs, float imm) {
+    switch (op) {
+        case GPU_OP_SQUARE_LHS: return lhs * lhs;
+        case GPU_OP_SQRT_LHS:   return sqrtf(lhs);
+        case GPU_OP_NEG_LHS:    return -lhs;
+        case GPU_OP_SIN_LHS:    return sinf(lhs);
+        case GPU_OP_COS_LHS:    return cosf(lhs);
+        case GPU_OP_ASIN_LHS:   return asinf(lhs);
+        case GPU_OP_ACOS_LHS:   return acosf(lhs);
+        case GPU_OP_ATAN_LHS:   return atanf(lhs);
+        case GPU_OP_EXP_LHS:    return expf(lhs);
+        case GPU_OP_ABS_LHS:    return fabsf(lhs);
+        case GPU_OP_LOG_LHS:    return logf(lhs);
+
+        case GPU_OP_ADD_LHS_IMM: return lhs + imm;
+        case GPU_OP_ADD_LHS_RHS: return lhs + rhs;
+        case GPU_OP_MUL_LHS_IMM: return lhs * imm;
+        case GPU_OP_MUL_LHS_RHS: return lhs * rhs;
+        case GPU_OP_MIN_LHS_IMM: return fminf(lhs, imm);
+        case GPU_OP_MIN_LHS_RHS: return fminf(lhs, rhs);
+        case GPU_OP_MAX_LHS_IMM: return fmaxf(lhs, imm);
+        case GPU_OP_MAX_LHS_RHS: return fmaxf(lhs, rhs);
+
+        case GPU_OP_SUB_LHS_IMM: return lhs - imm;
+        case GPU_OP_SUB_IMM_RHS: return imm - rhs;
+        case GPU_OP_SUB_LHS_RHS: return lhs - rhs;
+        case GPU_OP_DIV_LHS_IMM: return lhs / imm;
+        case GPU_OP_DIV_IMM_RHS: return imm / rhs;
+        case GPU_OP_DIV_LHS_RHS: return lhs / rhs;
+
+        case GPU_OP_COPY_IMM: return imm;
+        case GPU_OP_COPY_LHS: return lhs;
+        case GPU_OP_COPY_RHS: return rhs;
+        case GPU_OP_TAG_LHS: return lhs;
 
+        default:
+            fprintf(stderr, "Cannot fold opcode %s\n", gpu_op_str(op));
+            return 0.0f;
+    }
+}
+
+static bool uses_lhs(uint8_t op) {
+    return (op >= GPU_OP_SQUARE_LHS && op <= GPU_OP_LOG_LHS) ||
+           (op >= GPU_OP_ADD_LHS_IMM && op <= GPU_OP_MAX_LHS_RHS) ||
+           op == GPU_OP_SUB_LHS_IMM || op == GPU_OP_SUB_LHS_RHS ||
+           op == GPU_OP_DIV_LHS_IMM || op == GPU_OP_DIV_LHS_RHS ||
+           op == GPU_OP_COPY_LHS || op == GPU_OP_TAG_LHS;
+}
+
+static bool uses_rhs(uint8_t op) {
+    return op == GPU_OP_ADD_LHS_RHS || op == GPU_OP_MUL_LHS_RHS ||
+           op == GPU_OP_MIN_LHS_RHS || op == GPU_OP_MAX_LHS_RHS ||
+           op == GPU_OP_SUB_IMM_RHS || op == GPU_OP_SUB_LHS_RHS ||
+           op == GPU_OP_DIV_IMM_RHS || op == GPU_OP_DIV_LHS_RHS ||
+           op == GPU_OP_COPY_RHS;
+}
+
+std::vector<uint64_t> Tape::specialize(const uint64_t* data, int32_t length,
+                                       unsigned axis, float value)
+{
+    std::vector<uint64_t> out(data, data + length);
+    if (axis > 2) {
+        fprintf(stderr, "Invalid axis %u for specialization\n", axis);
+        return out;
+    }
+    const uint8_t axis_slot = ((const uint8_t*)data)[axis + 1];
+    if (axis_slot == 0) {
+        return out;
+    }
+
+    // Track which slots hold constant values.  Slots are reused once their
+    // previous value is dead, so a non-constant clause clears the flag.
+    bool is_const[256] = {false};
+    float consts[256];
+    is_const[axis_slot] = true;
+    consts[axis_slot] = value;
+
+    out.resize(1);
+    ((uint8_t*)&out[0])[axis + 1] = 0;
+
+    for (int32_t i=1; i < length - 1; ++i) {
+        uint64_t clause = data[i];
+        const uint8_t op = OP(&clause);
+        if (op == GPU_OP_JUMP) {
+            fprintf(stderr, "Cannot specialize a pushed tape\n");
+            return std::vector<uint64_t>(data, data + length);
+        } else if (op == GPU_OP_MARK_X || op == GPU_OP_MARK_XY) {
+            // Specializing never adds an axis dependency, so the groups
+            // which these markers separate remain valid.
+            out.push_back(clause);
+            continue;
+        } else if (op == GPU_OP_TAG_LHS && is_const[I_LHS(&clause)]) {
+            // Tags are never folded away, so that outputs can still be
+            // identified: we load the constant, then tag it in place.
+            const uint8_t i_out = I_OUT(&clause);
+            uint64_t copy = 0;
+            OP(&copy) = GPU_OP_COPY_IMM;
+            I_OUT(&copy) = i_out;
+            IMM(&copy) = consts[I_LHS(&clause)];
+            out.push_back(copy);
+
+            I_LHS(&clause) = i_out;
+            is_const[i_out] = false;
+            out.push_back(clause);
+            continue;
+        }
+
+        const uint8_t i_lhs = I_LHS(&clause);
+        const uint8_t i_rhs = I_RHS(&clause);
+        const bool lhs_const = uses_lhs(op) && is_const[i_lhs];
+        const bool rhs_const = uses_rhs(op) && is_const[i_rhs];
+
+        // If every argument is constant, then fold this clause away
+        if (lhs_const == uses_lhs(op) && rhs_const == uses_rhs(op)) {
+            const uint8_t i_out = I_OUT(&clause);
+            consts[i_out] = eval_constant(op,
+                    lhs_const ? consts[i_lhs] : 0.0f,
+                    rhs_const ? consts[i_rhs] : 0.0f,
+                    IMM(&clause));
+            is_const[i_out] = true;
+            continue;
+        }
+
+        // Otherwise, convert one constant argument into an immediate
+        if (lhs_const || rhs_const) {
+            const float imm = lhs_const ? consts[i_lhs] : consts[i_rhs];
+            switch (op) {
+                case GPU_OP_ADD_LHS_RHS:
+                case GPU_OP_MUL_LHS_RHS:
+                case GPU_OP_MIN_LHS_RHS:
+                case GPU_OP_MAX_LHS_RHS:
+                    // Each *_LHS_IMM opcode immediately precedes *_LHS_RHS,
+                    // and the non-immediate argument is always the LHS
+                    OP(&clause) = op - 1;
+                    I_LHS(&clause) = lhs_const ? i_rhs : i_lhs;
+                    I_RHS(&clause) = 0;
+                    break;
+                case GPU_OP_SUB_LHS_RHS:
+                case GPU_OP_DIV_LHS_RHS:
+                    if (lhs_const) {
+                        OP(&clause) = (op == GPU_OP_SUB_LHS_RHS)
+                            ? GPU_OP_SUB_IMM_RHS : GPU_OP_DIV_IMM_RHS;
+                        I_LHS(&clause) = 0;
+                    } else {
+                        OP(&clause) = (op == GPU_OP_SUB_LHS_RHS)
+                            ? GPU_OP_SUB_LHS_IMM : GPU_OP_DIV_LHS_IMM;
+                        I_RHS(&clause) = 0;
+                    }
+                    break;
+                default:
+                    fprintf(stderr, "Unexpected constant argument to %s\n",
+                            gpu_op_str(op));
+                    break;
+            }
+            IMM(&clause) = imm;
+        }
+        is_const[I_OUT(&clause)] = false;
+        out.push_back(clause);
+    }
+
+    // If the result is constant, then we need one clause to write it
+    const uint64_t end = data[length - 1];
+    if (is_const[I_OUT(&end)]) {
+        uint64_t clause = 0;
+        OP(&clause) = GPU_OP_COPY_IMM;
+        I_OUT(&clause) = I_OUT(&end);
+        IMM(&clause) = consts[I_OUT(&end)];
+        out.push_back(clause);
+    }
+    out.push_back(end);
+
+    return out;
+}
+
+Tape::Tape(const Tape& tape, unsigned axis, float value) {
+    MPR_TRACE("Tape (specialize)");
+    auto flat = specialize(tape.data.get(), tape.length, axis, value);
+    data.reset(CUDA_MALLOC(uint64_t, flat.size()));
+    CUDA_CHECK(cudaMemcpy(data.get(), flat.data(),
+                          sizeof(uint64_t) * flat.size(),
+                          cudaMemcpyHostToDevice));
+    length = flat.size();
+
+    // Specializing never adds clauses, so it can't need more slots
+    num_slots = tape.num_slots;
+    num_outputs = tape.num_outputs;
+}
+
+bool Tape::setVar(const void* var, float value) {
+    auto itr = vars.find(var);
+    if (itr == vars.end()) {
+        return false;
+    }
+    IMM(&data[itr->second]) = value;
+    return true;
+}
+
+float Tape::getVar(const void* var) const {
+    auto itr = vars.find(var);
+    return (itr == vars.end()) ? 0.0f : IMM(&data[itr->second]);
+}
+
+MemoryUsage Tape::memoryUsage() const {
+    MemoryUsage out;
+    out.add("data", sizeof(uint64_t) * length);
+    return out;
+}
+
+} // namespace mpr
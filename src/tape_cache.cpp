@@ -0,0 +1,277 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <cstring>
+
+#include "libfive/tree/tree.hpp"
+
+#include "octree.hpp"
+#include "tape.hpp"
+#include "tape_cache.hpp"
+#include "trace.hpp"
+
+namespace mpr {
+
+// Mixes a value into a running hash (using the splitmix64 finalizer, which
+// spreads every input bit across the output)
+static uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ *  Walks the trees in post-order, returning their structural hash.  If
+ *  fingerprint isn't null, it's filled with a canonical description of the
+ *  trees: three words per node (opcode, constant bits or free variable
+ *  pointer, and the post-order indices of its children), followed by the
+ *  index of each shape's root.  Hashes can collide, but fingerprints only
+ *  match if the trees are actually equal.
+ */
+static uint64_t walk(const std::vector<libfive::Tree>& shapes,
+                     std::vector<uint64_t>* fingerprint)
+{
+    using namespace libfive::Opcode;
+
+    // Hashes and post-order indices of nodes which have been visited, so
+    // that shared subtrees are only hashed once (like ordered_dfs in
+    // tape.cpp, this only borrows raw pointers from the tree)
+    std::unordered_map<libfive::Tree::Id,
+                       std::pair<uint64_t, uint32_t>> done;
+    std::vector<std::pair<libfive::Tree::Id, bool>> todo;
+
+    uint64_t out = mix(0, shapes.size());
+    std::vector<uint32_t> roots;
+    for (auto& s : shapes) {
+        todo.push_back({s.id(), false});
+        while (todo.size()) {
+            const auto t = todo.back();
+            todo.pop_back();
+            if (done.count(t.first)) {
+                continue;
+            }
+
+            const auto lhs = t.first->lhs.get();
+            const auto rhs = t.first->rhs.get();
+            if (!t.second && (lhs || rhs)) {
+                todo.push_back({t.first, true});
+                if (rhs) {
+                    todo.push_back({rhs, false});
+                }
+                if (lhs) {
+                    todo.push_back({lhs, false});
+                }
+                continue;
+            }
+
+            uint64_t payload = 0;
+            if (t.first->op == CONSTANT) {
+                uint32_t bits;
+                memcpy(&bits, &t.first->value, sizeof(bits));
+                payload = bits;
+            } else if (t.first->op == VAR_FREE) {
+                payload = reinterpret_cast<uintptr_t>(t.first);
+            }
+            uint64_t h = mix(0, t.first->op);
+            if (t.first->op == CONSTANT || t.first->op == VAR_FREE) {
+                h = mix(h, payload);
+            }
+            h = mix(h, lhs ? done.at(lhs).first : 0);
+            h = mix(h, rhs ? done.at(rhs).first : 0);
+
+            const uint32_t i = done.size();
+            if (fingerprint) {
+                const uint64_t a = lhs ? done.at(lhs).second + 1 : 0;
+                const uint64_t b = rhs ? done.at(rhs).second + 1 : 0;
+                fingerprint->push_back(t.first->op);
+                fingerprint->push_back(payload);
+                fingerprint->push_back(a | (b << 32));
+            }
+            done.insert({t.first, {h, i}});
+        }
+        const auto& root = done.at(s.id());
+        out = mix(out, root.first);
+        roots.push_back(root.second);
+    }
+    if (fingerprint) {
+        fingerprint->insert(fingerprint->end(), roots.begin(), roots.end());
+    }
+    return out;
+}
+
+uint64_t TapeCache::hash(const std::vector<libfive::Tree>& shapes) {
+    return walk(shapes, nullptr);
+}
+
+TapeCache::TapeCache(size_t max_bytes)
+    : max_bytes(max_bytes)
+{
+    // Nothing to do here
+}
+
+TapeCache& TapeCache::instance() {
+    static TapeCache cache(256 * 1024 * 1024);
+    return cache;
+}
+
+std::shared_ptr<Tape> TapeCache::get(const libfive::Tree& tree,
+                                     unsigned threads, bool schedule)
+{
+    return get(std::vector<libfive::Tree>{tree}, threads, schedule);
+}
+
+std::shared_ptr<Tape> TapeCache::get(const std::vector<libfive::Tree>& shapes,
+                                     unsigned threads, bool schedule)
+{
+    MPR_TRACE("TapeCache::get");
+    std::vector<uint64_t> fingerprint;
+    const uint64_t key = mix(walk(shapes, &fingerprint), schedule);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = index.find(key);
+        if (itr != index.end() && itr->second->fingerprint == fingerprint) {
+            num_hits++;
+            entries.splice(entries.begin(), entries, itr->second);
+            return itr->second->tape;
+        }
+        num_misses++;
+    }
+
+    // Build the tape without holding the lock, since it's slow
+    std::shared_ptr<Tape> tape(new Tape(shapes, threads, schedule));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itr = index.find(key);
+    if (itr != index.end()) {
+        if (itr->second->fingerprint == fingerprint) {
+            // Another thread built the same tape while we were working
+            entries.splice(entries.begin(), entries, itr->second);
+            return itr->second->tape;
+        }
+        // Otherwise, the hash collided with a different model, which is
+        // replaced by the newer one.
+        erase(itr->second);
+    }
+    const size_t bytes = tape->memoryUsage().bytes();
+    entries.push_front({key, std::move(fingerprint), tape, {}, bytes});
+    index.insert({key, entries.begin()});
+    keys.insert({tape.get(), key});
+    total_bytes += bytes;
+    evict();
+    return tape;
+}
+
+std::shared_ptr<Octree> TapeCache::octree(
+        const std::shared_ptr<Tape>& tape, Context& ctx, int32_t depth,
+        const Eigen::Vector3f& lower, const Eigen::Vector3f& upper)
+{
+    // Octrees are pruned with the tape's free variables at their current
+    // values, which any holder of the shared tape may have changed since,
+    // so the values are part of the octree's key.
+    std::vector<float> vars;
+    for (auto& v : tape->vars) {
+        vars.push_back(tape->getVar(v.first));
+    }
+
+    auto find = [&]() -> std::list<Entry>::iterator {
+        auto k = keys.find(tape.get());
+        return (k == keys.end()) ? entries.end() : index.at(k->second);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = find();
+        if (itr != entries.end()) {
+            for (auto& o : itr->octrees) {
+                if (o.depth == depth && o.lower == lower &&
+                    o.upper == upper && o.vars == vars)
+                {
+                    num_hits++;
+                    entries.splice(entries.begin(), entries, itr);
+                    return o.octree;
+                }
+            }
+        }
+        num_misses++;
+    }
+
+    std::shared_ptr<Octree> out(new Octree(*tape, ctx, depth, lower, upper));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itr = find();
+    if (itr != entries.end()) {
+        auto octree_bytes = [](const Octree& o) {
+            return sizeof(uint64_t) * o.tape_length +
+                   sizeof(int32_t) * Octree::numCells(o.depth);
+        };
+        // An octree with the same bounds but older variable values is
+        // stale, so it's replaced rather than kept alongside the new one.
+        auto& octrees = itr->octrees;
+        for (auto o = octrees.begin(); o != octrees.end(); ++o) {
+            if (o->depth == depth && o->lower == lower && o->upper == upper) {
+                itr->bytes -= octree_bytes(*o->octree);
+                total_bytes -= octree_bytes(*o->octree);
+                octrees.erase(o);
+                break;
+            }
+        }
+        octrees.push_back({depth, lower, upper, vars, out});
+        itr->bytes += octree_bytes(*out);
+        total_bytes += octree_bytes(*out);
+        entries.splice(entries.begin(), entries, itr);
+        evict();
+    }
+    return out;
+}
+
+void TapeCache::erase(std::list<Entry>::iterator itr) {
+    total_bytes -= itr->bytes;
+    index.erase(itr->key);
+    keys.erase(itr->tape.get());
+    entries.erase(itr);
+}
+
+void TapeCache::evict() {
+    while (total_bytes > max_bytes && entries.size() > 1) {
+        erase(std::prev(entries.end()));
+    }
+}
+
+void TapeCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    keys.clear();
+    total_bytes = 0;
+    num_hits = 0;
+    num_misses = 0;
+}
+
+size_t TapeCache::hits() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_hits;
+}
+
+size_t TapeCache::misses() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_misses;
+}
+
+size_t TapeCache::bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return total_bytes;
+}
+
+}   // namespace mpr
@@ -0,0 +1,217 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.hpp"
+#include "util.hpp"
+
+namespace mpr {
+
+std::atomic<bool> Trace::recording(false);
+std::atomic<bool> Trace::counting(false);
+
+// A single complete event, with times in microseconds since start()
+struct TraceEvent {
+    const char* name;
+    unsigned tid;
+    double ts;
+    double dur;
+
+    // Performance counter deltas, if has_counters is set
+    bool has_counters;
+    uint64_t counters[PerfCounters::NUM_COUNTERS];
+};
+
+// Recorded events, which are only touched with the lock held
+static std::mutex trace_mutex;
+static std::vector<TraceEvent> trace_events;
+static std::map<std::thread::id, unsigned> trace_threads;
+static std::chrono::steady_clock::time_point trace_start;
+
+void Trace::start(bool counters) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.clear();
+    trace_threads.clear();
+    trace_start = std::chrono::steady_clock::now();
+    counting.store(counters);
+    recording.store(true);
+}
+
+bool Trace::stop(const char* filename) {
+    recording.store(false);
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "Could not open trace file %s\n", filename);
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (auto& t : trace_threads) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+                   "\"pid\": 1, \"tid\": %u, "
+                   "\"args\": {\"name\": \"thread %u\"}}",
+                first ? "" : ",\n", t.second, t.second);
+        first = false;
+    }
+    for (auto& e : trace_events) {
+        fprintf(f, "%s{\"name\": \"%s\", \"cat\": \"mpr\", \"ph\": \"X\", "
+                   "\"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                first ? "" : ",\n", e.name, e.tid, e.ts, e.dur);
+        if (e.has_counters) {
+            // Counters show up in the event's details panel
+            fprintf(f, ", \"args\": {");
+            bool first_arg = true;
+            for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+                if (e.counters[i] != PerfCounters::UNAVAILABLE) {
+                    fprintf(f, "%s\"%s\": %llu", first_arg ? "" : ", ",
+                            PerfCounters::name(i),
+                            (unsigned long long)e.counters[i]);
+                    first_arg = false;
+                }
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "}");
+        first = false;
+    }
+    fprintf(f, "\n]}\n");
+
+    const bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Could not write trace file %s\n", filename);
+    }
+    return ok;
+}
+
+void Trace::summary(FILE* f) {
+    struct Total {
+        unsigned calls = 0;
+        double ms = 0;
+        unsigned counted = 0;
+        uint64_t counters[PerfCounters::NUM_COUNTERS] = {0};
+    };
+
+    // Totals are sorted by name, which groups related stages together
+    std::map<std::string, Total> totals;
+    bool any_counters = false;
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        for (auto& e : trace_events) {
+            auto& t = totals[e.name];
+            t.calls++;
+            t.ms += e.dur / 1000.0;
+            if (e.has_counters) {
+                t.counted++;
+                any_counters = true;
+                for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+                    if (e.counters[i] == PerfCounters::UNAVAILABLE ||
+                        t.counters[i] == PerfCounters::UNAVAILABLE)
+                    {
+                        t.counters[i] = PerfCounters::UNAVAILABLE;
+                    } else {
+                        t.counters[i] += e.counters[i];
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(f, "%-20s %8s %10s", "stage", "calls", "ms");
+    if (any_counters) {
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            fprintf(f, " %14s", PerfCounters::name(i));
+        }
+        fprintf(f, " %6s", "ipc");
+    }
+    fprintf(f, "\n");
+
+    for (auto& t : totals) {
+        fprintf(f, "%-20s %8u %10.3f", t.first.c_str(),
+                t.second.calls, t.second.ms);
+        if (any_counters && t.second.counted) {
+            const uint64_t* c = t.second.counters;
+            for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+                if (c[i] == PerfCounters::UNAVAILABLE) {
+                    fprintf(f, " %14s", "-");
+                } else {
+                    fprintf(f, " %14llu", (unsigned long long)c[i]);
+                }
+            }
+            if (c[PerfCounters::CYCLES] != PerfCounters::UNAVAILABLE &&
+                c[PerfCounters::INSTRUCTIONS] != PerfCounters::UNAVAILABLE &&
+                c[PerfCounters::CYCLES])
+            {
+                fprintf(f, " %6.2f", double(c[PerfCounters::INSTRUCTIONS]) /
+                                     c[PerfCounters::CYCLES]);
+            }
+        }
+        fprintf(f, "\n");
+    }
+}
+
+void Trace::Scope::begin() {
+    if (gpu) {
+        CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+    }
+    // Read counters last, so that they don't include the time to read them
+    counting = !gpu && Trace::counting.load() && PerfCounters::read(counters);
+    start = std::chrono::steady_clock::now();
+}
+
+void Trace::Scope::end() {
+    if (gpu) {
+        CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+    }
+    const auto now = std::chrono::steady_clock::now();
+
+    uint64_t deltas[PerfCounters::NUM_COUNTERS];
+    if (counting && PerfCounters::read(deltas)) {
+        for (unsigned i=0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            if (deltas[i] != PerfCounters::UNAVAILABLE) {
+                deltas[i] -= counters[i];
+            }
+        }
+    } else {
+        counting = false;
+    }
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if (!recording.load()) {
+        return;
+    }
+    auto itr = trace_threads.find(std::this_thread::get_id());
+    if (itr == trace_threads.end()) {
+        itr = trace_threads.insert({std::this_thread::get_id(),
+                                    trace_threads.size()}).first;
+    }
+
+    using us = std::chrono::duration<double, std::micro>;
+    TraceEvent e = {name, itr->second,
+                    us(start - trace_start).count(),
+                    us(now - start).count(), counting, {0}};
+    if (counting) {
+        std::copy(deltas, deltas + PerfCounters::NUM_COUNTERS, e.counters);
+    }
+    trace_events.push_back(e);
+}
+
+}   // namespace mpr
@@ -0,0 +1,108 @@
+/*
+Reference implementation for
+"Massively Parallel Rendering of Complex Closed-Form Implicit Surfaces"
+(SIGGRAPH 2020)
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+
+Copyright (C) 2019-2020  Matt Keeter
+*/
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "util.hpp"
+
+// Sizes of live allocations, so that frees can be subtracted from the tally.
+// These are only touched with the lock held.
+static std::mutex alloc_mutex;
+static std::unordered_map<void*, size_t> alloc_sizes;
+static size_t alloc_bytes = 0;
+static size_t alloc_peak_bytes = 0;
+
+void cudaTrackAlloc(void* ptr, size_t bytes) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    alloc_sizes[ptr] = bytes;
+    alloc_bytes += bytes;
+    alloc_peak_bytes = std::max(alloc_peak_bytes, alloc_bytes);
+}
+
+void cudaTrackFree(void* ptr) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    auto itr = alloc_sizes.find(ptr);
+    if (itr != alloc_sizes.end()) {
+        alloc_bytes -= itr->second;
+        alloc_sizes.erase(itr);
+    }
+}
+
+size_t cudaBytesAllocated() {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    return alloc_bytes;
+}
+
+size_t cudaPeakBytesAllocated() {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    return alloc_peak_bytes;
+}
+
+static std::atomic<bool> prefer_device(true);
+
+void cudaSetPreferDevice(bool enabled) {
+    prefer_device.store(enabled);
+}
+
+void cudaPreferDevice(void* ptr, size_t bytes) {
+    if (!ptr || !bytes || !prefer_device.load()) {
+        return;
+    }
+
+    int device = 0;
+    int concurrent = 0;
+    CUDA_CHECK(cudaGetDevice(&device));
+    CUDA_CHECK(cudaDeviceGetAttribute(
+            &concurrent, cudaDevAttrConcurrentManagedAccess, device));
+    if (!concurrent) {
+        return;
+    }
+
+    // These are only hints, so failures leave the buffer as plain managed
+    // memory (clearing the error so that it isn't reported later).
+    if (cudaMemAdvise(ptr, bytes, cudaMemAdviseSetPreferredLocation,
+                      device) != cudaSuccess ||
+        cudaMemPrefetchAsync(ptr, bytes, device,
+                             cudaStreamPerThread) != cudaSuccess)
+    {
+        cudaGetLastError();
+    }
+}
+
+namespace mpr {
+
+size_t MemoryUsage::bytes() const {
+    size_t out = 0;
+    for (auto& b : buffers) {
+        out += b.bytes;
+    }
+    return out;
+}
+
+size_t MemoryUsage::peak_bytes() const {
+    size_t out = 0;
+    for (auto& b : buffers) {
+        out += b.peak_bytes;
+    }
+    return out;
+}
+
+void MemoryUsage::print(FILE* f) const {
+    for (auto& b : buffers) {
+        fprintf(f, "%-20s %12zu %12zu\n", b.name, b.bytes, b.peak_bytes);
+    }
+    fprintf(f, "%-20s %12zu %12zu\n", "total", bytes(), peak_bytes());
+}
+
+}   // namespace mpr